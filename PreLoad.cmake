@@ -5,7 +5,7 @@ set(TOOLCHAIN_VER "rsdk-4.8.5-5281-EL-3.10-u0.9.33-m32fut-161202" CACHE STRING "
 
 # Extract the source code
 set(TOOLCHAIN_FOLDER "${CMAKE_SOURCE_DIR}/third-party/rsdk/${TOOLCHAIN_VER}" CACHE PATH "RSDK toolchain folder")
-if(NOT EXISTS "${TOOLCHAIN_FOLDER}")
+if(NOT IMAGER_SIMULATOR AND NOT EXISTS "${TOOLCHAIN_FOLDER}")
     message(STATUS "Extracting rsdk toolchain version ${TOOLCHAIN_VER}")
     file(ARCHIVE_EXTRACT
             INPUT "${TOOLCHAIN_FOLDER}.tar.gz"
@@ -0,0 +1,51 @@
+#ifndef BITRATE_CONTROLLER_H
+#define BITRATE_CONTROLLER_H
+
+#include <stdint.h>
+#include <liveMedia.hh>
+#include <frame_ring_source.h>
+
+// How often the receiver reports are looked at, clients send one every ~5 s
+#define ABR_INTERVAL_MS 2000
+// Fraction lost in a receiver report, out of 256: above HIGH the rate goes
+// down, it only goes back up after ABR_STABLE_INTERVALS reports below LOW
+#define ABR_LOSS_HIGH 13 // ~5%
+#define ABR_LOSS_LOW 3   // ~1%
+#define ABR_JITTER_HIGH_MS 50
+#define ABR_STABLE_INTERVALS 3
+// Cut quickly on loss, recover in smaller steps
+#define ABR_DECREASE_PERCENT 75
+#define ABR_INCREASE_PERCENT 110
+
+// Adapts the encoder of one stream to its worst receiver. Loss and jitter
+// come from the RTCP receiver reports of the reader's sinks; the new max
+// bitrate, and with a minimum fps set the sensor frame rate, go to the
+// streamer over the control channel. The bitrate never drops below
+// minBitrate, fps is only lowered once it has reached that floor.
+class BitrateController {
+public:
+    BitrateController(UsageEnvironment& env, FrameRingReader& reader, uint32_t minBitrate, uint32_t maxBitrate,
+                      unsigned minFps, unsigned maxFps);
+    ~BitrateController();
+
+private:
+    static void evaluate(void* clientData);
+    void evaluate();
+    void decrease();
+    void increase();
+    void apply(uint32_t bitrate, unsigned fps);
+
+    UsageEnvironment& fEnv;
+    FrameRingReader& fReader;
+    uint32_t fMinBitrate;
+    uint32_t fMaxBitrate;
+    unsigned fMinFps; // 0 leaves the frame rate alone
+    unsigned fMaxFps;
+    uint32_t fBitrate;
+    unsigned fFps;
+    unsigned fStableIntervals;
+    struct timeval fLastEvaluation;
+    TaskToken fTask;
+};
+
+#endif //BITRATE_CONTROLLER_H
@@ -0,0 +1,26 @@
+#ifndef CONFIG_WATCH_H
+#define CONFIG_WATCH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Notices when streamer.ini is rewritten, so the binaries can reload it
+// without restarting. The directory is watched rather than the file:
+// editors and sed -i replace the file with a rename, which would leave a
+// watch on the old inode behind. Only completed writes are reported, a
+// reload never reads a half written file.
+
+// Returns a non-blocking inotify fd to poll for POLLIN, -1 on failure
+int config_watch_open(const char *path);
+// Drains the pending events, true when any of them was about the file
+uint8_t config_watch_changed(int fd, const char *path);
+void config_watch_close(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CONFIG_WATCH_H
@@ -0,0 +1,74 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Control channel into imager_streamer, used by rtsp_server and by
+// rtsp_control for live reconfiguration. Messages are fixed size datagrams
+// on a UNIX socket. The server sends fire and forget from an unbound
+// socket, a request lost while the streamer restarts is simply not acted
+// on; a sender with an address gets a reply carrying the outcome.
+
+#define CONTROL_SOCKET "/tmp/rtsp_streamer_ctrl.sock"
+
+enum control_cmd {
+    CONTROL_CMD_KEY_FRAME = 1, // Request an IDR, rate limited by the streamer
+    CONTROL_CMD_BITRATE = 2,   // Set the encoder's max bitrate to value bps, clamped to the configured range
+    CONTROL_CMD_FPS = 3,       // Set the sensor to value fps, only honoured for the main stream
+    CONTROL_CMD_ISP = 4,       // Set ISP control id (enum_rts_video_ctrl_id) to value, within the range the ISP reports
+    CONTROL_CMD_GOP = 5,       // Set the frames between IDRs to value
+    CONTROL_CMD_ROI = 6,       // Set region id to rect with QP delta value, an empty rect disables it
+};
+
+// Set in the cmd of a reply
+#define CONTROL_REPLY 0x80
+
+enum control_status {
+    CONTROL_OK = 0,
+    CONTROL_ERR_UNKNOWN = 1, // No such command, stream, control or region
+    CONTROL_ERR_RANGE = 2,   // Value outside what the hardware accepts, nothing changed
+    CONTROL_ERR_FAILED = 3,  // The SDK refused the change
+};
+
+struct control_msg {
+    uint8_t cmd;
+    uint8_t stream;    // Index of the video stream, 0 is the main stream
+    uint8_t status;    // Replies only, enum control_status
+    uint8_t reserved;
+    uint32_t id;       // CONTROL_CMD_ISP: the control, CONTROL_CMD_ROI: the region index
+    int32_t value;     // In a reply, the value now in effect
+    uint16_t rect[4];  // CONTROL_CMD_ROI: left, top, right and bottom in pixels
+};
+
+// Where a request came from, empty for senders that want no reply
+typedef struct {
+    struct sockaddr_un addr;
+    socklen_t len;
+} control_peer;
+
+// Streamer side, returns a non-blocking socket bound to CONTROL_SOCKET, 0600
+int control_listen(void);
+// Returns 1 and fills msg while requests are pending, from may be NULL
+uint8_t control_recv(int fd, struct control_msg *msg, control_peer *from);
+// Sends msg back as the reply to a request from peer, if it has an address
+void control_reply(int fd, const control_peer *peer, struct control_msg *msg, uint8_t status);
+
+// Server side
+int control_connect(void);
+uint8_t control_send(int fd, uint8_t cmd, uint8_t stream, uint32_t value);
+// Sends a request from a socket of its own and waits up to timeout_ms for the reply
+uint8_t control_request(const struct control_msg *msg, struct control_msg *reply, int timeout_ms);
+
+void control_close(int fd, uint8_t listener);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //CONTROL_H
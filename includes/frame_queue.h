@@ -0,0 +1,32 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <stdint.h>
+#include <rtsavdef.h>
+
+// Bounded lock-free queue of encoder buffers from the capture loop (single
+// producer) to the writer thread (single consumer). A buffer is owned by
+// the queue from frame_queue_push() until frame_queue_pop() hands it to the
+// writer, which releases it with hal_put_buffer() once written.
+
+#define FRAME_QUEUE_SIZE 16 // Must be a power of two
+
+struct frame_queue_entry {
+    struct rts_av_buffer *buffer;
+    uint64_t recv_time; // When the capture loop received it, for the latency stats
+};
+
+typedef struct {
+    struct frame_queue_entry entries[FRAME_QUEUE_SIZE];
+    // Each index is only written by one side, kept on separate cache lines
+    uint32_t head __attribute__((aligned(64))); // Next slot to push
+    uint32_t tail __attribute__((aligned(64))); // Next slot to pop
+} frame_queue;
+
+void frame_queue_init(frame_queue *queue);
+// Returns RTS_FALSE when the queue is full, the caller keeps the buffer
+uint8_t frame_queue_push(frame_queue *queue, struct rts_av_buffer *buffer, uint64_t recv_time);
+// Returns NULL when the queue is empty
+struct rts_av_buffer *frame_queue_pop(frame_queue *queue, uint64_t *recv_time);
+
+#endif //FRAME_QUEUE_H
@@ -0,0 +1,90 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shared-memory ring of encoded frames between imager_streamer (single producer)
+// and rtsp_server (any number of readers). Frames are copied into the ring once
+// and readers consume them in place.
+//
+// The ring outlives a producer that dies, so readers keep their mapping and
+// their position across a streamer crash. A producer that stops cleanly marks
+// the ring closed and removes it; readers then attach to the next one.
+//
+// Slot descriptors and frame data are published with a sequence lock: the
+// producer invalidates a slot, writes it, then publishes its sequence number.
+// A reader copies the descriptor, reads the payload, then calls
+// frame_ring_valid() to confirm the producer has not lapped it in the meantime.
+
+#define FRAME_RING_SLOTS 128                // Must be a power of two
+#define FRAME_RING_DATA_SIZE (1024 * 1024)  // Must be a power of two
+#define FRAME_RING_MAX_NALS 8               // A frame with more NALs before its slice is stored without any
+
+#define FRAME_RING_SEQ_INVALID 0xffffffff
+
+#define FRAME_RING_FLAG_KEY (1 << 0)
+
+enum frame_ring_status {
+    FRAME_RING_OK = 0,
+    FRAME_RING_EMPTY,   // The requested frame has not been written yet
+    FRAME_RING_OVERRUN, // The requested frame has already been overwritten
+};
+
+struct frame_ring_nal {
+    uint32_t offset; // Offset of the NAL header from the start of the frame (start code skipped)
+    uint32_t size;   // Size of the NAL unit without its start code
+};
+
+typedef struct {
+    uint32_t seq;
+    uint32_t pos;    // Logical position of the frame in the data area
+    uint32_t size;
+    uint32_t flags;
+    uint64_t timestamp;
+    uint64_t recv_time;  // CLOCK_MONOTONIC us when the streamer got the frame from the encoder
+    uint64_t write_time; // CLOCK_MONOTONIC us when the frame was written to the ring
+    uint32_t nal_count;
+    struct frame_ring_nal nals[FRAME_RING_MAX_NALS];
+    const uint8_t *data;
+} frame_ring_frame;
+
+typedef struct frame_ring frame_ring;
+typedef void (*frame_ring_notify)(void *priv);
+
+// Name of ring n of a family, the base name itself for n = 0
+void frame_ring_name(const char *base, int index, char *name, size_t size);
+
+// Producer side
+frame_ring *frame_ring_create(const char *name);
+uint8_t frame_ring_write(frame_ring *ring, const void *data, uint32_t size, uint32_t flags, uint64_t timestamp, uint64_t recv_time);
+// Calls notify from the producer after each frame instead of ringing the
+// doorbell, for readers living in the same process. Set it before writing.
+void frame_ring_set_notify(frame_ring *ring, frame_ring_notify notify, void *priv);
+
+// Consumer side
+frame_ring *frame_ring_open(const char *name);
+int frame_ring_doorbell(frame_ring *ring);
+void frame_ring_drain_doorbell(frame_ring *ring);
+uint32_t frame_ring_head(const frame_ring *ring);
+uint32_t frame_ring_last_key(const frame_ring *ring);
+enum frame_ring_status frame_ring_peek(const frame_ring *ring, uint32_t seq, frame_ring_frame *frame);
+uint8_t frame_ring_valid(const frame_ring *ring, const frame_ring_frame *frame);
+// True once the producer stopped cleanly, a restarted one writes to a new ring
+uint8_t frame_ring_closed(const frame_ring *ring);
+// Maps the new ring of a restarted producer and hands it the doorbell of the
+// closed one. The closed ring stays mapped until it is closed as well.
+frame_ring *frame_ring_reopen(frame_ring *closed);
+
+// The producer's close also marks the ring closed and unlinks it
+void frame_ring_close(frame_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //FRAME_RING_H
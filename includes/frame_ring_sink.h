@@ -0,0 +1,94 @@
+#ifndef FRAME_RING_SINK_H
+#define FRAME_RING_SINK_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <liveMedia.hh>
+#include <frame_ring_source.h>
+
+// Packets handed to the kernel per sendmmsg() call
+#define SEND_BATCH 32
+
+struct PacingStats {
+    unsigned frames;
+    unsigned pacedFrames; // Frames that had to wait for the token bucket
+    unsigned maxSpread;   // us from the first to the last packet of a frame
+    uint64_t totalSpread;
+};
+
+// H.264 RTP sink fed by a FrameRingSource. Instead of fragmenting NAL units
+// into its own packet buffer, it sends the packets shared through
+// FrameRingReader::packetize(), gathered by sendmmsg() straight from the
+// frame ring, so each extra client costs the sends and no copy of the
+// frame. RTP headers, sequence numbers and the counters RTCP reports are
+// kept per sink.
+class FrameRingRTPSink : public H264VideoRTPSink {
+public:
+    static FrameRingRTPSink* createNew(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                       const u_int8_t* sps, unsigned spsSize, const u_int8_t* pps, unsigned ppsSize);
+
+    // Sends to a single UDP client with sendmmsg(), header and payload kept
+    // apart. Without it packets go through RTPInterface, which also covers
+    // RTP over RTSP and sinks shared by several clients.
+    void setDestination(const struct sockaddr_storage& addr, Port const& port);
+    // RTP over the client's RTSP connection: frames that would not fit in
+    // the socket's send budget are skipped instead of queued or cut short
+    void setTCPSocket(int socketNum);
+    // Spreads each frame over percent of frameInterval (us) with a token
+    // bucket, so an IDR does not hit the WiFi driver queue in one burst.
+    // 0 sends every frame at once.
+    void setPacing(unsigned percent, unsigned frameInterval) {
+        fPacing = percent;
+        fFrameInterval = frameInterval;
+    }
+    const PacingStats& pacingStats() const { return fPacingStats; }
+
+    void stopPlaying() override;
+
+protected:
+    FrameRingRTPSink(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                     const u_int8_t* sps, unsigned spsSize, const u_int8_t* pps, unsigned ppsSize);
+    ~FrameRingRTPSink() override;
+
+private:
+    Boolean sourceIsCompatibleWithUs(MediaSource& source) override;
+    Boolean continuePlaying() override;
+
+    static void frameAvailable(void* clientData);
+    static void sendNext(void* clientData);
+    void sendNext();
+    Boolean tcpHasRoom(const PacketizedFrame& frame);
+    void startFrame(const std::shared_ptr<const PacketizedFrame>& frame);
+    // Index up to which packets can go out now, with the delay until the next one when none can
+    size_t pacedEnd(size_t end, int64_t& delay);
+    void finishFrame();
+    void sendBatch(size_t end);
+    unsigned sendMessages(unsigned count);
+    void logDropped();
+    void sendPacket(const u_int8_t* header, const RTPPayload& payload);
+
+    FrameRingReader* fReader; // Set while playing
+    std::shared_ptr<const PacketizedFrame> fPending; // Frame part way out when pacing
+    size_t fNextPacket;
+    u_int32_t fPendingTimestamp;
+    int64_t fFrameStart;
+    Boolean fFrameDelayed;
+    unsigned fPacing; // Percent of the frame interval
+    unsigned fFrameInterval;
+    uint64_t fRate; // Bytes per second for the frame being sent
+    int64_t fTokens;
+    int64_t fLastRefill;
+    PacingStats fPacingStats;
+    Boolean fHaveDestination;
+    struct sockaddr_storage fDestination;
+    socklen_t fDestinationSize;
+    int fTCPSocket;
+    u_int8_t fPacket[RTP_MAX_PACKET_SIZE];
+    // Header arena and messages of the batch being sent
+    u_int8_t fHeaders[SEND_BATCH][RTP_HEADER_SIZE];
+    struct iovec fIov[SEND_BATCH][3];
+    struct mmsghdr fMessages[SEND_BATCH];
+    uint64_t fPacketsDropped; // Left over when sendmmsg() took only part of a batch
+};
+
+#endif //FRAME_RING_SINK_H
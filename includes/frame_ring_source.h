@@ -0,0 +1,194 @@
+#ifndef FRAME_RING_SOURCE_H
+#define FRAME_RING_SOURCE_H
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include <liveMedia.hh>
+#include <frame_ring.h>
+#include <control.h>
+#include <histogram.h>
+
+class FrameRingSource;
+
+// Largest RTP packet sent, header included, as in MultiFramedRTPSink
+#define RTP_MAX_PACKET_SIZE 1456
+#define RTP_HEADER_SIZE 12
+
+// One RTP payload: the FU indicator and header of an FU-A fragment, if any,
+// followed by a slice of the NAL unit as it sits in the frame ring
+struct RTPPayload {
+    const u_int8_t* data;
+    unsigned size;
+    u_int8_t fu[2];
+    u_int8_t fuSize; // 0 for a single NAL unit packet
+};
+
+// The RTP payloads of one frame (RFC 6184 single NAL unit and FU-A packets),
+// described once and shared by every client sending the frame. Nothing is
+// copied, so the frame must be checked with FrameRingReader::valid() around
+// sending it: the producer may lap it at any time.
+struct PacketizedFrame {
+    uint32_t seq;
+    uint32_t generation; // FrameRingReader::generation() of the ring it was read from
+    struct timeval presentationTime;
+    Boolean live;      // Packetized as the newest frame, not replayed from the GOP cache
+    uint64_t readTime; // CLOCK_MONOTONIC us when the server packetized it
+    Boolean keyFrame;
+    Boolean reference; // False when no slice has nal_ref_idc set, nothing depends on the frame
+    unsigned payloadSize; // Sum of all packets
+    std::vector<RTPPayload> packets;
+    frame_ring_frame frame;
+};
+
+// Where the time between capture and the RTP send goes, per stream. Only
+// frames read at the live edge are counted, GOP replays would skew it.
+struct StreamLatency {
+    histogram encode; // Encoder timestamp to the streamer receiving the frame
+    histogram queue;  // Received to written to the ring
+    histogram ring;   // Written to read by the server
+    histogram send;   // Read to the last packet sent, per client, pacing included
+    histogram total;  // Encoder timestamp to the last packet sent
+};
+
+// Owns the server side mapping of a frame ring and wakes the sources reading
+// from it whenever the streamer rings the doorbell.
+class FrameRingReader {
+public:
+    // stream is the index of the video stream the ring carries, used when talking to the streamer
+    FrameRingReader(UsageEnvironment& env, const char* name, uint8_t stream);
+    // Reads a ring written by a capture thread in this process, which wakes the
+    // event loop through an event trigger rather than the doorbell
+    FrameRingReader(UsageEnvironment& env, const char* name, uint8_t stream, frame_ring* ring);
+    ~FrameRingReader();
+
+    // Maps the ring on first use, the streamer may not have created it yet
+    frame_ring* ring();
+    // Bumped whenever a restarted streamer's ring replaces the mapped one,
+    // sequence numbers start over with it
+    uint32_t generation() const { return fGeneration; }
+    Boolean parameterSets(u_int8_t* sps, unsigned& spsSize, u_int8_t* pps, unsigned& ppsSize, unsigned maxSize);
+
+    // Maps an encoder timestamp onto wall clock time, shared by every source
+    // so all clients see the same presentation times for a frame
+    void presentationTime(uint64_t timestamp, struct timeval& tv);
+
+    // Where a new source starts reading: the latest keyframe still in the ring
+    // when the GOP cache is on, so playback starts without waiting for an IDR
+    uint32_t startSeq();
+    void setGopCache(Boolean enabled) { fGopCache = enabled; }
+
+    // Asks the streamer for an IDR over the control channel
+    void requestKeyFrame();
+    // Sends any other command about this stream to the streamer
+    Boolean sendControl(uint8_t cmd, uint32_t value);
+
+    // Sinks currently sending this stream, for their RTCP receiver reports
+    void addSink(RTPSink* sink);
+    void removeSink(RTPSink* sink);
+    const std::vector<RTPSink*>& sinks() const { return fSinks; }
+
+    // Returns the packets of a frame, built on first request and reused by
+    // the other clients. Null if the producer lapped the frame meanwhile.
+    std::shared_ptr<const PacketizedFrame> packetize(const frame_ring_frame& frame);
+    // False once the producer overwrote the frame's data
+    Boolean valid(const PacketizedFrame& frame);
+
+    const char* name() const { return fName; }
+    uint8_t stream() const { return fStream; }
+    const StreamLatency& latency() const { return fLatency; }
+    // Called by a sink once the last packet of a frame went out
+    void frameSent(const PacketizedFrame& frame);
+    // RTP packets and payload bytes the sinks handed to their sockets
+    void packetsSent(unsigned packets, unsigned bytes) { fPacketsSent += packets; fBytesSent += bytes; }
+    uint64_t packetsSent() const { return fPacketsSent; }
+    uint64_t bytesSent() const { return fBytesSent; }
+    // RTP packets the sockets had no room for, they used up sequence numbers but never went out
+    void packetsDropped(unsigned packets) { fPacketsDropped += packets; }
+    uint64_t packetsDropped() const { return fPacketsDropped; }
+
+    void waitForFrame(FrameRingSource* source);
+    void cancelWait(FrameRingSource* source);
+
+private:
+    static void doorbellHandler(void* clientData, int mask);
+    static void frameWritten(void* clientData);
+    static void frameTriggered(void* clientData);
+    void wakeSources();
+    void reattach();
+
+    UsageEnvironment& fEnv;
+    char* fName;
+    uint8_t fStream;
+    frame_ring* fRing;
+    frame_ring* fRetired; // The ring before the last reattach, sinks may still be sending from it
+    uint32_t fGeneration;
+    Boolean fOwnsRing;
+    EventTriggerId fTrigger;
+    Boolean fGopCache;
+    int fControl;
+    std::deque<std::shared_ptr<const PacketizedFrame>> fPacketized;
+    std::vector<FrameRingSource*> fWaiting;
+    std::vector<RTPSink*> fSinks;
+    StreamLatency fLatency;
+    uint64_t fPacketsSent;
+    uint64_t fBytesSent;
+    uint64_t fPacketsDropped;
+    Boolean fHaveTimeBase;
+    uint64_t fTimeBaseTimestamp;
+    struct timeval fTimeBase;
+};
+
+// Delivers the NAL units of each frame in the ring one at a time, without
+// start codes, or whole packetized frames to FrameRingRTPSink. All NAL units of a frame
+// carry the presentation time of the encoder timestamp, so RTP timestamps
+// follow capture time even when the sensor frame rate changes.
+//
+// A source starts at a keyframe (replaying the cached GOP, see
+// FrameRingReader::startSeq()), and when it falls behind the producer it
+// drops the rest of the GOP and resumes at the next keyframe, so the decoder
+// is never fed frames that reference ones it did not get.
+class FrameRingSource : public FramedSource {
+public:
+    static FrameRingSource* createNew(UsageEnvironment& env, FrameRingReader& reader);
+
+    FrameRingReader& reader() { return fReader; }
+
+    void frameAvailable();
+
+    // Used by FrameRingRTPSink in place of getNextFrame(): returns the next
+    // frame already packetized, or null and calls the frame handler once one
+    // is written
+    std::shared_ptr<const PacketizedFrame> nextPacketizedFrame();
+    void setFrameHandler(TaskFunc* handler, void* clientData);
+    // Called by the sink for a frame it chose not to send: a non-reference
+    // frame is just counted, otherwise the rest of the GOP is dropped too
+    void skipFrame(const PacketizedFrame& frame, const char* reason);
+
+protected:
+    FrameRingSource(UsageEnvironment& env, FrameRingReader& reader);
+    ~FrameRingSource() override;
+
+private:
+    void doGetNextFrame() override;
+    void doStopGettingFrames() override;
+    Boolean nextFrame();
+    Boolean deliverNal();
+
+    void dropUntilKeyFrame(const char* reason);
+
+    FrameRingReader& fReader;
+    uint32_t fGeneration;
+    uint32_t fSeq;
+    frame_ring_frame fFrame;
+    unsigned fNalIndex;
+    Boolean fPositioned;
+    Boolean fWaitForKey;
+    Boolean fStarted;
+    unsigned fFramesDropped;
+    unsigned fGopsDropped;
+    TaskFunc* fFrameHandler;
+    void* fFrameHandlerData;
+};
+
+#endif //FRAME_RING_SOURCE_H
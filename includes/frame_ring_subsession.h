@@ -0,0 +1,74 @@
+#ifndef FRAME_RING_SUBSESSION_H
+#define FRAME_RING_SUBSESSION_H
+
+#include <liveMedia.hh>
+#include <frame_ring_source.h>
+#include <frame_ring_sink.h>
+
+// Serves the H.264 stream from a frame ring. SPS/PPS for the SDP are taken
+// from the latest keyframe in the ring instead of being parsed from the stream.
+// Each client gets a FrameRingRTPSink sending the shared packets of the reader.
+class FrameRingMediaSubsession : public OnDemandServerMediaSubsession {
+public:
+    static FrameRingMediaSubsession* createNew(UsageEnvironment& env, FrameRingReader& reader, unsigned estBitrate, Boolean reuseFirstSource);
+
+    // Request an IDR from the streamer whenever a client starts playing
+    void setKeyFrameOnPlay(Boolean enabled) { fKeyFrameOnPlay = enabled; }
+    // See FrameRingRTPSink::setPacing()
+    void setPacing(unsigned percent, unsigned frameInterval) {
+        fPacing = percent;
+        fFrameInterval = frameInterval;
+    }
+
+protected:
+    FrameRingMediaSubsession(UsageEnvironment& env, FrameRingReader& reader, unsigned estBitrate, Boolean reuseFirstSource);
+
+    FramedSource* createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate) override;
+    RTPSink* createNewRTPSink(Groupsock* rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource* inputSource) override;
+    void startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler, void* rtcpRRHandlerClientData,
+                     unsigned short& rtpSeqNum, unsigned& rtpTimestamp,
+                     ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                     void* serverRequestAlternativeByteHandlerClientData) override;
+
+private:
+    FrameRingReader& fReader;
+    unsigned fEstBitrate; // kbps
+    Boolean fReuseFirstSource;
+    Boolean fKeyFrameOnPlay;
+    unsigned fPacing;
+    unsigned fFrameInterval;
+};
+
+// Sends the stream once to a multicast group, whatever the number of viewers.
+// RTSP only hands out the SDP, every client joins the same group.
+class FrameRingMulticastSubsession : public PassiveServerMediaSubsession {
+public:
+    // Null until the ring holds a keyframe, the SDP needs its SPS/PPS.
+    // With ssm the group is source-specific and receivers must filter on our address.
+    static FrameRingMulticastSubsession* createNew(UsageEnvironment& env, FrameRingReader& reader, unsigned estBitrate,
+                                                   const struct sockaddr_storage& group, uint16_t port, uint8_t ttl, Boolean ssm);
+
+    void setKeyFrameOnPlay(Boolean enabled) { fKeyFrameOnPlay = enabled; }
+    void setPacing(unsigned percent, unsigned frameInterval) { fSink.setPacing(percent, frameInterval); }
+
+protected:
+    FrameRingMulticastSubsession(FrameRingReader& reader, FrameRingRTPSink& sink, RTCPInstance* rtcp,
+                                 FrameRingSource* source, Groupsock* rtpGroupsock, Groupsock* rtcpGroupsock);
+    ~FrameRingMulticastSubsession() override;
+
+    void startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler, void* rtcpRRHandlerClientData,
+                     unsigned short& rtpSeqNum, unsigned& rtpTimestamp,
+                     ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                     void* serverRequestAlternativeByteHandlerClientData) override;
+
+private:
+    FrameRingReader& fReader;
+    FrameRingRTPSink& fSink;
+    RTCPInstance* fRTCP;
+    FrameRingSource* fSource;
+    Groupsock* fRTPGroupsock;
+    Groupsock* fRTCPGroupsock;
+    Boolean fKeyFrameOnPlay;
+};
+
+#endif //FRAME_RING_SUBSESSION_H
@@ -1,8 +1,12 @@
 #ifndef GLOBALS_H
 #define GLOBALS_H
 
-#define VIDEO_SINK "/tmp/rtsp_video_fifo"
+#define VIDEO_RING "/rtsp_video_ring"
+// The main stream plus up to two substreams, substream n uses VIDEO_RING followed by n
+#define VIDEO_STREAMS 3
 #define AUDIO_SINK "/tmp/rtsp_audio_fifo"
+// Read at startup and again whenever it changes
+#define STREAMER_INI "streamer.ini"
 
 #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
 
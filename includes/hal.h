@@ -0,0 +1,57 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <rtsavdef.h>
+#include <rtsvideo.h>
+
+// Hardware abstraction for imager_streamer. The calls mirror the rtstream
+// API used by the streamer; hal_rts.c forwards them to the Realtek SDK and
+// hal_sim.c plays back a recorded H.264 stream so the pipeline can run on a
+// host (see IMAGER_SIMULATOR in CMakeLists.txt).
+
+int hal_init(void);
+void hal_release(void);
+
+int hal_create_isp_chn(struct rts_isp_attr *attr);
+int hal_create_h264_chn(struct rts_h264_attr *attr);
+int hal_set_profile(int chn, struct rts_av_profile *profile);
+int hal_bind(int src, int dst);
+int hal_unbind(int src, int dst);
+int hal_enable_chn(int chn);
+int hal_disable_chn(int chn);
+int hal_destroy_chn(int chn);
+int hal_start_recv(int chn);
+int hal_stop_recv(int chn);
+
+// Sleeps until any receiving channel signals a frame or timeout_ms passes
+void hal_wait_frame(int timeout_ms);
+// Returns 0 and a buffer to release with hal_put_buffer() when a frame is ready
+int hal_recv(int chn, struct rts_av_buffer **buffer);
+void hal_put_buffer(struct rts_av_buffer *buffer);
+
+int hal_get_isp_ctrl(uint32_t id, struct rts_video_control *ctrl);
+int hal_set_isp_ctrl(uint32_t id, struct rts_video_control *ctrl);
+int hal_get_isp_dynamic_fps(void);
+int hal_set_isp_dynamic_fps(uint8_t fps);
+// Mean luminance (0-255) and total sensor gain from the latest AE statistics
+int hal_get_isp_ae_statis(int32_t *y_mean, int32_t *gain);
+// The ISP firmware's own day/night statistic, negative when not supported
+int hal_get_isp_daynight_statis(void);
+
+int hal_query_h264_ctrl(int chn, struct rts_video_h264_ctrl **ctrl);
+int hal_get_h264_ctrl(struct rts_video_h264_ctrl *ctrl);
+int hal_set_h264_ctrl(struct rts_video_h264_ctrl *ctrl);
+void hal_release_h264_ctrl(struct rts_video_h264_ctrl *ctrl);
+int hal_request_key_frame(int chn);
+int hal_query_h264_roi(int chn, struct rts_video_roi_attr **attr);
+int hal_set_h264_roi(struct rts_video_roi_attr *attr);
+void hal_release_h264_roi(struct rts_video_roi_attr *attr);
+// Frames the channel may hold for a slow receiver before dropping them
+int hal_set_waiting_limit(int chn, long limit);
+
+int hal_adc_get_value(int channel);
+// 0 = day, 1 = night
+void hal_set_ir_cut(int night);
+
+#endif //HAL_H
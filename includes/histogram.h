@@ -0,0 +1,36 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <zlog.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Latency histogram with power of two buckets: bucket n counts values in
+// [2^n, 2^(n+1)) microseconds, the last one everything above. Cheap enough
+// to update for every frame.
+
+#define HISTOGRAM_BUCKETS 24 // Up to ~8 s
+
+typedef struct {
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} histogram;
+
+void histogram_reset(histogram *h);
+void histogram_add(histogram *h, uint64_t value_us);
+// Upper bound of the bucket holding the given percentile (0-100), 0 when empty
+uint64_t histogram_percentile(const histogram *h, uint32_t percentile);
+// Logs a summary and the non-empty buckets at info level
+void histogram_log(const histogram *h, zlog_category_t *category, const char *title);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //HISTOGRAM_H
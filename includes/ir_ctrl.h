@@ -0,0 +1,88 @@
+#ifndef IR_CTRL_H
+#define IR_CTRL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Day/night decision from the light sensor ADC and the ISP's exposure
+// statistics. ADC readings go through a short median filter, which drops
+// single spikes like passing headlights, then an exponential moving
+// average; the ISP luminance and gain are averaged the same way. A
+// strategy turns the filtered values into the mode it wants and ir_ctrl
+// enforces a minimum dwell between switches, so the IR LEDs lighting up
+// the scene right after a switch to night cannot flip it straight back.
+// Free of any HAL calls so recorded traces can be replayed through it.
+
+#define IR_MEDIAN_WINDOW 5
+// Weight of a new value in the averages, out of 256
+#define IR_EMA_WEIGHT 64
+// Time the averages get to settle after a switch to night before the
+// brightness added by the IR illuminator is measured
+#define IR_SETTLE_MS 5000
+
+struct ir_ctrl;
+
+// One reading of every input, -1 for the ones that are not available
+typedef struct {
+    int32_t adc;
+    int32_t luma; // Mean luminance of the AE statistics, 0-255
+    int32_t gain; // Total sensor gain of the AE
+} ir_sample;
+
+// Returns the mode the readings call for: 0 = day, 1 = night, -1 to keep the current one
+typedef struct {
+    const char *name;
+    int8_t (*decide)(const struct ir_ctrl *ir);
+} ir_strategy;
+
+// The light sensor alone, with hysteresis around the cutoff. At night it
+// takes the IR illuminator's own reflection off the reading.
+extern const ir_strategy ir_strategy_adc;
+// Like adc, but goes to night only once the ISP agrees the image is dark
+extern const ir_strategy ir_strategy_fused;
+
+// NULL when no strategy has that name
+const ir_strategy *ir_strategy_find(const char *name);
+
+typedef struct {
+    const ir_strategy *strategy;
+    int32_t cutoff;     // ADC value between day and night
+    int32_t hysteresis; // Half width of the band around the cutoff where nothing changes
+    uint8_t inverted;   // The ADC rises with light instead of falling
+    uint32_t dwell_ms;  // Minimum time between switches
+    int32_t luma_night; // Fused: the ISP sees night below this mean luminance
+    int32_t gain_night; // Fused: or at and above this gain, 0 ignores the gain
+} ir_ctrl_config;
+
+typedef struct ir_ctrl {
+    ir_ctrl_config config;
+    int32_t window[IR_MEDIAN_WINDOW];
+    uint32_t samples;
+    int32_t average; // ADC times 256
+    int32_t luma;    // Times 256, -1 until the ISP reported one
+    int32_t gain;    // Times 256, -1 until the ISP reported one
+    int8_t mode;     // -1 until the first decision, then 0 = day, 1 = night
+    uint64_t last_switch_ms;
+    int32_t brightness_before; // At the last switch to night
+    uint8_t reflection_pending;
+    int32_t reflection; // Brightness the illuminator adds to the light sensor
+} ir_ctrl;
+
+void ir_ctrl_init(ir_ctrl *ir, const ir_ctrl_config *config);
+// Swaps the configuration, keeping the filtered readings and the current mode
+void ir_ctrl_configure(ir_ctrl *ir, const ir_ctrl_config *config);
+// Feeds one set of readings taken at now_ms. Returns the mode to switch to, or -1 to stay.
+int8_t ir_ctrl_sample(ir_ctrl *ir, const ir_sample *sample, uint64_t now_ms);
+// The filtered ADC reading, for logs and metrics
+int32_t ir_ctrl_level(const ir_ctrl *ir);
+// How far the filtered ADC reading is on the day side of the cutoff, in ADC counts
+int32_t ir_ctrl_brightness(const ir_ctrl *ir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //IR_CTRL_H
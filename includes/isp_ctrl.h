@@ -0,0 +1,52 @@
+#ifndef ISP_CTRL_H
+#define ISP_CTRL_H
+
+#include <stdint.h>
+#include <rtsvideo.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Cache of the ISP controls in front of hal_get_isp_ctrl()/hal_set_isp_ctrl().
+// Each control is read from the ISP once, writes of the value it already
+// has are skipped, and changes are grouped in transactions applied back to
+// back under one lock, so a day/night switch cannot interleave with a
+// runtime change from another thread. Safe to use from any thread.
+
+// Pseudo control id for the IR cut filter, 0 = day, 1 = night, so it can
+// be switched in the same transaction as the gray and IR modes
+#define ISP_CTRL_IR_CUT RTS_VIDEO_CTRL_ID_RESERVED
+#define ISP_CTRL_MAX_STEPS 16
+
+typedef struct {
+    uint32_t id;
+    int32_t value;
+} isp_ctrl_step;
+
+typedef struct {
+    isp_ctrl_step steps[ISP_CTRL_MAX_STEPS];
+    uint32_t count;
+} isp_ctrl_txn;
+
+void isp_ctrl_begin(isp_ctrl_txn *txn);
+// Steps are applied in the order they were added, returns 0 when the transaction is full
+uint8_t isp_ctrl_add(isp_ctrl_txn *txn, uint32_t id, int32_t value);
+// Applies the steps, an invalid value is replaced by the control's default.
+// Returns the number of steps that failed.
+int isp_ctrl_commit(const isp_ctrl_txn *txn);
+// Shorthand for a transaction of a single step
+uint8_t isp_ctrl_set(uint32_t id, int32_t value);
+
+// The last known state of a control, read from the ISP on first use
+int isp_ctrl_get(uint32_t id, struct rts_video_control *ctrl);
+// Whether value is within the range and step the control reports
+uint8_t isp_ctrl_in_range(const struct rts_video_control *ctrl, int32_t value);
+// Forgets every cached value, for when something else may have changed the ISP
+void isp_ctrl_invalidate(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ISP_CTRL_H
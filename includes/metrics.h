@@ -0,0 +1,40 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Prometheus text exposition over a bare bones HTTP/1.0 listener. Every
+// request, whatever its path, gets the full set of metrics and the
+// connection is closed.
+
+#define METRICS_BUFFER_SIZE 16384
+
+typedef struct {
+    char data[METRICS_BUFFER_SIZE];
+    size_t len;
+} metrics_buffer;
+
+void metrics_reset(metrics_buffer *b);
+// Appends to the buffer, output that does not fit is cut off
+void metrics_printf(metrics_buffer *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// CPU time and resident memory of this process, from /proc/self/stat
+void metrics_process(metrics_buffer *b);
+
+// Returns a non-blocking TCP socket listening on port on every interface
+int metrics_listen(uint16_t port);
+// Reads the request, waiting at most timeout_ms for each part of it.
+// Returns 0 when the client went away or the request did not end in time.
+uint8_t metrics_read_request(int client, int timeout_ms);
+// Sends the buffer as the response body and closes the connection
+void metrics_respond(int client, const metrics_buffer *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //METRICS_H
@@ -0,0 +1,35 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <vector>
+#include <liveMedia.hh>
+#include <metrics.h>
+#include <frame_ring_source.h>
+
+// Prometheus endpoint of the server, run on the event loop so the readers
+// and sinks can be looked at without locking. Exports the clients, RTP
+// counters, RTCP loss and latency of every stream, and in rtsp_streamer the
+// capture side too (see stream_metrics()).
+class MetricsServer {
+public:
+    static MetricsServer* createNew(UsageEnvironment& env, uint16_t port);
+    ~MetricsServer();
+
+    void addReader(FrameRingReader* reader) { fReaders.push_back(reader); }
+
+private:
+    MetricsServer(UsageEnvironment& env, int socket);
+
+    static void incomingConnection(void* clientData, int mask);
+    void incomingConnection();
+    static void requestReceived(void* clientData, int mask);
+    void respond(int client);
+    void render();
+
+    UsageEnvironment& fEnv;
+    int fSocket;
+    std::vector<FrameRingReader*> fReaders;
+    metrics_buffer fBuffer;
+};
+
+#endif //METRICS_SERVER_H
@@ -2,19 +2,85 @@
 #define RTSP_SERVER_H
 
 #include <stdint.h>
+#include <arpa/inet.h>
 #include <liveMedia.hh>
 #include <BasicUsageEnvironment.hh>
 #include <zlog.h>
 #include <ini.h>
 #include <ver.h>
 #include <globals.h>
+#include <frame_ring_subsession.h>
+#include <bitrate_controller.h>
+#include <stats_server.h>
+#include <metrics_server.h>
+#include <config_watch.h>
+#ifdef MERGED_STREAMER
+#include <signal.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <stream.h>
+#endif
+
+// A video stream served on its own RTSP path, [rtsp] name for the main
+// stream and the name in [substream1]/[substream2] for the others
+typedef struct {
+    const char* name;
+    uint32_t min_bitrate;
+    uint32_t max_bitrate;
+    uint32_t fps;
+    uint32_t width; // A new resolution brings new SPS/PPS, so a new session
+    uint32_t height;
+} rtsp_stream_settings;
 
 typedef struct {
     const char* user;
     const char* pwd;
     uint16_t port;
-    const char* name;
-    uint16_t resolution;
+    rtsp_stream_settings streams[VIDEO_STREAMS];
+    uint8_t gop_cache;
+    uint8_t key_frame_on_play;
+    uint32_t pacing; // Percent of the frame interval to spread a frame over
+    uint8_t abr;
+    uint32_t abr_min_fps;
+    const char* multicast; // Group for the main stream, unicast when empty
+    uint16_t multicast_port;
+    uint8_t multicast_ttl;
+    uint8_t multicast_ssm;
+    uint8_t stats; // Serve the latency histograms on STATS_SOCKET
+    uint16_t metrics_port; // HTTP port of the metrics endpoint, 0 disables it
 } rtsp_settings;
 
+// The main stream once it goes out over multicast, see start_multicast()
+typedef struct {
+    RTSPServer* server;
+    FrameRingReader* reader;
+    const char* name;
+    unsigned est_bitrate; // kbps
+    struct sockaddr_storage group;
+    uint16_t port;
+    uint8_t ttl;
+    uint8_t ssm;
+    uint8_t key_frame_on_play;
+    uint32_t pacing;
+    uint32_t frame_interval; // us
+} multicast_stream;
+
+// How a stream is being served, replaced when a reload changes its settings
+typedef struct {
+    FrameRingReader* reader; // Kept once created, the stats and metrics refer to it
+    ServerMediaSession* sms; // Null when not served or served over multicast
+    BitrateController* abr;
+} served_stream;
+
+// Everything a reload of streamer.ini may touch, see config_changed()
+typedef struct {
+    UsageEnvironment* env;
+    RTSPServer* server;
+    StatsServer* stats;
+    MetricsServer* metrics;
+    int watch;
+    rtsp_settings config; // As last loaded
+    served_stream streams[VIDEO_STREAMS];
+} rtsp_state;
+
 #endif //RTSP_SERVER_H
@@ -0,0 +1,34 @@
+#ifndef STATS_SERVER_H
+#define STATS_SERVER_H
+
+#include <string>
+#include <vector>
+#include <liveMedia.hh>
+#include <frame_ring_source.h>
+
+#define STATS_SOCKET "/tmp/rtsp_streamer_stats.sock"
+
+// Serves the per stage latency histograms of every stream on a local UNIX
+// stream socket: each connection gets a text dump and is closed, so
+// `socat - UNIX-CONNECT:/tmp/rtsp_streamer_stats.sock` is enough to read it.
+// Runs on the event loop like everything else touching the readers.
+class StatsServer {
+public:
+    static StatsServer* createNew(UsageEnvironment& env);
+    ~StatsServer();
+
+    void addReader(FrameRingReader* reader) { fReaders.push_back(reader); }
+
+private:
+    StatsServer(UsageEnvironment& env, int socket);
+
+    static void incomingConnection(void* clientData, int mask);
+    void incomingConnection();
+    std::string report() const;
+
+    UsageEnvironment& fEnv;
+    int fSocket;
+    std::vector<FrameRingReader*> fReaders;
+};
+
+#endif //STATS_SERVER_H
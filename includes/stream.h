@@ -0,0 +1,71 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include <globals.h>
+#include <frame_ring.h>
+#include <metrics.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One ISP + H.264 encoder pipeline, from [encoder] for the main stream and
+// [substream1]/[substream2] for the others. A substream without a
+// resolution and frame rate is disabled.
+typedef struct {
+    uint32_t min_bitrate;
+    uint32_t max_bitrate;
+    uint32_t width;
+    uint32_t height;
+    uint32_t fps;
+    uint32_t gop; // Frames between IDRs, 0 for two seconds worth
+    uint32_t isp_buf_num;   // ISP frame buffers, fewer cut latency but may drop frames
+    uint32_t waiting_limit; // Frames the encoder may queue for us, 0 keeps the SDK default
+} video_stream_settings;
+
+typedef struct {
+    int32_t noise_reduction;
+    int32_t ldc;
+    int32_t detail_enhancement;
+    int32_t three_dnr;
+    int32_t mirror;
+    int32_t flip;
+    int32_t adc_cutoff_inverted;
+    int32_t adc_cutoff;
+    int32_t in_out_door_mode;
+    int32_t dehaze;
+    int32_t ir_hysteresis; // ADC counts around the cutoff where the IR mode is kept
+    uint32_t ir_dwell;     // Minimum seconds between IR mode switches
+    char ir_strategy[16];  // Name of the ir_ctrl strategy, "adc" or "fused"
+    int32_t ir_luma_night; // Fused: ISP mean luminance below which the image is dark
+    int32_t ir_gain_night; // Fused: sensor gain at which the image is dark, 0 ignores it
+    video_stream_settings video[VIDEO_STREAMS];
+    uint32_t key_frame_interval; // Minimum ms between IDRs requested by clients
+    uint32_t latency_report;     // Seconds between capture latency histograms, 0 disables them
+    uint16_t metrics_port;       // HTTP port of the metrics endpoint, 0 disables it
+    uint8_t invert_ir_cut;
+} streamer_settings;
+
+// Loads streamer.ini and brings up the HAL, zlog must already be initialized
+int stream_init(streamer_settings *config);
+uint8_t stream_enabled(const video_stream_settings *video);
+// Creates the ring of every enabled stream, disabled ones are left NULL
+int stream_create_rings(const streamer_settings *config, frame_ring **video_rings);
+void stream_close_rings(frame_ring **video_rings);
+// Runs the capture loop, writing the frames of stream n to video_rings[n],
+// until stop_stream() is called. Returns once the channels are torn down, the
+// caller cleans up with stream_release(). Fatal errors end the process.
+int start_stream(streamer_settings config, frame_ring **video_rings);
+void stop_stream(void);
+// Closes and removes the rings and releases the HAL brought up by stream_init()
+void stream_release(frame_ring **video_rings);
+// Appends the capture counters, IR state and ADC reading in Prometheus text
+// format, safe to call from any thread
+void stream_metrics(metrics_buffer *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STREAM_H
@@ -33,7 +33,11 @@ cp /var/tmp/sd/Yi/ko/* /home/app/localko
 mount --bind /var/tmp/sd/localko /home/app/localko
 /var/tmp/sd/Yi/load_cpld_ssp
 
-# Start the imager streamer and RTSP server
-./imager_streamer &
-./rtsp_server &
+# Start the imager streamer and RTSP server, in a single process when available
+if [ -x ./rtsp_streamer ]; then
+    ./rtsp_streamer &
+else
+    ./imager_streamer &
+    ./rtsp_server &
+fi
 
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <sys/time.h>
+#include <zlog.h>
+#include <control.h>
+#include <bitrate_controller.h>
+
+static Boolean newer(const struct timeval& a, const struct timeval& b) {
+    return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_usec > b.tv_usec);
+}
+
+BitrateController::BitrateController(UsageEnvironment& env, FrameRingReader& reader, uint32_t minBitrate, uint32_t maxBitrate,
+                                     unsigned minFps, unsigned maxFps)
+    : fEnv(env), fReader(reader), fMinBitrate(minBitrate), fMaxBitrate(maxBitrate),
+      fMinFps(minFps < maxFps ? minFps : 0), fMaxFps(maxFps), fBitrate(maxBitrate), fFps(maxFps), fStableIntervals(0) {
+    if (fMinBitrate > fMaxBitrate) {
+        fMinBitrate = fMaxBitrate;
+    }
+    gettimeofday(&fLastEvaluation, nullptr);
+    fTask = env.taskScheduler().scheduleDelayedTask(ABR_INTERVAL_MS * 1000, evaluate, this);
+}
+
+BitrateController::~BitrateController() {
+    fEnv.taskScheduler().unscheduleDelayedTask(fTask);
+}
+
+void BitrateController::evaluate(void* clientData) {
+    static_cast<BitrateController*>(clientData)->evaluate();
+}
+
+void BitrateController::evaluate() {
+    fTask = fEnv.taskScheduler().scheduleDelayedTask(ABR_INTERVAL_MS * 1000, evaluate, this);
+
+    // Only reports that arrived since the last pass, a report is acted on once
+    unsigned receivers = 0, reports = 0;
+    unsigned worstLoss = 0, worstJitterMs = 0;
+    for (RTPSink* sink : fReader.sinks()) {
+        RTPTransmissionStatsDB::Iterator it(sink->transmissionStatsDB());
+        RTPTransmissionStats* stats;
+        while ((stats = it.next()) != nullptr) {
+            receivers++;
+            if (!newer(stats->lastTimeReceived(), fLastEvaluation)) {
+                continue;
+            }
+            reports++;
+            unsigned jitterMs = stats->jitter() / (sink->rtpTimestampFrequency() / 1000);
+            worstLoss = std::max(worstLoss, (unsigned) stats->packetLossRatio());
+            worstJitterMs = std::max(worstJitterMs, jitterMs);
+        }
+    }
+    gettimeofday(&fLastEvaluation, nullptr);
+
+    if (receivers == 0) {
+        // Nobody watching, the next client starts at full quality
+        fStableIntervals = 0;
+        apply(fMaxBitrate, fMaxFps);
+        return;
+    }
+    if (reports == 0) {
+        return;
+    }
+    if (worstLoss > ABR_LOSS_HIGH || worstJitterMs > ABR_JITTER_HIGH_MS) {
+        zlog_debug(zlog_get_category("server"), "Receiver loss %u/256, jitter %u ms, lowering the rate", worstLoss, worstJitterMs);
+        fStableIntervals = 0;
+        decrease();
+    } else if (worstLoss <= ABR_LOSS_LOW) {
+        if (++fStableIntervals >= ABR_STABLE_INTERVALS) {
+            fStableIntervals = 0;
+            increase();
+        }
+    } else {
+        // Between the thresholds: hold, but do not count it as stable
+        fStableIntervals = 0;
+    }
+}
+
+void BitrateController::decrease() {
+    if (fBitrate > fMinBitrate) {
+        apply(std::max(fMinBitrate, (uint32_t) ((uint64_t) fBitrate * ABR_DECREASE_PERCENT / 100)), fFps);
+    } else if (fMinFps && fFps > fMinFps) {
+        apply(fBitrate, std::max(fMinFps, fFps * ABR_DECREASE_PERCENT / 100));
+    }
+}
+
+void BitrateController::increase() {
+    // Undo the frame rate cut first, it hurts more than a lower bitrate
+    if (fFps < fMaxFps) {
+        apply(fBitrate, std::min(fMaxFps, std::max(fFps + 1, fFps * ABR_INCREASE_PERCENT / 100)));
+    } else if (fBitrate < fMaxBitrate) {
+        apply(std::min(fMaxBitrate, (uint32_t) ((uint64_t) fBitrate * ABR_INCREASE_PERCENT / 100)), fFps);
+    }
+}
+
+void BitrateController::apply(uint32_t bitrate, unsigned fps) {
+    zlog_category_t* c = zlog_get_category("server");
+    if (bitrate != fBitrate) {
+        if (fReader.sendControl(CONTROL_CMD_BITRATE, bitrate)) {
+            zlog_info(c, "Adapting bitrate from %u to %u", fBitrate, bitrate);
+            fBitrate = bitrate;
+        } else {
+            zlog_warn(c, "Failed to send the new bitrate to the streamer");
+        }
+    }
+    if (fMinFps && fps != fFps) {
+        if (fReader.sendControl(CONTROL_CMD_FPS, fps)) {
+            zlog_info(c, "Adapting fps from %u to %u", fFps, fps);
+            fFps = fps;
+        } else {
+            zlog_warn(c, "Failed to send the new fps to the streamer");
+        }
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <config_watch.h>
+
+// The last path component, what the directory events are named after
+static const char *file_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+int config_watch_open(const char *path) {
+    char dir[PATH_MAX];
+    const char *name = file_name(path);
+    if (name == path) {
+        strcpy(dir, ".");
+    } else if (name - path == 1) {
+        strcpy(dir, "/");
+    } else {
+        size_t len = name - path - 1;
+        if (len >= sizeof(dir)) {
+            return -1;
+        }
+        memcpy(dir, path, len);
+        dir[len] = 0;
+    }
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    // Written in place, or moved over the old file
+    if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+uint8_t config_watch_changed(int fd, const char *path) {
+    const char *name = file_name(path);
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    uint8_t changed = 0;
+    ssize_t n;
+    // A save often comes as several events, they all end up in one reload
+    while ((n = read(fd, events, sizeof(events))) > 0) {
+        for (char *p = events; p < events + n;) {
+            const struct inotify_event *event = (const struct inotify_event *) p;
+            if (event->len && strcmp(event->name, name) == 0) {
+                changed = 1;
+            }
+            p += sizeof(*event) + event->len;
+        }
+    }
+    return changed;
+}
+
+void config_watch_close(int fd) {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
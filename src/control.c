@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <control.h>
+
+static void control_address(struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, CONTROL_SOCKET, sizeof(addr->sun_path) - 1);
+}
+
+int control_listen(void) {
+    struct sockaddr_un addr;
+    control_address(&addr);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(addr.sun_path);
+    // Only the streamer's user may change its settings, so the socket is
+    // created 0600 rather than chmod'ed after other users could connect
+    mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    int bound = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    umask(mask);
+    if (bound < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+uint8_t control_recv(int fd, struct control_msg *msg, control_peer *from) {
+    control_peer ignored;
+    if (!from) {
+        from = &ignored;
+    }
+    // Anything else on the socket, like a short datagram, is dropped
+    for (;;) {
+        from->len = sizeof(from->addr);
+        ssize_t n = recvfrom(fd, msg, sizeof(*msg), 0, (struct sockaddr *) &from->addr, &from->len);
+        if (n < 0) {
+            return 0;
+        }
+        if (n == sizeof(*msg)) {
+            return 1;
+        }
+    }
+}
+
+void control_reply(int fd, const control_peer *peer, struct control_msg *msg, uint8_t status) {
+    // Unbound senders have no address to answer to
+    if (peer->len <= sizeof(sa_family_t)) {
+        return;
+    }
+    msg->cmd |= CONTROL_REPLY;
+    msg->status = status;
+    sendto(fd, msg, sizeof(*msg), MSG_DONTWAIT, (const struct sockaddr *) &peer->addr, peer->len);
+}
+
+int control_connect(void) {
+    return socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+}
+
+uint8_t control_send(int fd, uint8_t cmd, uint8_t stream, uint32_t value) {
+    struct sockaddr_un addr;
+    control_address(&addr);
+    struct control_msg msg = {
+        .cmd = cmd,
+        .stream = stream,
+        .value = (int32_t) value,
+    };
+    return sendto(fd, &msg, sizeof(msg), MSG_DONTWAIT, (struct sockaddr *) &addr, sizeof(addr)) == sizeof(msg);
+}
+
+uint8_t control_request(const struct control_msg *msg, struct control_msg *reply, int timeout_ms) {
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    // Binding just the family gives the socket a unique abstract address to reply to
+    struct sockaddr_un self = {.sun_family = AF_UNIX};
+    struct sockaddr_un addr;
+    control_address(&addr);
+    uint8_t ok = bind(fd, (struct sockaddr *) &self, sizeof(sa_family_t)) == 0 &&
+                 sendto(fd, msg, sizeof(*msg), 0, (struct sockaddr *) &addr, sizeof(addr)) == sizeof(*msg);
+    while (ok) {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, timeout_ms) <= 0 || recv(fd, reply, sizeof(*reply), 0) != sizeof(*reply)) {
+            ok = 0;
+        } else if (reply->cmd == (msg->cmd | CONTROL_REPLY)) {
+            break;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+void control_close(int fd, uint8_t listener) {
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+    if (listener) {
+        unlink(CONTROL_SOCKET);
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <rtsdef.h>
+#include <frame_queue.h>
+
+void frame_queue_init(frame_queue *queue) {
+    memset(queue, 0, sizeof(*queue));
+}
+
+uint8_t frame_queue_push(frame_queue *queue, struct rts_av_buffer *buffer, uint64_t recv_time) {
+    uint32_t head = queue->head;
+    // Acquire pairs with the consumer's release, the slot is free once tail moved past it
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= FRAME_QUEUE_SIZE) {
+        return RTS_FALSE;
+    }
+    struct frame_queue_entry *entry = &queue->entries[head & (FRAME_QUEUE_SIZE - 1)];
+    entry->buffer = buffer;
+    entry->recv_time = recv_time;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return RTS_TRUE;
+}
+
+struct rts_av_buffer *frame_queue_pop(frame_queue *queue, uint64_t *recv_time) {
+    uint32_t tail = queue->tail;
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail == head) {
+        return NULL;
+    }
+    const struct frame_queue_entry *entry = &queue->entries[tail & (FRAME_QUEUE_SIZE - 1)];
+    struct rts_av_buffer *buffer = entry->buffer;
+    if (recv_time) {
+        *recv_time = entry->recv_time;
+    }
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return buffer;
+}
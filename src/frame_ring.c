@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <frame_ring.h>
+
+#define FRAME_RING_MAGIC 0x474e4952 // "RING"
+#define FRAME_RING_VERSION 3
+
+struct frame_ring_slot {
+    uint32_t seq;
+    uint32_t pos;
+    uint32_t size;
+    uint32_t flags;
+    uint64_t timestamp;
+    uint64_t recv_time;
+    uint64_t write_time;
+    uint32_t nal_count;
+    struct frame_ring_nal nals[FRAME_RING_MAX_NALS];
+};
+
+struct frame_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t write_seq; // Sequence number of the next frame to be written
+    uint32_t write_pos; // Logical end of the data reserved by the producer
+    uint32_t key_seq;   // Sequence number of the most recent keyframe
+    uint32_t closed;    // Set by a producer that stopped cleanly
+    struct frame_ring_slot slots[FRAME_RING_SLOTS];
+};
+
+struct frame_ring {
+    struct frame_ring_header *hdr;
+    uint8_t *data;
+    size_t map_size;
+    uint8_t owner;
+    char name[64];
+    int doorbell;
+    struct sockaddr_un doorbell_addr;
+    frame_ring_notify notify;
+    void *notify_priv;
+};
+
+static size_t map_size(void) {
+    // Keep the data area page aligned
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t hdr = (sizeof(struct frame_ring_header) + page - 1) & ~(page - 1);
+    return hdr + FRAME_RING_DATA_SIZE;
+}
+
+static void doorbell_address(struct sockaddr_un *addr, const char *name) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "/tmp%s.sock", name);
+}
+
+static frame_ring *ring_map(const char *name, int fd, uint8_t owner) {
+    frame_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->map_size = map_size();
+    void *map = mmap(NULL, ring->map_size, owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        free(ring);
+        return NULL;
+    }
+    ring->hdr = (struct frame_ring_header *) map;
+    ring->data = (uint8_t *) map + (ring->map_size - FRAME_RING_DATA_SIZE);
+    ring->owner = owner;
+    ring->doorbell = -1;
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    doorbell_address(&ring->doorbell_addr, name);
+    return ring;
+}
+
+void frame_ring_name(const char *base, int index, char *name, size_t size) {
+    if (index == 0) {
+        snprintf(name, size, "%s", base);
+    } else {
+        snprintf(name, size, "%s%d", base, index);
+    }
+}
+
+frame_ring *frame_ring_create(const char *name) {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t) map_size()) < 0) {
+        close(fd);
+        return NULL;
+    }
+    frame_ring *ring = ring_map(name, fd, 1);
+    close(fd);
+    if (!ring) {
+        return NULL;
+    }
+
+    // Pick up where a previous producer left off so attached readers carry on
+    struct frame_ring_header *hdr = ring->hdr;
+    if (hdr->magic != FRAME_RING_MAGIC || hdr->version != FRAME_RING_VERSION) {
+        memset(hdr, 0, sizeof(*hdr));
+        for (int i = 0; i < FRAME_RING_SLOTS; i++) {
+            hdr->slots[i].seq = FRAME_RING_SEQ_INVALID;
+        }
+        hdr->key_seq = FRAME_RING_SEQ_INVALID;
+        hdr->version = FRAME_RING_VERSION;
+        __atomic_store_n(&hdr->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    // Readers are woken through a datagram socket, the send is fire and forget
+    ring->doorbell = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    return ring;
+}
+
+frame_ring *frame_ring_open(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < map_size()) {
+        close(fd);
+        return NULL;
+    }
+    frame_ring *ring = ring_map(name, fd, 0);
+    close(fd);
+    if (!ring) {
+        return NULL;
+    }
+    if (__atomic_load_n(&ring->hdr->magic, __ATOMIC_ACQUIRE) != FRAME_RING_MAGIC ||
+        ring->hdr->version != FRAME_RING_VERSION) {
+        frame_ring_close(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+frame_ring *frame_ring_reopen(frame_ring *closed) {
+    frame_ring *ring = frame_ring_open(closed->name);
+    if (!ring) {
+        return NULL;
+    }
+    // Already bound to the address the new producer rings
+    ring->doorbell = closed->doorbell;
+    closed->doorbell = -1;
+    return ring;
+}
+
+int frame_ring_doorbell(frame_ring *ring) {
+    if (ring->doorbell >= 0) {
+        return ring->doorbell;
+    }
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(ring->doorbell_addr.sun_path);
+    if (bind(fd, (struct sockaddr *) &ring->doorbell_addr, sizeof(ring->doorbell_addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    ring->doorbell = fd;
+    return fd;
+}
+
+void frame_ring_drain_doorbell(frame_ring *ring) {
+    uint32_t seq;
+    while (recv(ring->doorbell, &seq, sizeof(seq), 0) > 0) {
+    }
+}
+
+// Index the NAL units of an Annex B access unit. Scanning stops at the first
+// slice, which runs to the end of the buffer; the encoder emits a single slice
+// per picture so only the few bytes of SPS/PPS/SEI ahead of it are looked at.
+static void index_nals(struct frame_ring_slot *slot, const uint8_t *data, uint32_t size) {
+    uint32_t i = 0;
+    slot->nal_count = 0;
+    while (i + 3 <= size && slot->nal_count < FRAME_RING_MAX_NALS) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+            i++;
+            continue;
+        }
+        i += 3;
+        if (slot->nal_count > 0) {
+            struct frame_ring_nal *prev = &slot->nals[slot->nal_count - 1];
+            // Drop the start code (and the leading zero of a 4 byte one) from the previous NAL
+            uint32_t end = i - 3;
+            if (end > prev->offset && data[end - 1] == 0) {
+                end--;
+            }
+            prev->size = end - prev->offset;
+        }
+        if (i >= size) {
+            break;
+        }
+        struct frame_ring_nal *nal = &slot->nals[slot->nal_count++];
+        nal->offset = i;
+        nal->size = size - i;
+        uint8_t type = data[i] & 0x1f;
+        if (type == 5) {
+            slot->flags |= FRAME_RING_FLAG_KEY;
+        }
+        if (type >= 1 && type <= 5) {
+            return;
+        }
+    }
+    if (slot->nal_count == FRAME_RING_MAX_NALS) {
+        // The table filled up before the slice, the last entry would swallow the slice and its start code
+        slot->nal_count = 0;
+        slot->flags &= ~FRAME_RING_FLAG_KEY;
+    }
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint8_t frame_ring_write(frame_ring *ring, const void *data, uint32_t size, uint32_t flags, uint64_t timestamp, uint64_t recv_time) {
+    struct frame_ring_header *hdr = ring->hdr;
+    if (size == 0 || size > FRAME_RING_DATA_SIZE / 2) {
+        return 0;
+    }
+
+    // Frames are stored contiguously, skip the tail of the data area if it does not fit
+    uint32_t pos = hdr->write_pos;
+    uint32_t offset = pos & (FRAME_RING_DATA_SIZE - 1);
+    if (offset + size > FRAME_RING_DATA_SIZE) {
+        pos += FRAME_RING_DATA_SIZE - offset;
+        offset = 0;
+    }
+
+    uint32_t seq = hdr->write_seq;
+    struct frame_ring_slot *slot = &hdr->slots[seq & (FRAME_RING_SLOTS - 1)];
+
+    // Invalidate the slot and reserve the data before touching either
+    __atomic_store_n(&slot->seq, FRAME_RING_SEQ_INVALID, __ATOMIC_RELAXED);
+    __atomic_store_n(&hdr->write_pos, pos + size, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    memcpy(ring->data + offset, data, size);
+    slot->pos = pos;
+    slot->size = size;
+    slot->flags = flags;
+    slot->timestamp = timestamp;
+    slot->recv_time = recv_time;
+    index_nals(slot, ring->data + offset, size);
+    slot->write_time = now_us();
+
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    if (slot->flags & FRAME_RING_FLAG_KEY) {
+        __atomic_store_n(&hdr->key_seq, seq, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&hdr->write_seq, seq + 1, __ATOMIC_RELEASE);
+
+    if (ring->notify) {
+        ring->notify(ring->notify_priv);
+    } else if (ring->doorbell >= 0) {
+        sendto(ring->doorbell, &seq, sizeof(seq), MSG_DONTWAIT,
+               (struct sockaddr *) &ring->doorbell_addr, sizeof(ring->doorbell_addr));
+    }
+    return 1;
+}
+
+void frame_ring_set_notify(frame_ring *ring, frame_ring_notify notify, void *priv) {
+    ring->notify = notify;
+    ring->notify_priv = priv;
+}
+
+uint32_t frame_ring_head(const frame_ring *ring) {
+    return __atomic_load_n(&ring->hdr->write_seq, __ATOMIC_ACQUIRE);
+}
+
+uint32_t frame_ring_last_key(const frame_ring *ring) {
+    return __atomic_load_n(&ring->hdr->key_seq, __ATOMIC_ACQUIRE);
+}
+
+enum frame_ring_status frame_ring_peek(const frame_ring *ring, uint32_t seq, frame_ring_frame *frame) {
+    const struct frame_ring_header *hdr = ring->hdr;
+    uint32_t head = __atomic_load_n(&hdr->write_seq, __ATOMIC_ACQUIRE);
+    if ((int32_t) (seq - head) >= 0) {
+        return FRAME_RING_EMPTY;
+    }
+    if (head - seq > FRAME_RING_SLOTS) {
+        return FRAME_RING_OVERRUN;
+    }
+
+    const struct frame_ring_slot *slot = &hdr->slots[seq & (FRAME_RING_SLOTS - 1)];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq) {
+        return FRAME_RING_OVERRUN;
+    }
+    frame->seq = seq;
+    frame->pos = slot->pos;
+    frame->size = slot->size;
+    frame->flags = slot->flags;
+    frame->timestamp = slot->timestamp;
+    frame->recv_time = slot->recv_time;
+    frame->write_time = slot->write_time;
+    frame->nal_count = slot->nal_count;
+    memcpy(frame->nals, slot->nals, sizeof(frame->nals));
+    frame->data = ring->data + (slot->pos & (FRAME_RING_DATA_SIZE - 1));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+        return FRAME_RING_OVERRUN;
+    }
+    return frame_ring_valid(ring, frame) ? FRAME_RING_OK : FRAME_RING_OVERRUN;
+}
+
+uint8_t frame_ring_valid(const frame_ring *ring, const frame_ring_frame *frame) {
+    // Anything read from the frame must be ordered before the check
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint32_t write_pos = __atomic_load_n(&ring->hdr->write_pos, __ATOMIC_RELAXED);
+    return write_pos - frame->pos <= FRAME_RING_DATA_SIZE;
+}
+
+uint8_t frame_ring_closed(const frame_ring *ring) {
+    return __atomic_load_n(&ring->hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+void frame_ring_close(frame_ring *ring) {
+    if (!ring) {
+        return;
+    }
+    if (ring->owner) {
+        // Readers still attached keep the mapping until they move to the next producer's ring
+        __atomic_store_n(&ring->hdr->closed, 1, __ATOMIC_RELEASE);
+        shm_unlink(ring->name);
+    }
+    if (ring->doorbell >= 0) {
+        close(ring->doorbell);
+        if (!ring->owner) {
+            unlink(ring->doorbell_addr.sun_path);
+        }
+    }
+    munmap(ring->hdr, ring->map_size);
+    free(ring);
+}
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <netinet/in.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <zlog.h>
+#include <frame_ring_sink.h>
+
+// Bytes a TCP client may have queued in its socket, beyond that it is
+// behind and frames are skipped; also bounds the kernel memory per client
+#define TCP_SEND_BUDGET (256 * 1024)
+// "$", channel and length in front of every interleaved packet
+#define TCP_FRAMING_SIZE 4
+// Bytes the pacer lets out back to back, small frames are never delayed
+#define PACING_BURST (4 * RTP_MAX_PACKET_SIZE)
+
+static int64_t now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+FrameRingRTPSink* FrameRingRTPSink::createNew(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                              const u_int8_t* sps, unsigned spsSize, const u_int8_t* pps, unsigned ppsSize) {
+    return new FrameRingRTPSink(env, RTPgs, rtpPayloadFormat, sps, spsSize, pps, ppsSize);
+}
+
+FrameRingRTPSink::FrameRingRTPSink(UsageEnvironment& env, Groupsock* RTPgs, unsigned char rtpPayloadFormat,
+                                   const u_int8_t* sps, unsigned spsSize, const u_int8_t* pps, unsigned ppsSize)
+    : H264VideoRTPSink(env, RTPgs, rtpPayloadFormat, sps, spsSize, pps, ppsSize),
+      fReader(nullptr), fNextPacket(0), fPendingTimestamp(0), fFrameStart(0), fFrameDelayed(False),
+      fPacing(0), fFrameInterval(0), fRate(0), fTokens(PACING_BURST), fLastRefill(0), fPacingStats(),
+      fHaveDestination(False), fDestinationSize(0), fTCPSocket(-1), fPacketsDropped(0) {
+}
+
+FrameRingRTPSink::~FrameRingRTPSink() {
+    if (fPacingStats.pacedFrames > 0) {
+        zlog_info(zlog_get_category("server"), "Paced %u of %u frames, longest took %u us, average %u us",
+                  fPacingStats.pacedFrames, fPacingStats.frames, fPacingStats.maxSpread,
+                  (unsigned) (fPacingStats.totalSpread / fPacingStats.frames));
+    }
+    logDropped();
+    if (fReader != nullptr) {
+        fReader->removeSink(this);
+    }
+}
+
+void FrameRingRTPSink::setDestination(const struct sockaddr_storage& addr, Port const& port) {
+    fDestination = addr;
+    if (addr.ss_family == AF_INET6) {
+        reinterpret_cast<struct sockaddr_in6*>(&fDestination)->sin6_port = port.num();
+        fDestinationSize = sizeof(struct sockaddr_in6);
+    } else {
+        reinterpret_cast<struct sockaddr_in*>(&fDestination)->sin_port = port.num();
+        fDestinationSize = sizeof(struct sockaddr_in);
+    }
+    fHaveDestination = True;
+}
+
+void FrameRingRTPSink::setTCPSocket(int socketNum) {
+    int size = TCP_SEND_BUDGET;
+    if (setsockopt(socketNum, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0) {
+        zlog_warn(zlog_get_category("server"), "Failed to size the send buffer of TCP client socket %d", socketNum);
+    }
+    fTCPSocket = socketNum;
+}
+
+Boolean FrameRingRTPSink::sourceIsCompatibleWithUs(MediaSource& /*source*/) {
+    // FrameRingMediaSubsession only ever pairs us with a FrameRingSource
+    return True;
+}
+
+void FrameRingRTPSink::logDropped() {
+    if (fPacketsDropped > 0) {
+        zlog_info(zlog_get_category("server"), "Dropped %llu RTP packets the socket buffer had no room for",
+                  (unsigned long long) fPacketsDropped);
+        fPacketsDropped = 0;
+    }
+}
+
+void FrameRingRTPSink::stopPlaying() {
+    fPending.reset();
+    logDropped();
+    if (fReader != nullptr) {
+        fReader->removeSink(this);
+        fReader = nullptr;
+    }
+    H264VideoRTPSink::stopPlaying();
+}
+
+Boolean FrameRingRTPSink::continuePlaying() {
+    auto* source = static_cast<FrameRingSource*>(fSource);
+    source->setFrameHandler(frameAvailable, this);
+    // Lets the reader's rate controller see our receiver reports
+    fReader = &source->reader();
+    fReader->addSink(this);
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0, sendNext, this);
+    return True;
+}
+
+void FrameRingRTPSink::frameAvailable(void* clientData) {
+    auto* sink = static_cast<FrameRingRTPSink*>(clientData);
+    // A paced frame still going out picks the new one up when it is done
+    if (sink->nextTask() == nullptr) {
+        sink->sendNext();
+    }
+}
+
+void FrameRingRTPSink::sendNext(void* clientData) {
+    static_cast<FrameRingRTPSink*>(clientData)->sendNext();
+}
+
+void FrameRingRTPSink::sendNext() {
+    nextTask() = nullptr;
+    if (fSource == nullptr) {
+        return;
+    }
+    auto* source = static_cast<FrameRingSource*>(fSource);
+    if (!fPending) {
+        auto frame = source->nextPacketizedFrame();
+        if (!frame) {
+            // The source calls frameAvailable() once the streamer writes another frame
+            return;
+        }
+        if (fTCPSocket >= 0 && !tcpHasRoom(*frame)) {
+            // Skip whole frames, a decoder recovers from a missing GOP but not from missing packets
+            source->skipFrame(*frame, "TCP client falling behind");
+        } else if (!fReader->valid(*frame)) {
+            source->skipFrame(*frame, "Video ring overrun before sending");
+        } else {
+            startFrame(frame);
+        }
+    }
+    if (fPending) {
+        while (fNextPacket < fPending->packets.size()) {
+            size_t end = std::min(fPending->packets.size(), fNextPacket + SEND_BATCH);
+            if (fPacing) {
+                int64_t delay;
+                end = pacedEnd(end, delay);
+                if (end == fNextPacket) {
+                    nextTask() = envir().taskScheduler().scheduleDelayedTask(delay, sendNext, this);
+                    return;
+                }
+            }
+            sendBatch(end);
+        }
+        finishFrame();
+    }
+    // One frame per pass, a GOP replay should not hold up the other clients
+    nextTask() = envir().taskScheduler().scheduleDelayedTask(0, sendNext, this);
+}
+
+Boolean FrameRingRTPSink::tcpHasRoom(const PacketizedFrame& frame) {
+    int queued;
+    if (ioctl(fTCPSocket, SIOCOUTQ, &queued) < 0) {
+        return True;
+    }
+    size_t needed = frame.payloadSize + frame.packets.size() * (TCP_FRAMING_SIZE + RTP_HEADER_SIZE);
+    return queued + needed <= TCP_SEND_BUDGET;
+}
+
+void FrameRingRTPSink::startFrame(const std::shared_ptr<const PacketizedFrame>& frame) {
+    fPending = frame;
+    fNextPacket = 0;
+    fPendingTimestamp = convertToRTPTimestamp(frame->presentationTime);
+    fFrameStart = now_us();
+    fFrameDelayed = False;
+    if (fPacing) {
+        // Spread the frame over its share of the frame interval
+        uint64_t bytes = frame->payloadSize + frame->packets.size() * RTP_HEADER_SIZE;
+        uint64_t window = std::max<uint64_t>(1, (uint64_t) fFrameInterval * fPacing / 100);
+        fRate = std::max<uint64_t>(1, bytes * 1000000 / window);
+    }
+}
+
+size_t FrameRingRTPSink::pacedEnd(size_t end, int64_t& delay) {
+    int64_t now = now_us();
+    if (fLastRefill != 0 && now > fLastRefill) {
+        fTokens = std::min<int64_t>(PACING_BURST, fTokens + (now - fLastRefill) * (int64_t) fRate / 1000000);
+    }
+    fLastRefill = now;
+    size_t i = fNextPacket;
+    for (; i < end; i++) {
+        int64_t size = RTP_HEADER_SIZE + fPending->packets[i].fuSize + fPending->packets[i].size;
+        if (size > fTokens) {
+            break;
+        }
+        fTokens -= size;
+    }
+    if (i == fNextPacket) {
+        const RTPPayload& next = fPending->packets[i];
+        int64_t missing = RTP_HEADER_SIZE + next.fuSize + next.size - fTokens;
+        delay = missing * 1000000 / (int64_t) fRate + 1;
+        fFrameDelayed = True;
+    }
+    return i;
+}
+
+void FrameRingRTPSink::finishFrame() {
+    // The packets were read from the ring as they went out
+    if (!fReader->valid(*fPending)) {
+        static_cast<FrameRingSource*>(fSource)->skipFrame(*fPending, "Video ring overrun while sending");
+    }
+    if (fInitialPresentationTime.tv_sec == 0 && fInitialPresentationTime.tv_usec == 0) {
+        fInitialPresentationTime = fPending->presentationTime;
+    }
+    fMostRecentPresentationTime = fPending->presentationTime;
+    fCurrentTimestamp = fPendingTimestamp;
+    fReader->frameSent(*fPending);
+    fPending.reset();
+
+    unsigned spread = (unsigned) (now_us() - fFrameStart);
+    fPacingStats.frames++;
+    if (fFrameDelayed) {
+        fPacingStats.pacedFrames++;
+    }
+    fPacingStats.totalSpread += spread;
+    fPacingStats.maxSpread = std::max(fPacingStats.maxSpread, spread);
+}
+
+void FrameRingRTPSink::sendBatch(size_t end) {
+    const PacketizedFrame& frame = *fPending;
+    u_int32_t ssrc = SSRC();
+    unsigned count = 0;
+    unsigned bytes = 0;
+    for (size_t i = fNextPacket; i < end; i++, count++) {
+        const RTPPayload& payload = frame.packets[i];
+        Boolean last = i + 1 == frame.packets.size();
+        u_int32_t timestamp = fPendingTimestamp;
+        u_int8_t* header = fHeaders[count];
+        header[0] = 0x80; // Version 2, no padding, extension or CSRCs
+        header[1] = (last ? 0x80 : 0) | fRTPPayloadType; // Marker on the last packet of the access unit
+        header[2] = fSeqNo >> 8;
+        header[3] = fSeqNo;
+        header[4] = timestamp >> 24;
+        header[5] = timestamp >> 16;
+        header[6] = timestamp >> 8;
+        header[7] = timestamp;
+        header[8] = ssrc >> 24;
+        header[9] = ssrc >> 16;
+        header[10] = ssrc >> 8;
+        header[11] = ssrc;
+
+        if (fHaveDestination) {
+            // Header from the arena, FU bytes from the shared descriptor, the rest from the ring
+            struct iovec* iov = fIov[count];
+            int parts = 0;
+            iov[parts].iov_base = header;
+            iov[parts++].iov_len = RTP_HEADER_SIZE;
+            if (payload.fuSize) {
+                iov[parts].iov_base = const_cast<u_int8_t*>(payload.fu);
+                iov[parts++].iov_len = payload.fuSize;
+            }
+            iov[parts].iov_base = const_cast<u_int8_t*>(payload.data);
+            iov[parts++].iov_len = payload.size;
+            struct msghdr& msg = fMessages[count].msg_hdr;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &fDestination;
+            msg.msg_namelen = fDestinationSize;
+            msg.msg_iov = iov;
+            msg.msg_iovlen = parts;
+        } else {
+            sendPacket(header, payload);
+        }
+        fSeqNo++;
+        bytes += payload.fuSize + payload.size;
+    }
+
+    unsigned sent = count;
+    if (fHaveDestination && count > 0) {
+        sent = sendMessages(count);
+        if (sent < count) {
+            bytes = 0;
+            for (unsigned i = 0; i < sent; i++) {
+                bytes += fMessages[i].msg_len - RTP_HEADER_SIZE;
+            }
+            fPacketsDropped += count - sent;
+            fReader->packetsDropped(count - sent);
+        }
+    }
+    // Kept up to date for the RTCP sender reports, only with what reached the socket
+    fPacketCount += sent;
+    fOctetCount += bytes;
+    fTotalOctetCount += sent * RTP_HEADER_SIZE + bytes;
+    fReader->packetsSent(sent, bytes);
+    fNextPacket = end;
+}
+
+// Returns how many of the first count messages went out, sendmmsg() stops at the first that fails
+unsigned FrameRingRTPSink::sendMessages(unsigned count) {
+    int socketNum = fRTPInterface.gs()->socketNum();
+    unsigned done = 0;
+    while (done < count) {
+        int sent = sendmmsg(socketNum, fMessages + done, count - done, MSG_DONTWAIT);
+        if (sent > 0) {
+            done += sent;
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        // Like Groupsock::output(), packets that do not fit in the socket buffer are dropped. Whatever
+        // stopped this one, mostly a full buffer, stops the rest of the batch as well.
+        break;
+    }
+    return done;
+}
+
+void FrameRingRTPSink::sendPacket(const u_int8_t* header, const RTPPayload& payload) {
+    // RTPInterface wants the packet in one piece
+    memcpy(fPacket, header, RTP_HEADER_SIZE);
+    memcpy(fPacket + RTP_HEADER_SIZE, payload.fu, payload.fuSize);
+    memcpy(fPacket + RTP_HEADER_SIZE + payload.fuSize, payload.data, payload.size);
+    fRTPInterface.sendPacket(fPacket, RTP_HEADER_SIZE + payload.fuSize + payload.size);
+}
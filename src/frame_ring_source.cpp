@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <time.h>
+#include <zlog.h>
+#include <frame_ring_source.h>
+
+// Re-anchor the encoder clock when it strays this far from the wall clock,
+// e.g. after the streamer restarts and its timestamps start over
+#define MAX_CLOCK_SKEW_US 10000000LL
+// Packetized frames kept for other clients, enough for the live edge where
+// every client asks for the same frame on the same doorbell
+#define PACKETIZED_CACHE 4
+#define FU_A_TYPE 28
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Adds the time from start to end, skipping samples from clocks that disagree
+static void addLatency(histogram& h, uint64_t start, uint64_t end) {
+    if (start != 0 && end >= start) {
+        histogram_add(&h, end - start);
+    }
+}
+
+FrameRingReader::FrameRingReader(UsageEnvironment& env, const char* name, uint8_t stream)
+    : fEnv(env), fName(strDup(name)), fStream(stream), fRing(nullptr), fRetired(nullptr), fGeneration(0), fOwnsRing(True),
+      fTrigger(0), fGopCache(False), fControl(-1), fHaveTimeBase(False), fTimeBaseTimestamp(0) {
+    memset(&fLatency, 0, sizeof(fLatency));
+    fPacketsSent = fBytesSent = fPacketsDropped = 0;
+}
+
+FrameRingReader::FrameRingReader(UsageEnvironment& env, const char* name, uint8_t stream, frame_ring* ring)
+    : fEnv(env), fName(strDup(name)), fStream(stream), fRing(ring), fRetired(nullptr), fGeneration(0), fOwnsRing(False),
+      fGopCache(False), fControl(-1), fHaveTimeBase(False), fTimeBaseTimestamp(0) {
+    memset(&fLatency, 0, sizeof(fLatency));
+    fPacketsSent = fBytesSent = fPacketsDropped = 0;
+    fTrigger = env.taskScheduler().createEventTrigger(frameTriggered);
+    frame_ring_set_notify(ring, frameWritten, this);
+}
+
+FrameRingReader::~FrameRingReader() {
+    control_close(fControl, False);
+    if (!fOwnsRing) {
+        frame_ring_set_notify(fRing, nullptr, nullptr);
+        fEnv.taskScheduler().deleteEventTrigger(fTrigger);
+    } else if (fRing != nullptr) {
+        fEnv.taskScheduler().turnOffBackgroundReadHandling(frame_ring_doorbell(fRing));
+        frame_ring_close(fRing);
+    }
+    frame_ring_close(fRetired);
+    delete[] fName;
+}
+
+frame_ring* FrameRingReader::ring() {
+    if (fRing != nullptr) {
+        return fRing;
+    }
+    zlog_category_t* c = zlog_get_category("server");
+    fRing = frame_ring_open(fName);
+    if (fRing == nullptr) {
+        zlog_warn(c, "Video ring %s is not available yet", fName);
+        return nullptr;
+    }
+    int doorbell = frame_ring_doorbell(fRing);
+    if (doorbell < 0) {
+        zlog_error(c, "Failed to bind the doorbell for %s", fName);
+        frame_ring_close(fRing);
+        fRing = nullptr;
+        return nullptr;
+    }
+    fEnv.taskScheduler().turnOnBackgroundReadHandling(doorbell, doorbellHandler, this);
+    zlog_info(c, "Attached to video ring %s", fName);
+    return fRing;
+}
+
+Boolean FrameRingReader::parameterSets(u_int8_t* sps, unsigned& spsSize, u_int8_t* pps, unsigned& ppsSize, unsigned maxSize) {
+    frame_ring* r = ring();
+    if (r == nullptr) {
+        return False;
+    }
+    uint32_t key = frame_ring_last_key(r);
+    frame_ring_frame frame;
+    if (key == FRAME_RING_SEQ_INVALID || frame_ring_peek(r, key, &frame) != FRAME_RING_OK) {
+        return False;
+    }
+    spsSize = ppsSize = 0;
+    for (unsigned i = 0; i < frame.nal_count; i++) {
+        const frame_ring_nal& nal = frame.nals[i];
+        u_int8_t type = frame.data[nal.offset] & 0x1f;
+        if (type == 7 && nal.size <= maxSize) {
+            memcpy(sps, frame.data + nal.offset, nal.size);
+            spsSize = nal.size;
+        } else if (type == 8 && nal.size <= maxSize) {
+            memcpy(pps, frame.data + nal.offset, nal.size);
+            ppsSize = nal.size;
+        }
+    }
+    return frame_ring_valid(r, &frame) && spsSize > 0 && ppsSize > 0;
+}
+
+void FrameRingReader::presentationTime(uint64_t timestamp, struct timeval& tv) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (fHaveTimeBase) {
+        // rts_av_buffer::timestamp is in microseconds
+        int64_t delta = (int64_t) (timestamp - fTimeBaseTimestamp);
+        int64_t us = (int64_t) fTimeBase.tv_sec * 1000000 + fTimeBase.tv_usec + delta;
+        int64_t skew = us - ((int64_t) now.tv_sec * 1000000 + now.tv_usec);
+        if (delta >= 0 && skew < MAX_CLOCK_SKEW_US && skew > -MAX_CLOCK_SKEW_US) {
+            tv.tv_sec = us / 1000000;
+            tv.tv_usec = us % 1000000;
+            return;
+        }
+        zlog_info(zlog_get_category("server"), "Encoder clock jumped by %lld us, re-anchoring presentation times", (long long) skew);
+    }
+    fHaveTimeBase = True;
+    fTimeBaseTimestamp = timestamp;
+    fTimeBase = now;
+    tv = now;
+}
+
+uint32_t FrameRingReader::startSeq() {
+    frame_ring* r = ring();
+    uint32_t head = frame_ring_head(r);
+    if (!fGopCache) {
+        return head;
+    }
+    // The ring is the cache, the GOP is replayed from it as long as the producer has not lapped it
+    uint32_t key = frame_ring_last_key(r);
+    frame_ring_frame frame;
+    if (key == FRAME_RING_SEQ_INVALID || frame_ring_peek(r, key, &frame) != FRAME_RING_OK) {
+        return head;
+    }
+    zlog_debug(zlog_get_category("server"), "Replaying %u cached frames from keyframe %u", head - key, key);
+    return key;
+}
+
+void FrameRingReader::requestKeyFrame() {
+    if (!sendControl(CONTROL_CMD_KEY_FRAME, 0)) {
+        zlog_warn(zlog_get_category("server"), "Failed to request a keyframe for %s", fName);
+    }
+}
+
+Boolean FrameRingReader::sendControl(uint8_t cmd, uint32_t value) {
+    if (fControl < 0) {
+        fControl = control_connect();
+    }
+    return fControl >= 0 && control_send(fControl, cmd, fStream, value);
+}
+
+void FrameRingReader::addSink(RTPSink* sink) {
+    if (std::find(fSinks.begin(), fSinks.end(), sink) == fSinks.end()) {
+        fSinks.push_back(sink);
+    }
+}
+
+void FrameRingReader::removeSink(RTPSink* sink) {
+    fSinks.erase(std::remove(fSinks.begin(), fSinks.end(), sink), fSinks.end());
+}
+
+std::shared_ptr<const PacketizedFrame> FrameRingReader::packetize(const frame_ring_frame& frame) {
+    for (const auto& cached : fPacketized) {
+        if (cached->seq == frame.seq) {
+            return cached;
+        }
+    }
+
+    auto packets = std::make_shared<PacketizedFrame>();
+    packets->seq = frame.seq;
+    packets->generation = fGeneration;
+    presentationTime(frame.timestamp, packets->presentationTime);
+    packets->readTime = now_us();
+    packets->live = frame.seq + 1 == frame_ring_head(ring());
+    packets->keyFrame = (frame.flags & FRAME_RING_FLAG_KEY) != 0;
+    packets->reference = False;
+    packets->payloadSize = 0;
+    packets->frame = frame;
+    const unsigned maxPayload = RTP_MAX_PACKET_SIZE - RTP_HEADER_SIZE;
+    packets->packets.reserve(frame.size / (maxPayload - 2) + frame.nal_count + 1);
+    for (unsigned i = 0; i < frame.nal_count; i++) {
+        const u_int8_t* nal = frame.data + frame.nals[i].offset;
+        unsigned size = frame.nals[i].size;
+        u_int8_t type = nal[0] & 0x1f;
+        if ((type == 1 || type == 5) && (nal[0] & 0x60)) {
+            packets->reference = True;
+        }
+        if (size <= maxPayload) {
+            packets->packets.push_back({nal, size, {0, 0}, 0});
+            packets->payloadSize += size;
+            continue;
+        }
+        // FU-A: the NAL header is split into the FU indicator and FU header of every fragment
+        u_int8_t indicator = (nal[0] & 0xe0) | FU_A_TYPE;
+        for (unsigned pos = 1; pos < size;) {
+            unsigned chunk = std::min(maxPayload - 2, size - pos);
+            u_int8_t header = nal[0] & 0x1f;
+            if (pos == 1) {
+                header |= 0x80;
+            }
+            if (pos + chunk == size) {
+                header |= 0x40;
+            }
+            packets->packets.push_back({nal + pos, chunk, {indicator, header}, 2});
+            packets->payloadSize += chunk + 2;
+            pos += chunk;
+        }
+    }
+    if (!frame_ring_valid(ring(), &frame)) {
+        return nullptr;
+    }
+
+    if (packets->live) {
+        addLatency(fLatency.encode, frame.timestamp, frame.recv_time);
+        addLatency(fLatency.queue, frame.recv_time, frame.write_time);
+        addLatency(fLatency.ring, frame.write_time, packets->readTime);
+    }
+
+    if (fPacketized.size() >= PACKETIZED_CACHE) {
+        fPacketized.pop_front();
+    }
+    fPacketized.push_back(packets);
+    return packets;
+}
+
+Boolean FrameRingReader::valid(const PacketizedFrame& frame) {
+    return frame.generation == fGeneration && frame_ring_valid(ring(), &frame.frame);
+}
+
+void FrameRingReader::frameSent(const PacketizedFrame& frame) {
+    if (frame.live) {
+        uint64_t now = now_us();
+        addLatency(fLatency.send, frame.readTime, now);
+        addLatency(fLatency.total, frame.frame.timestamp, now);
+    }
+}
+
+void FrameRingReader::waitForFrame(FrameRingSource* source) {
+    if (std::find(fWaiting.begin(), fWaiting.end(), source) == fWaiting.end()) {
+        fWaiting.push_back(source);
+    }
+}
+
+void FrameRingReader::cancelWait(FrameRingSource* source) {
+    fWaiting.erase(std::remove(fWaiting.begin(), fWaiting.end(), source), fWaiting.end());
+}
+
+void FrameRingReader::doorbellHandler(void* clientData, int /*mask*/) {
+    auto* reader = static_cast<FrameRingReader*>(clientData);
+    frame_ring_drain_doorbell(reader->fRing);
+    if (frame_ring_closed(reader->fRing)) {
+        // Only a restarted streamer rings the doorbell of a closed ring
+        reader->reattach();
+    }
+    reader->wakeSources();
+}
+
+void FrameRingReader::reattach() {
+    zlog_category_t* c = zlog_get_category("server");
+    frame_ring* ring = frame_ring_reopen(fRing);
+    if (ring == nullptr) {
+        zlog_warn(c, "Video ring %s was closed and the new one is not available yet", fName);
+        return;
+    }
+    frame_ring_close(fRetired);
+    fRetired = fRing;
+    fRing = ring;
+    fGeneration++;
+    fPacketized.clear();
+    fHaveTimeBase = False;
+    zlog_info(c, "Attached to the video ring %s of the restarted streamer", fName);
+}
+
+void FrameRingReader::frameWritten(void* clientData) {
+    // Called on the capture thread, triggerEvent() is the one scheduler call that is safe there
+    auto* reader = static_cast<FrameRingReader*>(clientData);
+    reader->fEnv.taskScheduler().triggerEvent(reader->fTrigger, reader);
+}
+
+void FrameRingReader::frameTriggered(void* clientData) {
+    static_cast<FrameRingReader*>(clientData)->wakeSources();
+}
+
+void FrameRingReader::wakeSources() {
+    // Sources may start waiting again while being woken
+    std::vector<FrameRingSource*> waiting;
+    waiting.swap(fWaiting);
+    for (FrameRingSource* source : waiting) {
+        source->frameAvailable();
+    }
+}
+
+FrameRingSource* FrameRingSource::createNew(UsageEnvironment& env, FrameRingReader& reader) {
+    frame_ring* ring = reader.ring();
+    if (ring == nullptr) {
+        return nullptr;
+    }
+    return new FrameRingSource(env, reader);
+}
+
+FrameRingSource::FrameRingSource(UsageEnvironment& env, FrameRingReader& reader)
+    : FramedSource(env), fReader(reader), fGeneration(reader.generation()), fSeq(0), fNalIndex(0), fPositioned(False),
+      fWaitForKey(True), fStarted(False), fFramesDropped(0), fGopsDropped(0), fFrameHandler(nullptr), fFrameHandlerData(nullptr) {
+    fFrame.nal_count = 0;
+}
+
+FrameRingSource::~FrameRingSource() {
+    fReader.cancelWait(this);
+    if (fGopsDropped > 0) {
+        zlog_info(zlog_get_category("server"), "Client fell behind %u times, dropped %u frames", fGopsDropped, fFramesDropped);
+    }
+}
+
+void FrameRingSource::doGetNextFrame() {
+    if (deliverNal()) {
+        // Delivered synchronously, go through the event loop to avoid recursion
+        nextTask() = envir().taskScheduler().scheduleDelayedTask(0, (TaskFunc*) FramedSource::afterGetting, this);
+    }
+}
+
+void FrameRingSource::doStopGettingFrames() {
+    fReader.cancelWait(this);
+    envir().taskScheduler().unscheduleDelayedTask(nextTask());
+}
+
+void FrameRingSource::frameAvailable() {
+    if (fFrameHandler != nullptr) {
+        fFrameHandler(fFrameHandlerData);
+        return;
+    }
+    if (isCurrentlyAwaitingData() && deliverNal()) {
+        FramedSource::afterGetting(this);
+    }
+}
+
+std::shared_ptr<const PacketizedFrame> FrameRingSource::nextPacketizedFrame() {
+    for (;;) {
+        if (!nextFrame()) {
+            return nullptr;
+        }
+        auto packets = fReader.packetize(fFrame);
+        if (packets) {
+            return packets;
+        }
+        fFramesDropped++;
+        dropUntilKeyFrame("Video ring overrun while packetizing");
+    }
+}
+
+void FrameRingSource::setFrameHandler(TaskFunc* handler, void* clientData) {
+    fFrameHandler = handler;
+    fFrameHandlerData = clientData;
+}
+
+void FrameRingSource::skipFrame(const PacketizedFrame& frame, const char* reason) {
+    fFramesDropped++;
+    if (frame.reference || frame.keyFrame) {
+        dropUntilKeyFrame(reason);
+    }
+}
+
+Boolean FrameRingSource::nextFrame() {
+    frame_ring* ring = fReader.ring();
+    if (fGeneration != fReader.generation()) {
+        // The streamer restarted, its encoder starts over with an IDR
+        fGeneration = fReader.generation();
+        fPositioned = False;
+        fWaitForKey = True;
+    }
+    if (!fPositioned) {
+        // Picked at the first read rather than at SETUP, so PLAY gets the freshest GOP
+        fSeq = fReader.startSeq();
+        fPositioned = True;
+    }
+    for (;;) {
+        switch (frame_ring_peek(ring, fSeq, &fFrame)) {
+            case FRAME_RING_OK:
+                fSeq++;
+                if (fFrame.nal_count == 0) {
+                    // Nothing to send, the decoder has to treat it as lost
+                    if (fStarted) {
+                        fFramesDropped++;
+                    }
+                    if (!fWaitForKey) {
+                        dropUntilKeyFrame("Frame without NAL units");
+                    }
+                    break;
+                }
+                if (fWaitForKey && !(fFrame.flags & FRAME_RING_FLAG_KEY)) {
+                    if (fStarted) {
+                        fFramesDropped++;
+                    }
+                    break;
+                }
+                fWaitForKey = False;
+                fStarted = True;
+                fNalIndex = 0;
+                fReader.presentationTime(fFrame.timestamp, fPresentationTime);
+                return True;
+            case FRAME_RING_EMPTY:
+                fReader.waitForFrame(this);
+                return False;
+            case FRAME_RING_OVERRUN: {
+                uint32_t head = frame_ring_head(ring);
+                fFramesDropped += head - fSeq;
+                fSeq = head;
+                dropUntilKeyFrame("Video ring overrun");
+                break;
+            }
+        }
+    }
+}
+
+void FrameRingSource::dropUntilKeyFrame(const char* reason) {
+    fNalIndex = fFrame.nal_count;
+    fWaitForKey = True;
+    fGopsDropped++;
+    zlog_warn(zlog_get_category("server"), "%s, dropping frames until the next keyframe (%u frames dropped so far)", reason, fFramesDropped);
+}
+
+Boolean FrameRingSource::deliverNal() {
+    if (fGeneration != fReader.generation()) {
+        // The rest of the frame is in the ring of the stopped streamer
+        fNalIndex = fFrame.nal_count;
+    }
+    for (;;) {
+        if (fNalIndex >= fFrame.nal_count && !nextFrame()) {
+            return False;
+        }
+        const frame_ring_nal& nal = fFrame.nals[fNalIndex++];
+        if (nal.size > fMaxSize) {
+            fFrameSize = fMaxSize;
+            fNumTruncatedBytes = nal.size - fMaxSize;
+        } else {
+            fFrameSize = nal.size;
+            fNumTruncatedBytes = 0;
+        }
+        memcpy(fTo, fFrame.data + nal.offset, fFrameSize);
+        // The producer may have lapped us while copying, the frame can not be completed
+        if (!frame_ring_valid(fReader.ring(), &fFrame)) {
+            fFramesDropped++;
+            dropUntilKeyFrame("Video ring overrun while copying");
+            continue;
+        }
+        fDurationInMicroseconds = 0;
+        return True;
+    }
+}
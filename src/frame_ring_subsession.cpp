@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <frame_ring_subsession.h>
+
+#define MAX_PARAMETER_SET_SIZE 64
+
+FrameRingMediaSubsession* FrameRingMediaSubsession::createNew(UsageEnvironment& env, FrameRingReader& reader, unsigned estBitrate, Boolean reuseFirstSource) {
+    return new FrameRingMediaSubsession(env, reader, estBitrate, reuseFirstSource);
+}
+
+FrameRingMediaSubsession::FrameRingMediaSubsession(UsageEnvironment& env, FrameRingReader& reader, unsigned estBitrate, Boolean reuseFirstSource)
+    : OnDemandServerMediaSubsession(env, reuseFirstSource), fReader(reader), fEstBitrate(estBitrate),
+      fReuseFirstSource(reuseFirstSource), fKeyFrameOnPlay(False), fPacing(0), fFrameInterval(0) {
+}
+
+FramedSource* FrameRingMediaSubsession::createNewStreamSource(unsigned /*clientSessionId*/, unsigned& estBitrate) {
+    estBitrate = fEstBitrate;
+    // No framer, the sink packetizes whole frames from the ring itself
+    return FrameRingSource::createNew(envir(), fReader);
+}
+
+RTPSink* FrameRingMediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource* /*inputSource*/) {
+    u_int8_t sps[MAX_PARAMETER_SET_SIZE], pps[MAX_PARAMETER_SET_SIZE];
+    unsigned spsSize, ppsSize;
+    FrameRingRTPSink* sink;
+    if (fReader.parameterSets(sps, spsSize, pps, ppsSize, MAX_PARAMETER_SET_SIZE)) {
+        sink = FrameRingRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, sps, spsSize, pps, ppsSize);
+    } else {
+        // No keyframe yet, clients will pick the parameter sets up in-band
+        sink = FrameRingRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, nullptr, 0, nullptr, 0);
+    }
+    sink->setPacing(fPacing, fFrameInterval);
+    return sink;
+}
+
+void FrameRingMediaSubsession::startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler, void* rtcpRRHandlerClientData,
+                                           unsigned short& rtpSeqNum, unsigned& rtpTimestamp,
+                                           ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                                           void* serverRequestAlternativeByteHandlerClientData) {
+    auto* state = static_cast<StreamState*>(streamToken);
+    auto* destinations = static_cast<Destinations*>(fDestinationsHashTable->Lookup((char const*) (uintptr_t) clientSessionId));
+    if (!fReuseFirstSource && state != nullptr && destinations != nullptr) {
+        // The sink is ours alone, let it address the client directly
+        auto* sink = static_cast<FrameRingRTPSink*>(state->rtpSink());
+        if (destinations->isTCP) {
+            sink->setTCPSocket(destinations->tcpSocketNum);
+        } else {
+            sink->setDestination(destinations->addr, destinations->rtpPort);
+        }
+    }
+    if (fKeyFrameOnPlay) {
+        // The streamer rate limits these, a burst of reconnects does not turn into a burst of IDRs
+        fReader.requestKeyFrame();
+    }
+    OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler, rtcpRRHandlerClientData,
+                                               rtpSeqNum, rtpTimestamp,
+                                               serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
+}
+
+FrameRingMulticastSubsession* FrameRingMulticastSubsession::createNew(UsageEnvironment& env, FrameRingReader& reader, unsigned estBitrate,
+                                                                      const struct sockaddr_storage& group, uint16_t port, uint8_t ttl, Boolean ssm) {
+    u_int8_t sps[MAX_PARAMETER_SET_SIZE], pps[MAX_PARAMETER_SET_SIZE];
+    unsigned spsSize, ppsSize;
+    if (!reader.parameterSets(sps, spsSize, pps, ppsSize, MAX_PARAMETER_SET_SIZE)) {
+        return nullptr;
+    }
+    FrameRingSource* source = FrameRingSource::createNew(env, reader);
+    if (source == nullptr) {
+        return nullptr;
+    }
+
+    // RTCP goes to the next port, as the RTSP server would announce it
+    auto* rtpGroupsock = new Groupsock(env, group, Port(port), ttl);
+    auto* rtcpGroupsock = new Groupsock(env, group, Port(port + 1), ttl);
+    if (ssm) {
+        rtpGroupsock->multicastSendOnly();
+        rtcpGroupsock->multicastSendOnly();
+    }
+    FrameRingRTPSink* sink = FrameRingRTPSink::createNew(env, rtpGroupsock, 96, sps, spsSize, pps, ppsSize);
+
+    char cname[100];
+    if (gethostname(cname, sizeof(cname) - 1)) {
+        strcpy(cname, "rtsp_server");
+    }
+    cname[sizeof(cname) - 1] = '\0';
+    RTCPInstance* rtcp = RTCPInstance::createNew(env, rtcpGroupsock, estBitrate, (unsigned char const*) cname, sink, nullptr, ssm);
+
+    // Runs for as long as the server does, viewers only join the group
+    sink->startPlaying(*source, nullptr, nullptr);
+    return new FrameRingMulticastSubsession(reader, *sink, rtcp, source, rtpGroupsock, rtcpGroupsock);
+}
+
+FrameRingMulticastSubsession::FrameRingMulticastSubsession(FrameRingReader& reader, FrameRingRTPSink& sink, RTCPInstance* rtcp,
+                                                           FrameRingSource* source, Groupsock* rtpGroupsock, Groupsock* rtcpGroupsock)
+    : PassiveServerMediaSubsession(sink, rtcp), fReader(reader), fSink(sink), fRTCP(rtcp), fSource(source),
+      fRTPGroupsock(rtpGroupsock), fRTCPGroupsock(rtcpGroupsock), fKeyFrameOnPlay(False) {
+}
+
+FrameRingMulticastSubsession::~FrameRingMulticastSubsession() {
+    fSink.stopPlaying();
+    Medium::close(fRTCP);
+    Medium::close(&fSink);
+    Medium::close(fSource);
+    delete fRTCPGroupsock;
+    delete fRTPGroupsock;
+}
+
+void FrameRingMulticastSubsession::startStream(unsigned clientSessionId, void* streamToken, TaskFunc* rtcpRRHandler, void* rtcpRRHandlerClientData,
+                                               unsigned short& rtpSeqNum, unsigned& rtpTimestamp,
+                                               ServerRequestAlternativeByteHandler* serverRequestAlternativeByteHandler,
+                                               void* serverRequestAlternativeByteHandlerClientData) {
+    if (fKeyFrameOnPlay) {
+        // There is no cached GOP to replay on a shared group, a new viewer waits for the next IDR
+        fReader.requestKeyFrame();
+    }
+    PassiveServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler, rtcpRRHandlerClientData,
+                                              rtpSeqNum, rtpTimestamp,
+                                              serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
+}
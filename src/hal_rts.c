@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2021 Colin Jensen
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <rtsisp.h>
+#include <rtscamkit.h>
+#include <rtsavapi.h>
+#include <rtsvideo.h>
+#include <rts_io_adc.h>
+#include <zlog.h>
+#include <hal.h>
+
+static zlog_category_t *hc;
+// Shared by every encoder channel, any of them can wake the capture loop
+static int frame_event = -1;
+static int frame_event_failed = RTS_FALSE;
+
+int hal_init(void) {
+    hc = zlog_get_category("hal");
+    return rts_av_init();
+}
+
+void hal_release(void) {
+    if (frame_event >= 0) {
+        close(frame_event);
+        frame_event = -1;
+    }
+    frame_event_failed = RTS_FALSE;
+    rts_av_release();
+}
+
+int hal_create_isp_chn(struct rts_isp_attr *attr) {
+    int chn = rts_av_create_isp_chn(attr);
+    if (chn >= 0) {
+        // Try load the V4L device
+        int vfd = rts_isp_v4l2_open(attr->isp_id);
+        if (vfd > 0) {
+            zlog_debug(hc, "Opened the V4L2 fd %d", vfd);
+            rts_isp_v4l2_close(vfd);
+        }
+    }
+    return chn;
+}
+
+int hal_create_h264_chn(struct rts_h264_attr *attr) {
+    return rts_av_create_h264_chn(attr);
+}
+
+int hal_set_profile(int chn, struct rts_av_profile *profile) {
+    return rts_av_set_profile(chn, profile);
+}
+
+int hal_bind(int src, int dst) {
+    return rts_av_bind(src, dst);
+}
+
+int hal_unbind(int src, int dst) {
+    return rts_av_unbind(src, dst);
+}
+
+int hal_enable_chn(int chn) {
+    return rts_av_enable_chn(chn);
+}
+
+int hal_disable_chn(int chn) {
+    return rts_av_disable_chn(chn);
+}
+
+int hal_destroy_chn(int chn) {
+    return rts_av_destroy_chn(chn);
+}
+
+static void frame_ready(void *priv, struct rts_av_profile *profile, struct rts_av_buffer *buffer) {
+    // Called from the rtstream thread, wake the capture loop
+    const uint64_t one = 1;
+    if (write(frame_event, &one, sizeof(one)) < 0) {
+        zlog_error(hc, "Failed to signal frame event");
+    }
+}
+
+static int register_frame_event(int chn) {
+    if (frame_event < 0) {
+        frame_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (frame_event < 0) {
+            return -1;
+        }
+    }
+    struct rts_av_callback frame_cb = {
+        .func = frame_ready,
+        .priv = NULL,
+        .start = 0,
+        .times = -1,
+        .interval = 1,
+        .type = RTS_AV_CB_TYPE_ASYNC,
+    };
+    return rts_av_set_callback(chn, &frame_cb, 0);
+}
+
+int hal_start_recv(int chn) {
+    int ret = rts_av_start_recv(chn);
+    // Let the encoder wake us up instead of polling it
+    if (!ret && !frame_event_failed) {
+        int cb = register_frame_event(chn);
+        if (cb) {
+            zlog_warn(hc, "Failed to set frame callback on channel %d, ret %d, falling back to polling", chn, cb);
+            frame_event_failed = RTS_TRUE;
+        }
+    }
+    return ret;
+}
+
+int hal_stop_recv(int chn) {
+    return rts_av_stop_recv(chn);
+}
+
+void hal_wait_frame(int timeout_ms) {
+    // Without a callback on every channel some frames would only be seen on the next wakeup
+    if (frame_event < 0 || frame_event_failed) {
+        usleep(1000);
+        return;
+    }
+
+    struct pollfd pfd = {.fd = frame_event, .events = POLLIN};
+    if (poll(&pfd, 1, timeout_ms) > 0) {
+        uint64_t events;
+        if (read(frame_event, &events, sizeof(events)) < 0) {
+            zlog_error(hc, "Failed to read frame event");
+        }
+    }
+}
+
+int hal_recv(int chn, struct rts_av_buffer **buffer) {
+    if (rts_av_poll(chn)) {
+        return -1;
+    }
+    return rts_av_recv(chn, buffer);
+}
+
+void hal_put_buffer(struct rts_av_buffer *buffer) {
+    rts_av_put_buffer(buffer);
+}
+
+int hal_get_isp_ctrl(uint32_t id, struct rts_video_control *ctrl) {
+    return rts_av_get_isp_ctrl(id, ctrl);
+}
+
+int hal_set_isp_ctrl(uint32_t id, struct rts_video_control *ctrl) {
+    return rts_av_set_isp_ctrl(id, ctrl);
+}
+
+int hal_get_isp_dynamic_fps(void) {
+    return rts_av_get_isp_dynamic_fps();
+}
+
+int hal_set_isp_dynamic_fps(uint8_t fps) {
+    return rts_av_set_isp_dynamic_fps(fps);
+}
+
+int hal_get_isp_ae_statis(int32_t *y_mean, int32_t *gain) {
+    struct rts_isp_ae_ctrl *ae = NULL;
+    int ret = rts_av_query_isp_ae(&ae);
+    if (ret || ae == NULL) {
+        return -1;
+    }
+    // The gain in effect is reported in the manual fields whatever the AE mode
+    ret = rts_av_get_isp_ae(ae);
+    if (!ret) {
+        ret = rts_av_refresh_isp_ae_statis(ae);
+    }
+    if (!ret) {
+        *y_mean = ae->statis.y_mean;
+        *gain = ae->_manual.total_gain;
+    }
+    rts_av_release_isp_ae(ae);
+    return ret;
+}
+
+int hal_get_isp_daynight_statis(void) {
+    return rts_av_get_isp_daynight_statis();
+}
+
+int hal_query_h264_ctrl(int chn, struct rts_video_h264_ctrl **ctrl) {
+    return rts_av_query_h264_ctrl(chn, ctrl);
+}
+
+int hal_get_h264_ctrl(struct rts_video_h264_ctrl *ctrl) {
+    return rts_av_get_h264_ctrl(ctrl);
+}
+
+int hal_set_h264_ctrl(struct rts_video_h264_ctrl *ctrl) {
+    return rts_av_set_h264_ctrl(ctrl);
+}
+
+void hal_release_h264_ctrl(struct rts_video_h264_ctrl *ctrl) {
+    rts_av_release_h264_ctrl(ctrl);
+}
+
+int hal_request_key_frame(int chn) {
+    return rts_av_request_h264_key_frame(chn);
+}
+
+int hal_query_h264_roi(int chn, struct rts_video_roi_attr **attr) {
+    return rts_av_query_h264_roi(chn, attr);
+}
+
+int hal_set_h264_roi(struct rts_video_roi_attr *attr) {
+    return rts_av_set_h264_roi(attr);
+}
+
+void hal_release_h264_roi(struct rts_video_roi_attr *attr) {
+    rts_av_release_h264_roi(attr);
+}
+
+int hal_set_waiting_limit(int chn, long limit) {
+    return rts_av_set_waiting_limit(chn, limit);
+}
+
+int hal_adc_get_value(int channel) {
+    return rts_io_adc_get_value(channel);
+}
+
+void hal_set_ir_cut(int night) {
+    int driver = open("/dev/cpld_periph", O_RDWR);
+    if (driver < 0) {
+        zlog_error(hc, "Failed to open /dev/cpld_periph");
+        return;
+    }
+    if (night == 0) {
+        ioctl(driver, _IOC(_IOC_NONE, 0x70, 0x15, 0), 0);
+    } else {
+        ioctl(driver, _IOC(_IOC_NONE, 0x70, 0x16, 0), 0);
+    }
+    close(driver);
+}
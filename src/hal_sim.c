@@ -0,0 +1,560 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Simulated camera: plays back a recorded H.264 elementary stream at the
+// configured frame rate and produces a slow synthetic day/night cycle on the
+// light sensor ADC.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <math.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <rtsdef.h>
+#include <zlog.h>
+#include <ini.h>
+#include <globals.h>
+#include <hal.h>
+
+#define SIM_MAX_CHANNELS 8
+// Encoder output buffers per channel, frames stay due while all are held
+#define SIM_BUFFERS 4
+#define SIM_MAX_BUFFERS 32
+#define SIM_ROIS 4
+#define SIM_ADC_DAY 50
+#define SIM_ADC_NIGHT 3297
+#define SIM_ADC_NOISE 100
+// How much brighter the light sensor reads once the IR LEDs light up nearby walls
+#define SIM_ADC_REFLECTION 400
+// The AE keeps the image at SIM_LUMA_TARGET until the gain reaches SIM_GAIN_MAX
+#define SIM_LUMA_TARGET 120
+#define SIM_GAIN_MIN 16
+#define SIM_GAIN_MAX 256
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+    uint8_t key;
+} sim_access_unit;
+
+typedef struct {
+    char video[256];
+    uint32_t adc_period; // Seconds for a full day/night cycle
+    double adc_phase;    // Fraction of the cycle gone at startup, 0.5 starts at midnight
+    uint32_t buffers;    // Encoder output buffers per channel
+} sim_settings;
+
+typedef struct {
+    uint8_t in_use;     // Destroyed channels are handed out again, pipelines get rebuilt on reload
+    uint32_t fps;       // Frame rate of the ISP profile feeding the channel
+    int timer;          // Paces an encoder channel once it is receiving
+    uint64_t frames_due;
+    uint32_t next_unit; // Every encoder plays the recording from its own position
+    struct rts_av_buffer buffers[SIM_MAX_BUFFERS];
+    uint8_t held[SIM_MAX_BUFFERS];
+} sim_channel;
+
+typedef struct {
+    uint32_t id;
+    const char *name;
+    int32_t minimum;
+    int32_t maximum;
+    int32_t step;
+    int32_t default_value;
+    int32_t current_value;
+} sim_control;
+
+static zlog_category_t *hc;
+static sim_settings settings = {.video = "sim.h264", .adc_period = 600, .buffers = SIM_BUFFERS};
+
+static uint8_t *stream;
+static sim_access_unit *units;
+static uint32_t unit_count;
+
+static int ir_night;
+
+static sim_channel channels[SIM_MAX_CHANNELS];
+static uint32_t channel_count;
+static uint8_t dynamic_fps;
+static struct timespec start_time;
+
+// The controls the streamer touches, ranges as reported by an RTS3903N
+static sim_control controls[] = {
+    {RTS_VIDEO_CTRL_ID_EXPOSURE_PRIORITY, "Exposure Priority", 0, 1, 1, 1, 1},
+    {RTS_VIDEO_CTRL_ID_FLIP, "Flip", 0, 1, 1, 0, 0},
+    {RTS_VIDEO_CTRL_ID_MIRROR, "Mirror", 0, 1, 1, 0, 0},
+    {RTS_VIDEO_CTRL_ID_GRAY_MODE, "Gray Mode", 0, 1, 1, 0, 0},
+    {RTS_VIDEO_CTRL_ID_3DNR, "3DNR", 0, 1, 1, 1, 1},
+    {RTS_VIDEO_CTRL_ID_DEHAZE, "Dehaze", 0, 1, 1, 0, 0},
+    {RTS_VIDEO_CTRL_ID_IR_MODE, "IR Mode", 0, 2, 1, 0, 0},
+    {RTS_VIDEO_CTRL_ID_IN_OUT_DOOR_MODE, "In/Out Door Mode", 0, 2, 1, 0, 0},
+    {RTS_VIDEO_CTRL_ID_NOISE_REDUCTION, "Noise Reduction", 0, 7, 1, 4, 4},
+    {RTS_VIDEO_CTRL_ID_DETAIL_ENHANCEMENT, "Detail Enhancement", 0, 7, 1, 4, 4},
+    {RTS_VIDEO_CTRL_ID_LDC, "LDC", 0, 1, 1, 0, 0},
+};
+
+static int parse_ini(void *user, const char *section, const char *name, const char *value) {
+    sim_settings *config = (sim_settings *) user;
+
+    if (MATCH("simulator", "video")) {
+        snprintf(config->video, sizeof(config->video), "%s", value);
+    } else if (MATCH("simulator", "adc_period")) {
+        sscanf(value, "%u", &config->adc_period);
+    } else if (MATCH("simulator", "adc_phase")) {
+        sscanf(value, "%lf", &config->adc_phase);
+    } else if (MATCH("simulator", "buffers")) {
+        sscanf(value, "%u", &config->buffers);
+    }
+
+    return 1;
+}
+
+static uint8_t load_stream(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        zlog_fatal(hc, "Failed to open simulator video %s", path);
+        return RTS_FALSE;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    stream = malloc(size);
+    if (!stream || fread(stream, 1, size, f) != (size_t) size) {
+        zlog_fatal(hc, "Failed to read simulator video %s", path);
+        fclose(f);
+        return RTS_FALSE;
+    }
+    fclose(f);
+
+    // Split into access units: each picture plus the SPS/PPS/SEI ahead of it
+    uint32_t capacity = 256;
+    uint32_t pending = UINT32_MAX;
+    uint8_t pending_key = 0;
+    units = malloc(capacity * sizeof(*units));
+    for (uint32_t i = 0; units && i + 3 < (uint32_t) size; i++) {
+        if (stream[i] != 0 || stream[i + 1] != 0 || stream[i + 2] != 1) {
+            continue;
+        }
+        uint32_t nal_start = (i > 0 && stream[i - 1] == 0) ? i - 1 : i;
+        uint8_t type = stream[i + 3] & 0x1f;
+        if (type >= 1 && type <= 5) {
+            if (unit_count == capacity) {
+                capacity *= 2;
+                units = realloc(units, capacity * sizeof(*units));
+                if (!units) {
+                    break;
+                }
+            }
+            units[unit_count].offset = pending != UINT32_MAX ? pending : nal_start;
+            units[unit_count].key = pending_key || type == 5;
+            unit_count++;
+            pending = UINT32_MAX;
+            pending_key = 0;
+        } else {
+            if (pending == UINT32_MAX) {
+                pending = nal_start;
+            }
+            pending_key |= type == 7;
+        }
+        i += 3;
+    }
+    if (!units || unit_count == 0) {
+        zlog_fatal(hc, "No pictures found in simulator video %s", path);
+        return RTS_FALSE;
+    }
+    for (uint32_t i = 0; i + 1 < unit_count; i++) {
+        uint32_t end = units[i + 1].offset;
+        units[i].size = end - units[i].offset;
+    }
+    units[unit_count - 1].size = (uint32_t) size - units[unit_count - 1].offset;
+    zlog_info(hc, "Loaded %u pictures from simulator video %s", unit_count, path);
+    return RTS_TRUE;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void arm_frame_timer(sim_channel *chn) {
+    // The sensor rate caps every stream, like the ISP does
+    uint32_t fps = dynamic_fps && dynamic_fps < chn->fps ? dynamic_fps : chn->fps;
+    if (chn->timer < 0 || fps == 0) {
+        return;
+    }
+    struct itimerspec spec = {0};
+    spec.it_interval.tv_nsec = 1000000000 / fps;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(chn->timer, 0, &spec, NULL);
+}
+
+static int create_channel(void) {
+    uint32_t id = 0;
+    while (id < channel_count && channels[id].in_use) {
+        id++;
+    }
+    if (id >= SIM_MAX_CHANNELS) {
+        return -1;
+    }
+    sim_channel *chn = &channels[id];
+    memset(chn, 0, sizeof(*chn));
+    chn->in_use = 1;
+    chn->fps = 20;
+    chn->timer = -1;
+    if (id == channel_count) {
+        channel_count++;
+    }
+    return (int) id;
+}
+
+static sim_channel *find_channel(int chn) {
+    return chn >= 0 && (uint32_t) chn < channel_count && channels[chn].in_use ? &channels[chn] : NULL;
+}
+
+static sim_control *find_control(uint32_t id) {
+    for (size_t i = 0; i < sizeof(controls) / sizeof(controls[0]); i++) {
+        if (controls[i].id == id) {
+            return &controls[i];
+        }
+    }
+    return NULL;
+}
+
+int hal_init(void) {
+    hc = zlog_get_category("hal");
+    if (ini_parse("streamer.ini", parse_ini, &settings) < 0) {
+        zlog_warn(hc, "Failed to load simulator settings, using defaults");
+    }
+    if (settings.buffers < 1 || settings.buffers > SIM_MAX_BUFFERS) {
+        settings.buffers = settings.buffers < 1 ? 1 : SIM_MAX_BUFFERS;
+    }
+    if (!load_stream(settings.video)) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    srand((unsigned) start_time.tv_nsec);
+    zlog_info(hc, "Simulated camera ready");
+    return 0;
+}
+
+void hal_release(void) {
+    for (uint32_t i = 0; i < channel_count; i++) {
+        hal_stop_recv((int) i);
+    }
+    channel_count = 0;
+    free(units);
+    free(stream);
+    units = NULL;
+    stream = NULL;
+}
+
+int hal_create_isp_chn(struct rts_isp_attr *attr) {
+    // Like the SDK, a new ISP channel starts from the default settings
+    for (size_t i = 0; i < sizeof(controls) / sizeof(controls[0]); i++) {
+        controls[i].current_value = controls[i].default_value;
+    }
+    return create_channel();
+}
+
+int hal_create_h264_chn(struct rts_h264_attr *attr) {
+    return create_channel();
+}
+
+int hal_set_profile(int chn, struct rts_av_profile *profile) {
+    sim_channel *sim = find_channel(chn);
+    if (!sim) {
+        return -1;
+    }
+    if (profile->video.numerator) {
+        sim->fps = profile->video.denominator / profile->video.numerator;
+    }
+    zlog_debug(hc, "Channel %d profile %ux%u at %u fps", chn, profile->video.width, profile->video.height, sim->fps);
+    return 0;
+}
+
+int hal_bind(int src, int dst) {
+    sim_channel *isp = find_channel(src);
+    sim_channel *enc = find_channel(dst);
+    if (!isp || !enc) {
+        return -1;
+    }
+    // Every stream plays back the same recording, only its pace follows the profile
+    enc->fps = isp->fps;
+    return 0;
+}
+
+int hal_unbind(int src, int dst) {
+    return 0;
+}
+
+int hal_enable_chn(int chn) {
+    return 0;
+}
+
+int hal_disable_chn(int chn) {
+    return 0;
+}
+
+int hal_destroy_chn(int chn) {
+    sim_channel *sim = find_channel(chn);
+    if (!sim) {
+        return -1;
+    }
+    hal_stop_recv(chn);
+    sim->in_use = 0;
+    return 0;
+}
+
+int hal_start_recv(int chn) {
+    sim_channel *sim = find_channel(chn);
+    if (!sim) {
+        return -1;
+    }
+    if (sim->timer < 0) {
+        sim->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (sim->timer < 0) {
+            return -1;
+        }
+    }
+    arm_frame_timer(sim);
+    return 0;
+}
+
+int hal_stop_recv(int chn) {
+    sim_channel *sim = find_channel(chn);
+    if (sim && sim->timer >= 0) {
+        close(sim->timer);
+        sim->timer = -1;
+    }
+    return 0;
+}
+
+void hal_wait_frame(int timeout_ms) {
+    struct pollfd pfds[SIM_MAX_CHANNELS];
+    sim_channel *polled[SIM_MAX_CHANNELS];
+    nfds_t count = 0;
+    for (uint32_t i = 0; i < channel_count; i++) {
+        if (channels[i].timer >= 0) {
+            pfds[count].fd = channels[i].timer;
+            pfds[count].events = POLLIN;
+            polled[count++] = &channels[i];
+        }
+    }
+    if (count == 0) {
+        usleep(timeout_ms * 1000);
+        return;
+    }
+    if (poll(pfds, count, timeout_ms) <= 0) {
+        return;
+    }
+    for (nfds_t i = 0; i < count; i++) {
+        uint64_t expirations;
+        if ((pfds[i].revents & POLLIN) && read(pfds[i].fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            polled[i]->frames_due += expirations;
+        }
+    }
+}
+
+int hal_recv(int chn, struct rts_av_buffer **buffer) {
+    sim_channel *sim = find_channel(chn);
+    if (!sim || sim->frames_due == 0) {
+        return -1;
+    }
+    // Like the hardware, the encoder stalls once every output buffer is held
+    int free_buffer = -1;
+    for (int i = 0; i < (int) settings.buffers; i++) {
+        if (!sim->held[i]) {
+            free_buffer = i;
+            break;
+        }
+    }
+    if (free_buffer < 0) {
+        return -1;
+    }
+    sim->frames_due--;
+
+    const sim_access_unit *unit = &units[sim->next_unit];
+    sim->next_unit = (sim->next_unit + 1) % unit_count;
+    struct rts_av_buffer *out = &sim->buffers[free_buffer];
+    out->vm_addr = stream + unit->offset;
+    out->length = unit->size;
+    out->bytesused = unit->size;
+    out->flags = unit->key ? RTSTREAM_PKT_FLAG_KEY : 0;
+    out->timestamp = now_us();
+    sim->held[free_buffer] = 1;
+    *buffer = out;
+    return 0;
+}
+
+void hal_put_buffer(struct rts_av_buffer *buffer) {
+    for (uint32_t i = 0; i < channel_count; i++) {
+        sim_channel *sim = &channels[i];
+        if (buffer >= sim->buffers && buffer < sim->buffers + SIM_MAX_BUFFERS) {
+            sim->held[buffer - sim->buffers] = 0;
+            return;
+        }
+    }
+}
+
+int hal_get_isp_ctrl(uint32_t id, struct rts_video_control *ctrl) {
+    sim_control *sim = find_control(id);
+    if (!sim) {
+        return -1;
+    }
+    memset(ctrl, 0, sizeof(*ctrl));
+    ctrl->type = id;
+    snprintf(ctrl->name, sizeof(ctrl->name), "%s", sim->name);
+    ctrl->minimum = sim->minimum;
+    ctrl->maximum = sim->maximum;
+    ctrl->step = sim->step;
+    ctrl->default_value = sim->default_value;
+    ctrl->current_value = sim->current_value;
+    return 0;
+}
+
+int hal_set_isp_ctrl(uint32_t id, struct rts_video_control *ctrl) {
+    sim_control *sim = find_control(id);
+    if (!sim || ctrl->current_value < sim->minimum || ctrl->current_value > sim->maximum) {
+        return -1;
+    }
+    sim->current_value = ctrl->current_value;
+    return 0;
+}
+
+int hal_get_isp_dynamic_fps(void) {
+    return dynamic_fps ? dynamic_fps : (int) (channel_count ? channels[0].fps : 0);
+}
+
+int hal_set_isp_dynamic_fps(uint8_t fps) {
+    dynamic_fps = fps;
+    for (uint32_t i = 0; i < channel_count; i++) {
+        arm_frame_timer(&channels[i]);
+    }
+    return 0;
+}
+
+int hal_query_h264_ctrl(int chn, struct rts_video_h264_ctrl **ctrl) {
+    static struct rts_video_h264_ctrl h264_ctrl;
+    *ctrl = &h264_ctrl;
+    return 0;
+}
+
+int hal_get_h264_ctrl(struct rts_video_h264_ctrl *ctrl) {
+    return 0;
+}
+
+int hal_set_h264_ctrl(struct rts_video_h264_ctrl *ctrl) {
+    zlog_debug(hc, "Encoder bitrate %u-%u", ctrl->min_bitrate, ctrl->max_bitrate);
+    return 0;
+}
+
+void hal_release_h264_ctrl(struct rts_video_h264_ctrl *ctrl) {
+}
+
+int hal_request_key_frame(int chn) {
+    sim_channel *sim = find_channel(chn);
+    if (!sim) {
+        return -1;
+    }
+    // A recording can not be re-encoded, skip ahead to its next keyframe instead
+    for (uint32_t i = 0; i < unit_count; i++) {
+        uint32_t unit = (sim->next_unit + i) % unit_count;
+        if (units[unit].key) {
+            sim->next_unit = unit;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int hal_query_h264_roi(int chn, struct rts_video_roi_attr **attr) {
+    // Shared by every channel, the simulator only logs what it is given
+    static struct rts_video_roi_ctrl rois[SIM_ROIS] = {
+        {.index = 0, .min = -51, .max = 51, .step = 1},
+        {.index = 1, .min = -51, .max = 51, .step = 1},
+        {.index = 2, .min = -51, .max = 51, .step = 1},
+        {.index = 3, .min = -51, .max = 51, .step = 1},
+    };
+    static struct rts_video_roi_attr roi_attr = {.type = RTS_VIDEO_ROI_H264, .roi = rois, .count = SIM_ROIS};
+    if (!find_channel(chn)) {
+        return -1;
+    }
+    *attr = &roi_attr;
+    return 0;
+}
+
+int hal_set_h264_roi(struct rts_video_roi_attr *attr) {
+    for (int i = 0; i < attr->count; i++) {
+        const struct rts_video_roi_ctrl *roi = &attr->roi[i];
+        if (roi->enable) {
+            zlog_debug(hc, "ROI %d: %d,%d-%d,%d QP delta %d", i, roi->area.left, roi->area.top, roi->area.right,
+                       roi->area.bottom, roi->value);
+        }
+    }
+    return 0;
+}
+
+void hal_release_h264_roi(struct rts_video_roi_attr *attr) {
+}
+
+int hal_set_waiting_limit(int chn, long limit) {
+    // The simulated encoder holds as many frames as [simulator] buffers says
+    return find_channel(chn) ? 0 : -1;
+}
+
+// 0 in full daylight, 1 in total darkness
+static double darkness(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double t = (double) (ts.tv_sec - start_time.tv_sec) / (settings.adc_period ? settings.adc_period : 1) + settings.adc_phase;
+    return (1.0 - cos(2.0 * M_PI * t)) / 2.0;
+}
+
+int hal_get_isp_ae_statis(int32_t *y_mean, int32_t *gain) {
+    if (ir_night) {
+        // Lit by the IR LEDs whatever the time of day
+        *y_mean = SIM_LUMA_TARGET;
+        *gain = SIM_GAIN_MIN * 4;
+        return 0;
+    }
+    // The light falls off 100 times from day to night, the AE makes up for it until the gain runs out
+    double needed = SIM_GAIN_MIN * pow(100.0, darkness());
+    *gain = needed < SIM_GAIN_MAX ? (int32_t) needed : SIM_GAIN_MAX;
+    *y_mean = (int32_t) (SIM_LUMA_TARGET * *gain / needed);
+    return 0;
+}
+
+int hal_get_isp_daynight_statis(void) {
+    return -1;
+}
+
+int hal_adc_get_value(int channel) {
+    int noise = rand() % (2 * SIM_ADC_NOISE + 1) - SIM_ADC_NOISE;
+    int value = SIM_ADC_DAY + (int) (darkness() * (SIM_ADC_NIGHT - SIM_ADC_DAY)) + noise;
+    if (ir_night) {
+        value -= SIM_ADC_REFLECTION;
+    }
+    return value < 0 ? 0 : value;
+}
+
+void hal_set_ir_cut(int night) {
+    ir_night = night;
+    zlog_info(hc, "IR cut switched to %s", night ? "night" : "day");
+}
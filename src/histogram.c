@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <histogram.h>
+
+void histogram_reset(histogram *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+static uint32_t bucket_of(uint64_t value) {
+    uint32_t bucket = 0;
+    while (value > 1 && bucket < HISTOGRAM_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void histogram_add(histogram *h, uint64_t value_us) {
+    h->buckets[bucket_of(value_us)]++;
+    if (h->count == 0 || value_us < h->min) {
+        h->min = value_us;
+    }
+    if (value_us > h->max) {
+        h->max = value_us;
+    }
+    h->count++;
+    h->sum += value_us;
+}
+
+uint64_t histogram_percentile(const histogram *h, uint32_t percentile) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t target = ((uint64_t) h->count * percentile + 99) / 100;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target && seen > 0) {
+            return i == HISTOGRAM_BUCKETS - 1 ? h->max : (uint64_t) 2 << i;
+        }
+    }
+    return h->max;
+}
+
+void histogram_log(const histogram *h, zlog_category_t *category, const char *title) {
+    if (h->count == 0) {
+        zlog_info(category, "%s: no samples", title);
+        return;
+    }
+    zlog_info(category, "%s: %u samples, min %llu us, mean %llu us, p50 < %llu us, p99 < %llu us, max %llu us",
+              title, h->count, (unsigned long long) h->min, (unsigned long long) (h->sum / h->count),
+              (unsigned long long) histogram_percentile(h, 50), (unsigned long long) histogram_percentile(h, 99),
+              (unsigned long long) h->max);
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (h->buckets[i] == 0) {
+            continue;
+        }
+        uint64_t low = i == 0 ? 0 : (uint64_t) 1 << i;
+        if (i == HISTOGRAM_BUCKETS - 1) {
+            zlog_info(category, "  %8llu +          us: %u", (unsigned long long) low, h->buckets[i]);
+        } else {
+            zlog_info(category, "  %8llu - %8llu us: %u", (unsigned long long) low, (unsigned long long) ((uint64_t) 2 << i),
+                      h->buckets[i]);
+        }
+    }
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <ir_ctrl.h>
+
+static int8_t decide_adc(const ir_ctrl *ir) {
+    int32_t brightness = ir_ctrl_brightness(ir);
+    int32_t hysteresis = ir->config.hysteresis;
+    if (ir->mode == 1) {
+        if (ir->reflection_pending) {
+            return -1;
+        }
+        // The IR LEDs light up nearby walls, which the sensor takes for daylight
+        int32_t reflection = ir->reflection;
+        // The reading stops at 0, take off no more than still lets dawn through
+        int32_t reachable = ir->config.cutoff - 2 * hysteresis;
+        if (!ir->config.inverted && reflection > reachable) {
+            reflection = reachable > 0 ? reachable : 0;
+        }
+        brightness -= reflection;
+    }
+    if (brightness > hysteresis) {
+        return 0;
+    }
+    if (brightness < -hysteresis) {
+        return 1;
+    }
+    if (ir->mode < 0) {
+        // Inside the band on startup, fall back to the plain cutoff
+        return brightness > 0 ? 0 : 1;
+    }
+    return -1;
+}
+
+static int8_t decide_fused(const ir_ctrl *ir) {
+    const ir_ctrl_config *cfg = &ir->config;
+    if (ir->mode == 1) {
+        // The illuminator lights up the image, only the light sensor can tell
+        // dawn from a wall reflecting the IR back
+        return decide_adc(ir);
+    }
+    int8_t wanted = decide_adc(ir);
+    if (wanted != 1 || ir->luma < 0) {
+        return wanted;
+    }
+    // The AE holds the luminance up until the gain runs out, so a dark
+    // image means it really is dark and not just a shadow on the sensor
+    uint8_t dark = ir->luma / 256 < cfg->luma_night || (cfg->gain_night > 0 && ir->gain >= 0 && ir->gain / 256 >= cfg->gain_night);
+    if (dark) {
+        return 1;
+    }
+    return ir->mode < 0 ? 0 : -1;
+}
+
+const ir_strategy ir_strategy_adc = {"adc", decide_adc};
+const ir_strategy ir_strategy_fused = {"fused", decide_fused};
+
+static const ir_strategy *const strategies[] = {&ir_strategy_adc, &ir_strategy_fused};
+
+const ir_strategy *ir_strategy_find(const char *name) {
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        if (strcmp(strategies[i]->name, name) == 0) {
+            return strategies[i];
+        }
+    }
+    return NULL;
+}
+
+void ir_ctrl_init(ir_ctrl *ir, const ir_ctrl_config *config) {
+    memset(ir, 0, sizeof(*ir));
+    ir_ctrl_configure(ir, config);
+    ir->luma = -1;
+    ir->gain = -1;
+    ir->mode = -1;
+}
+
+void ir_ctrl_configure(ir_ctrl *ir, const ir_ctrl_config *config) {
+    ir->config = *config;
+    if (!ir->config.strategy) {
+        ir->config.strategy = &ir_strategy_adc;
+    }
+    if (ir->config.hysteresis < 0) {
+        ir->config.hysteresis = 0;
+    }
+}
+
+static int32_t median(const int32_t *values, uint32_t count) {
+    int32_t sorted[IR_MEDIAN_WINDOW];
+    memcpy(sorted, values, count * sizeof(*values));
+    for (uint32_t i = 1; i < count; i++) {
+        int32_t v = sorted[i];
+        uint32_t j = i;
+        for (; j > 0 && sorted[j - 1] > v; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = v;
+    }
+    return sorted[count / 2];
+}
+
+// Moves an average kept times 256 towards value, -1 values are skipped
+static void average(int32_t *avg, int32_t value) {
+    if (value < 0) {
+        return;
+    }
+    if (*avg < 0) {
+        *avg = value * 256;
+    } else {
+        *avg += (value * 256 - *avg) * IR_EMA_WEIGHT / 256;
+    }
+}
+
+int32_t ir_ctrl_level(const ir_ctrl *ir) {
+    return ir->average / 256;
+}
+
+int32_t ir_ctrl_brightness(const ir_ctrl *ir) {
+    int32_t level = ir_ctrl_level(ir);
+    return ir->config.inverted ? level - ir->config.cutoff : ir->config.cutoff - level;
+}
+
+int8_t ir_ctrl_sample(ir_ctrl *ir, const ir_sample *sample, uint64_t now_ms) {
+    average(&ir->luma, sample->luma);
+    average(&ir->gain, sample->gain);
+    if (sample->adc < 0) {
+        return -1;
+    }
+    ir->window[ir->samples % IR_MEDIAN_WINDOW] = sample->adc;
+    ir->samples++;
+    if (ir->samples < IR_MEDIAN_WINDOW) {
+        // Not enough readings to tell a spike from the scene yet
+        return -1;
+    }
+    int32_t filtered = median(ir->window, IR_MEDIAN_WINDOW);
+    if (ir->samples == IR_MEDIAN_WINDOW) {
+        ir->average = filtered * 256;
+    } else {
+        ir->average += (filtered * 256 - ir->average) * IR_EMA_WEIGHT / 256;
+    }
+
+    if (ir->reflection_pending && now_ms - ir->last_switch_ms >= IR_SETTLE_MS) {
+        int32_t added = ir_ctrl_brightness(ir) - ir->brightness_before;
+        ir->reflection = added > 0 ? added : 0;
+        ir->reflection_pending = 0;
+    }
+
+    int8_t wanted = ir->config.strategy->decide(ir);
+    if (wanted < 0 || wanted == ir->mode) {
+        return -1;
+    }
+    if (ir->mode >= 0 && now_ms - ir->last_switch_ms < ir->config.dwell_ms) {
+        return -1;
+    }
+    if (wanted == 1) {
+        ir->brightness_before = ir_ctrl_brightness(ir);
+        ir->reflection_pending = 1;
+    }
+    ir->reflection = 0;
+    ir->mode = wanted;
+    ir->last_switch_ms = now_ms;
+    return wanted;
+}
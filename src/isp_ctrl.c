@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <rtsdef.h>
+#include <zlog.h>
+#include <hal.h>
+#include <isp_ctrl.h>
+
+typedef struct {
+    struct rts_video_control ctrl;
+    uint8_t valid;
+} isp_ctrl_entry;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static isp_ctrl_entry cache[RTS_VIDEO_CTRL_ID_RESERVED];
+static int8_t ir_cut = -1; // Unknown until first set
+
+static zlog_category_t *category(void) {
+    static zlog_category_t *ic;
+    if (!ic) {
+        ic = zlog_get_category("isp");
+    }
+    return ic;
+}
+
+// Called with the lock held
+static isp_ctrl_entry *load(uint32_t id) {
+    if (id == 0 || id >= RTS_VIDEO_CTRL_ID_RESERVED) {
+        return NULL;
+    }
+    isp_ctrl_entry *entry = &cache[id];
+    if (!entry->valid) {
+        if (hal_get_isp_ctrl(id, &entry->ctrl)) {
+            return NULL;
+        }
+        entry->valid = RTS_TRUE;
+    }
+    return entry;
+}
+
+uint8_t isp_ctrl_in_range(const struct rts_video_control *ctrl, int32_t value) {
+    return value >= ctrl->minimum && value <= ctrl->maximum && (ctrl->step <= 0 || (value - ctrl->minimum) % ctrl->step == 0);
+}
+
+// Called with the lock held
+static uint8_t apply(const isp_ctrl_step *step) {
+    if (step->id == ISP_CTRL_IR_CUT) {
+        int8_t night = step->value ? 1 : 0;
+        if (night != ir_cut) {
+            hal_set_ir_cut(night);
+            ir_cut = night;
+        }
+        return RTS_TRUE;
+    }
+
+    isp_ctrl_entry *entry = load(step->id);
+    if (!entry) {
+        zlog_error(category(), "Failed to get ISP control %u", step->id);
+        return RTS_FALSE;
+    }
+    int32_t value = step->value;
+    if (!isp_ctrl_in_range(&entry->ctrl, value)) {
+        zlog_error(category(), "Invalid value %d for %s (min: %d, max: %d, step: %d), using the default %d", value,
+                   entry->ctrl.name, entry->ctrl.minimum, entry->ctrl.maximum, entry->ctrl.step, entry->ctrl.default_value);
+        value = entry->ctrl.default_value;
+    }
+    if (value == entry->ctrl.current_value) {
+        return RTS_TRUE;
+    }
+    struct rts_video_control ctrl = entry->ctrl;
+    ctrl.current_value = value;
+    int ret = hal_set_isp_ctrl(step->id, &ctrl);
+    if (ret) {
+        // The ISP may have taken part of it, read it back next time
+        entry->valid = RTS_FALSE;
+        zlog_error(category(), "Failed to set %s to %d, ret %d", ctrl.name, value, ret);
+        return RTS_FALSE;
+    }
+    entry->ctrl.current_value = value;
+    zlog_info(category(), "Changed %s to %d", ctrl.name, value);
+    return RTS_TRUE;
+}
+
+void isp_ctrl_begin(isp_ctrl_txn *txn) {
+    txn->count = 0;
+}
+
+uint8_t isp_ctrl_add(isp_ctrl_txn *txn, uint32_t id, int32_t value) {
+    if (txn->count >= ISP_CTRL_MAX_STEPS) {
+        return RTS_FALSE;
+    }
+    txn->steps[txn->count].id = id;
+    txn->steps[txn->count].value = value;
+    txn->count++;
+    return RTS_TRUE;
+}
+
+int isp_ctrl_commit(const isp_ctrl_txn *txn) {
+    int failed = 0;
+    pthread_mutex_lock(&lock);
+    // Fill the cache first so the writes go out back to back
+    for (uint32_t i = 0; i < txn->count; i++) {
+        load(txn->steps[i].id);
+    }
+    for (uint32_t i = 0; i < txn->count; i++) {
+        if (!apply(&txn->steps[i])) {
+            failed++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return failed;
+}
+
+uint8_t isp_ctrl_set(uint32_t id, int32_t value) {
+    isp_ctrl_txn txn;
+    isp_ctrl_begin(&txn);
+    isp_ctrl_add(&txn, id, value);
+    return isp_ctrl_commit(&txn) == 0;
+}
+
+int isp_ctrl_get(uint32_t id, struct rts_video_control *ctrl) {
+    pthread_mutex_lock(&lock);
+    const isp_ctrl_entry *entry = load(id);
+    if (entry) {
+        *ctrl = entry->ctrl;
+    }
+    pthread_mutex_unlock(&lock);
+    return entry ? 0 : -1;
+}
+
+void isp_ctrl_invalidate(void) {
+    pthread_mutex_lock(&lock);
+    memset(cache, 0, sizeof(cache));
+    ir_cut = -1;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <metrics.h>
+
+void metrics_reset(metrics_buffer *b) {
+    b->len = 0;
+    b->data[0] = 0;
+}
+
+void metrics_printf(metrics_buffer *b, const char *fmt, ...) {
+    size_t room = sizeof(b->data) - b->len;
+    if (room <= 1) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(b->data + b->len, room, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        b->len += (size_t) n < room ? (size_t) n : room - 1;
+    }
+}
+
+void metrics_process(metrics_buffer *b) {
+    FILE *f = fopen("/proc/self/stat", "r");
+    if (!f) {
+        return;
+    }
+    unsigned long utime = 0, stime = 0;
+    long rss = 0;
+    // The command name may hold spaces, the fields after it are fixed
+    int fields = fscanf(f, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+                        &utime, &stime, &rss);
+    fclose(f);
+    if (fields != 3) {
+        return;
+    }
+    long ticks = sysconf(_SC_CLK_TCK);
+    long page = sysconf(_SC_PAGESIZE);
+    metrics_printf(b, "# TYPE process_cpu_seconds_total counter\n");
+    metrics_printf(b, "process_cpu_seconds_total %.2f\n", (double) (utime + stime) / (ticks > 0 ? ticks : 100));
+    metrics_printf(b, "# TYPE process_resident_memory_bytes gauge\n");
+    metrics_printf(b, "process_resident_memory_bytes %ld\n", rss * page);
+}
+
+int metrics_listen(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+uint8_t metrics_read_request(int client, int timeout_ms) {
+    // The request itself does not matter, only that it ended before the
+    // response goes out, closing with unread data would reset the connection
+    char request[1024];
+    size_t len = 0;
+    while (len < sizeof(request) - 1) {
+        struct pollfd pfd = {.fd = client, .events = POLLIN};
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return 0;
+        }
+        ssize_t n = recv(client, request + len, sizeof(request) - 1 - len, MSG_DONTWAIT);
+        if (n <= 0) {
+            return 0;
+        }
+        len += n;
+        request[len] = 0;
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+            return 1;
+        }
+    }
+    // Headers we do not care about, answer anyway
+    return 1;
+}
+
+void metrics_respond(int client, const metrics_buffer *b) {
+    // A stalled scraper must not hold up the caller for long
+    struct timeval timeout = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    char header[160];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                     b->len);
+    if (send(client, header, n, MSG_NOSIGNAL) == n) {
+        send(client, b->data, b->len, MSG_NOSIGNAL);
+    }
+    close(client);
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <metrics_server.h>
+#ifdef MERGED_STREAMER
+#include <stream.h>
+#endif
+
+// A connection waiting for its request
+struct MetricsClient {
+    MetricsServer* server;
+    int socket;
+};
+
+MetricsServer* MetricsServer::createNew(UsageEnvironment& env, uint16_t port) {
+    int fd = metrics_listen(port);
+    if (fd < 0) {
+        return nullptr;
+    }
+    return new MetricsServer(env, fd);
+}
+
+MetricsServer::MetricsServer(UsageEnvironment& env, int socket) : fEnv(env), fSocket(socket) {
+    metrics_reset(&fBuffer);
+    env.taskScheduler().setBackgroundHandling(fSocket, SOCKET_READABLE, incomingConnection, this);
+}
+
+MetricsServer::~MetricsServer() {
+    fEnv.taskScheduler().disableBackgroundHandling(fSocket);
+    close(fSocket);
+}
+
+void MetricsServer::incomingConnection(void* clientData, int) {
+    static_cast<MetricsServer*>(clientData)->incomingConnection();
+}
+
+void MetricsServer::incomingConnection() {
+    int client = accept4(fSocket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+        return;
+    }
+    // Wait for the request on the event loop rather than blocking it
+    auto* pending = new MetricsClient{this, client};
+    fEnv.taskScheduler().setBackgroundHandling(client, SOCKET_READABLE | SOCKET_EXCEPTION, requestReceived, pending);
+}
+
+void MetricsServer::requestReceived(void* clientData, int) {
+    auto* pending = static_cast<MetricsClient*>(clientData);
+    MetricsServer* server = pending->server;
+    int client = pending->socket;
+    delete pending;
+    server->fEnv.taskScheduler().disableBackgroundHandling(client);
+    // The request usually arrives in one segment, answer whatever was sent
+    // rather than wait on the event loop for the rest
+    metrics_read_request(client, 0);
+    server->respond(client);
+}
+
+void MetricsServer::respond(int client) {
+    render();
+    metrics_respond(client, &fBuffer);
+}
+
+void MetricsServer::render() {
+    metrics_reset(&fBuffer);
+    metrics_printf(&fBuffer, "# TYPE rtsp_clients gauge\n");
+    for (const FrameRingReader* reader : fReaders) {
+        metrics_printf(&fBuffer, "rtsp_clients{stream=\"%u\"} %zu\n", reader->stream(), reader->sinks().size());
+    }
+    metrics_printf(&fBuffer, "# TYPE rtsp_rtp_packets_total counter\n");
+    for (const FrameRingReader* reader : fReaders) {
+        metrics_printf(&fBuffer, "rtsp_rtp_packets_total{stream=\"%u\"} %llu\n", reader->stream(),
+                       (unsigned long long) reader->packetsSent());
+    }
+    metrics_printf(&fBuffer, "# TYPE rtsp_rtp_bytes_total counter\n");
+    for (const FrameRingReader* reader : fReaders) {
+        metrics_printf(&fBuffer, "rtsp_rtp_bytes_total{stream=\"%u\"} %llu\n", reader->stream(),
+                       (unsigned long long) reader->bytesSent());
+    }
+    metrics_printf(&fBuffer, "# TYPE rtsp_rtp_packets_dropped_total counter\n");
+    for (const FrameRingReader* reader : fReaders) {
+        metrics_printf(&fBuffer, "rtsp_rtp_packets_dropped_total{stream=\"%u\"} %llu\n", reader->stream(),
+                       (unsigned long long) reader->packetsDropped());
+    }
+
+    // From the last RTCP receiver report of every client
+    metrics_printf(&fBuffer, "# TYPE rtsp_rtcp_receivers gauge\n# TYPE rtsp_rtcp_fraction_lost gauge\n"
+                             "# TYPE rtsp_rtcp_packets_lost gauge\n# TYPE rtsp_rtcp_jitter_ms gauge\n");
+    for (const FrameRingReader* reader : fReaders) {
+        unsigned receivers = 0, worstLoss = 0, lost = 0, worstJitterMs = 0;
+        for (RTPSink* sink : reader->sinks()) {
+            RTPTransmissionStatsDB::Iterator it(sink->transmissionStatsDB());
+            RTPTransmissionStats* stats;
+            while ((stats = it.next()) != nullptr) {
+                receivers++;
+                worstLoss = std::max(worstLoss, (unsigned) stats->packetLossRatio());
+                lost += stats->totNumPacketsLost();
+                worstJitterMs = std::max(worstJitterMs, stats->jitter() / (sink->rtpTimestampFrequency() / 1000));
+            }
+        }
+        metrics_printf(&fBuffer, "rtsp_rtcp_receivers{stream=\"%u\"} %u\n", reader->stream(), receivers);
+        metrics_printf(&fBuffer, "rtsp_rtcp_fraction_lost{stream=\"%u\"} %.4f\n", reader->stream(), worstLoss / 256.0);
+        metrics_printf(&fBuffer, "rtsp_rtcp_packets_lost{stream=\"%u\"} %u\n", reader->stream(), lost);
+        metrics_printf(&fBuffer, "rtsp_rtcp_jitter_ms{stream=\"%u\"} %u\n", reader->stream(), worstJitterMs);
+    }
+
+    // Same histograms as the stats socket, as p50 and p99 bucket bounds
+    metrics_printf(&fBuffer, "# TYPE rtsp_frame_latency_us gauge\n");
+    for (const FrameRingReader* reader : fReaders) {
+        const StreamLatency& latency = reader->latency();
+        const struct {
+            const char* name;
+            const histogram* h;
+        } stages[] = {{"encode", &latency.encode}, {"queue", &latency.queue}, {"ring", &latency.ring},
+                      {"send", &latency.send}, {"total", &latency.total}};
+        for (const auto& stage : stages) {
+            if (stage.h->count == 0) {
+                continue;
+            }
+            metrics_printf(&fBuffer, "rtsp_frame_latency_us{stream=\"%u\",stage=\"%s\",quantile=\"0.5\"} %llu\n",
+                           reader->stream(), stage.name, (unsigned long long) histogram_percentile(stage.h, 50));
+            metrics_printf(&fBuffer, "rtsp_frame_latency_us{stream=\"%u\",stage=\"%s\",quantile=\"0.99\"} %llu\n",
+                           reader->stream(), stage.name, (unsigned long long) histogram_percentile(stage.h, 99));
+        }
+    }
+
+#ifdef MERGED_STREAMER
+    stream_metrics(&fBuffer);
+#endif
+    metrics_process(&fBuffer);
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rtsvideo.h>
+#include <control.h>
+
+// Changes imager_streamer settings while it runs, see CONTROL_SOCKET
+
+#define REPLY_TIMEOUT_MS 2000
+
+// The [isp] names of streamer.ini, any other control is given by its id
+static const struct {
+    const char *name;
+    uint32_t id;
+} isp_controls[] = {
+    {"noise_reduction", RTS_VIDEO_CTRL_ID_NOISE_REDUCTION},
+    {"ldc", RTS_VIDEO_CTRL_ID_LDC},
+    {"detail_enhancement", RTS_VIDEO_CTRL_ID_DETAIL_ENHANCEMENT},
+    {"three_dnr", RTS_VIDEO_CTRL_ID_3DNR},
+    {"mirror", RTS_VIDEO_CTRL_ID_MIRROR},
+    {"flip", RTS_VIDEO_CTRL_ID_FLIP},
+    {"in_out_door_mode", RTS_VIDEO_CTRL_ID_IN_OUT_DOOR_MODE},
+    {"dehaze", RTS_VIDEO_CTRL_ID_DEHAZE},
+    {"brightness", RTS_VIDEO_CTRL_ID_BRIGHTNESS},
+    {"contrast", RTS_VIDEO_CTRL_ID_CONTRAST},
+    {"saturation", RTS_VIDEO_CTRL_ID_SATURATION},
+    {"sharpness", RTS_VIDEO_CTRL_ID_SHARPNESS},
+    {"wdr_mode", RTS_VIDEO_CTRL_ID_WDR_MODE},
+    {"wdr_level", RTS_VIDEO_CTRL_ID_WDR_LEVEL},
+};
+
+static void usage(const char *self) {
+    fprintf(stderr,
+            "Usage: %s [-s stream] command\n"
+            "  keyframe\n"
+            "  bitrate <bps>              within the stream's min_bitrate and max_bitrate\n"
+            "  fps <fps>                  main stream only, up to its configured fps\n"
+            "  isp <name|id> <value>      e.g. mirror 1, within the range the ISP reports\n"
+            "  gop <frames>\n"
+            "  roi <index> <qp delta> [left top right bottom]   no rectangle disables the region\n",
+            self);
+}
+
+// A whole decimal number within min and max, nothing before or after it
+static uint8_t parse_number(const char *text, long min, long max, long *value) {
+    char *end;
+    errno = 0;
+    long n = strtol(text, &end, 10);
+    if (errno || end == text || *end != '\0' || n < min || n > max) {
+        fprintf(stderr, "Invalid number %s, expected %ld to %ld\n", text, min, max);
+        return 0;
+    }
+    *value = n;
+    return 1;
+}
+
+static uint8_t isp_control_id(const char *name, long *id) {
+    for (size_t i = 0; i < sizeof(isp_controls) / sizeof(isp_controls[0]); i++) {
+        if (strcmp(isp_controls[i].name, name) == 0) {
+            *id = isp_controls[i].id;
+            return 1;
+        }
+    }
+    return parse_number(name, 0, INT32_MAX, id);
+}
+
+int main(int argc, char *argv[]) {
+    struct control_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    long stream = 0, id = 0, value = 0, rect[4] = {0};
+    int arg = 1;
+    if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+        if (!parse_number(argv[2], 0, UINT8_MAX, &stream)) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        arg = 3;
+    }
+    if (arg >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *cmd = argv[arg++];
+    int params = argc - arg;
+    char **param = argv + arg;
+    uint8_t ok = 1;
+    if (strcmp(cmd, "keyframe") == 0 && params == 0) {
+        msg.cmd = CONTROL_CMD_KEY_FRAME;
+    } else if (strcmp(cmd, "bitrate") == 0 && params == 1) {
+        msg.cmd = CONTROL_CMD_BITRATE;
+        ok = parse_number(param[0], 1, INT32_MAX, &value);
+    } else if (strcmp(cmd, "fps") == 0 && params == 1) {
+        msg.cmd = CONTROL_CMD_FPS;
+        ok = parse_number(param[0], 1, UINT8_MAX, &value);
+    } else if (strcmp(cmd, "isp") == 0 && params == 2) {
+        msg.cmd = CONTROL_CMD_ISP;
+        ok = isp_control_id(param[0], &id) && parse_number(param[1], INT32_MIN, INT32_MAX, &value);
+    } else if (strcmp(cmd, "gop") == 0 && params == 1) {
+        msg.cmd = CONTROL_CMD_GOP;
+        ok = parse_number(param[0], 1, INT32_MAX, &value);
+    } else if (strcmp(cmd, "roi") == 0 && (params == 2 || params == 6)) {
+        msg.cmd = CONTROL_CMD_ROI;
+        ok = parse_number(param[0], 0, INT32_MAX, &id) && parse_number(param[1], INT32_MIN, INT32_MAX, &value);
+        for (int i = 0; ok && i < 4 && params == 6; i++) {
+            ok = parse_number(param[2 + i], 0, UINT16_MAX, &rect[i]);
+        }
+    } else {
+        ok = 0;
+    }
+    if (!ok) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    msg.stream = (uint8_t) stream;
+    msg.id = (uint32_t) id;
+    msg.value = (int32_t) value;
+    for (int i = 0; i < 4; i++) {
+        msg.rect[i] = (uint16_t) rect[i];
+    }
+
+    struct control_msg reply;
+    if (!control_request(&msg, &reply, REPLY_TIMEOUT_MS)) {
+        fprintf(stderr, "No reply from the streamer on %s\n", CONTROL_SOCKET);
+        return EXIT_FAILURE;
+    }
+    static const char *errors[] = {
+        [CONTROL_ERR_UNKNOWN] = "unknown stream, control or region",
+        [CONTROL_ERR_RANGE] = "value out of range",
+        [CONTROL_ERR_FAILED] = "rejected by the SDK",
+    };
+    if (reply.status != CONTROL_OK) {
+        const char *error = reply.status < sizeof(errors) / sizeof(errors[0]) ? errors[reply.status] : NULL;
+        fprintf(stderr, "Failed: %s, current value %d\n", error ? error : "unknown error", reply.value);
+        return EXIT_FAILURE;
+    }
+    printf("%d\n", reply.value);
+    return EXIT_SUCCESS;
+}
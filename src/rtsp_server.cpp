@@ -20,6 +20,23 @@
 static int parse_ini(void* user, const char* section, const char* name, const char* value) {
     auto* config = static_cast<rtsp_settings *>(user);
 
+    for (int i = 1; i < VIDEO_STREAMS; i++) {
+        char substream[16];
+        snprintf(substream, sizeof(substream), "substream%d", i);
+        if (MATCH(substream, "name")) {
+            config->streams[i].name = strdup(value);
+        } else if (MATCH(substream, "max_bitrate")) {
+            config->streams[i].max_bitrate = strtoul(value, nullptr, 10);
+        } else if (MATCH(substream, "min_bitrate")) {
+            config->streams[i].min_bitrate = strtoul(value, nullptr, 10);
+        } else if (MATCH(substream, "fps")) {
+            config->streams[i].fps = strtoul(value, nullptr, 10);
+        } else if (MATCH(substream, "width")) {
+            config->streams[i].width = strtoul(value, nullptr, 10);
+        } else if (MATCH(substream, "height")) {
+            config->streams[i].height = strtoul(value, nullptr, 10);
+        }
+    }
     if (MATCH("rtsp", "username")) {
         config->user = strdup(value);
     } else if (MATCH("rtsp", "password")) {
@@ -27,14 +44,329 @@ static int parse_ini(void* user, const char* section, const char* name, const ch
     } else if (MATCH("rtsp", "port")) {
         config->port = strtoul(value, nullptr, 10);
     } else if (MATCH("rtsp", "name")) {
-        config->name = strdup(value);
+        config->streams[0].name = strdup(value);
+    } else if (MATCH("encoder", "width")) {
+        config->streams[0].width = strtoul(value, nullptr, 10);
     } else if (MATCH("encoder", "height")) {
-        config->resolution = strtoul(value, nullptr, 10);
+        config->streams[0].height = strtoul(value, nullptr, 10);
+    } else if (MATCH("encoder", "max_bitrate")) {
+        config->streams[0].max_bitrate = strtoul(value, nullptr, 10);
+    } else if (MATCH("encoder", "min_bitrate")) {
+        config->streams[0].min_bitrate = strtoul(value, nullptr, 10);
+    } else if (MATCH("encoder", "fps")) {
+        config->streams[0].fps = strtoul(value, nullptr, 10);
+    } else if (MATCH("rtsp", "gop_cache")) {
+        config->gop_cache = strtoul(value, nullptr, 10) != 0;
+    } else if (MATCH("rtsp", "key_frame_on_play")) {
+        config->key_frame_on_play = strtoul(value, nullptr, 10) != 0;
+    } else if (MATCH("rtsp", "pacing")) {
+        config->pacing = strtoul(value, nullptr, 10);
+    } else if (MATCH("rtsp", "abr")) {
+        config->abr = strtoul(value, nullptr, 10) != 0;
+    } else if (MATCH("rtsp", "abr_min_fps")) {
+        config->abr_min_fps = strtoul(value, nullptr, 10);
+    } else if (MATCH("rtsp", "multicast")) {
+        config->multicast = strdup(value);
+    } else if (MATCH("rtsp", "multicast_port")) {
+        config->multicast_port = strtoul(value, nullptr, 10);
+    } else if (MATCH("rtsp", "multicast_ttl")) {
+        config->multicast_ttl = strtoul(value, nullptr, 10);
+    } else if (MATCH("rtsp", "multicast_ssm")) {
+        config->multicast_ssm = strtoul(value, nullptr, 10) != 0;
+    } else if (MATCH("rtsp", "stats")) {
+        config->stats = strtoul(value, nullptr, 10) != 0;
+    } else if (MATCH("rtsp", "metrics_port")) {
+        config->metrics_port = strtoul(value, nullptr, 10);
     }
 
     return 1;
 }
 
+static zlog_category_t *c;
+static multicast_stream multicast;
+static rtsp_state state;
+
+static Boolean has_name(const char* name) {
+    return name != nullptr && strcmp(name, "") != 0;
+}
+
+static Boolean same_string(const char* a, const char* b) {
+    return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+static void free_settings(rtsp_settings& config) {
+    free(const_cast<char*>(config.user));
+    free(const_cast<char*>(config.pwd));
+    free(const_cast<char*>(config.multicast));
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        free(const_cast<char*>(config.streams[i].name));
+    }
+    config = {};
+}
+
+// Defaults overridden by streamer.ini, into a fresh struct both at startup and on reload
+static Boolean load_settings(rtsp_settings& config) {
+    config = {};
+    config.gop_cache = 1;
+    config.key_frame_on_play = 1;
+    config.multicast_port = 18888;
+    config.multicast_ttl = 1;
+    if (ini_parse(STREAMER_INI, parse_ini, &config) < 0) {
+        free_settings(config);
+        return False;
+    }
+
+    // if the strings are empty strings set them to nullptr
+    if (!has_name(config.user)) {
+        free(const_cast<char*>(config.user));
+        config.user = nullptr;
+    }
+    if (!has_name(config.pwd)) {
+        free(const_cast<char*>(config.pwd));
+        config.pwd = nullptr;
+    }
+    if (config.pacing > 100) {
+        config.pacing = 100;
+    }
+    if (!has_name(config.multicast)) {
+        free(const_cast<char*>(config.multicast));
+        config.multicast = nullptr;
+    }
+    return True;
+}
+
+// Null, leaving the server open, unless both a user and a password are set
+static UserAuthenticationDatabase* auth_database(const rtsp_settings& config) {
+    if (config.user == nullptr || config.pwd == nullptr) {
+        return nullptr;
+    }
+    auto* authDB = new UserAuthenticationDatabase;
+    authDB->addUserRecord(config.user, config.pwd);
+    return authDB;
+}
+
+static Boolean parse_multicast_group(const char* address, struct sockaddr_storage& group) {
+    memset(&group, 0, sizeof(group));
+    auto* v4 = reinterpret_cast<struct sockaddr_in*>(&group);
+    auto* v6 = reinterpret_cast<struct sockaddr_in6*>(&group);
+    if (inet_pton(AF_INET, address, &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        return IN_MULTICAST(ntohl(v4->sin_addr.s_addr));
+    }
+    if (inet_pton(AF_INET6, address, &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        return IN6_IS_ADDR_MULTICAST(&v6->sin6_addr);
+    }
+    return False;
+}
+
+static void start_multicast(void* clientData) {
+    auto* m = static_cast<multicast_stream*>(clientData);
+    UsageEnvironment& env = m->server->envir();
+    FrameRingMulticastSubsession* video = FrameRingMulticastSubsession::createNew(env, *m->reader, m->est_bitrate,
+                                                                                  m->group, m->port, m->ttl, m->ssm);
+    if (video == nullptr) {
+        // The SDP carries the parameter sets, wait for the streamer's first keyframe
+        env.taskScheduler().scheduleDelayedTask(1000000, start_multicast, m);
+        return;
+    }
+    video->setKeyFrameOnPlay(m->key_frame_on_play);
+    video->setPacing(m->pacing, m->frame_interval);
+    ServerMediaSession *sms = ServerMediaSession::createNew(env, m->name, "", "", m->ssm);
+    sms->addSubsession(video);
+    m->server->addServerMediaSession(sms);
+    zlog_info(c, "Multicast started on port %u, ttl %u%s", m->port, m->ttl, m->ssm ? ", source-specific" : "");
+}
+
+#ifdef MERGED_STREAMER
+// Capture loop from imager_streamer, run on its own thread next to the event loop
+static streamer_settings stream_config;
+static frame_ring* stream_rings[VIDEO_STREAMS];
+static char volatile capture_done;
+
+static void* capture_thread(void*) {
+    // The nice value is per thread on Linux, only favour the capture loop
+    setpriority(PRIO_PROCESS, 0, -5);
+    start_stream(stream_config, stream_rings);
+    capture_done = 1;
+    return nullptr;
+}
+
+// Nothing wakes the event loop when the capture loop ends, so it looks every 100 ms
+static void check_capture(void* clientData) {
+    auto* env = static_cast<UsageEnvironment*>(clientData);
+    if (!capture_done) {
+        env->taskScheduler().scheduleDelayedTask(100000, check_capture, env);
+    }
+}
+
+static void terminate(int) {
+    // The event loop stops once the capture loop has released the camera
+    stop_stream();
+}
+#endif
+
+// Serves stream i as state.config describes it, at startup and after a reload changed it
+static void serve_stream(int i) {
+    const rtsp_settings& config = state.config;
+    const rtsp_stream_settings& stream = config.streams[i];
+    served_stream& served = state.streams[i];
+    if (!has_name(stream.name)) {
+        return;
+    }
+    if (served.reader == nullptr) {
+        char ring_name[64];
+        frame_ring_name(VIDEO_RING, i, ring_name, sizeof(ring_name));
+#ifdef MERGED_STREAMER
+        if (stream_rings[i] == nullptr) {
+            zlog_warn(c, "Stream %d is not configured in the streamer, not serving %s", i, stream.name);
+            return;
+        }
+        served.reader = new FrameRingReader(*state.env, ring_name, i, stream_rings[i]);
+#else
+        served.reader = new FrameRingReader(*state.env, ring_name, i);
+#endif
+        if (state.stats) {
+            state.stats->addReader(served.reader);
+        }
+        if (state.metrics) {
+            state.metrics->addReader(served.reader);
+        }
+    }
+    FrameRingReader* video_ring = served.reader;
+    video_ring->setGopCache(config.gop_cache);
+    if (config.abr) {
+        // The sensor rate is shared by every stream, only the main one may lower it
+        served.abr = new BitrateController(*state.env, *video_ring, stream.min_bitrate, stream.max_bitrate,
+                                           i == 0 ? config.abr_min_fps : 0, stream.fps);
+    }
+    if (i == 0 && config.multicast) {
+        if (parse_multicast_group(config.multicast, multicast.group)) {
+            multicast.server = state.server;
+            multicast.reader = video_ring;
+            multicast.name = strdup(stream.name);
+            multicast.est_bitrate = stream.max_bitrate / 1000;
+            multicast.port = config.multicast_port;
+            multicast.ttl = config.multicast_ttl;
+            multicast.ssm = config.multicast_ssm;
+            multicast.key_frame_on_play = config.key_frame_on_play;
+            multicast.pacing = config.pacing;
+            multicast.frame_interval = stream.fps ? 1000000 / stream.fps : 0;
+            start_multicast(&multicast);
+            zlog_info(c, "Serving stream 0 over multicast %s at rtsp://<camera>:%u/%s", config.multicast, config.port, stream.name);
+            return;
+        }
+        zlog_error(c, "%s is not a multicast address, serving stream 0 over unicast", config.multicast);
+    }
+    // Replaying the GOP needs a source per client, otherwise late joiners share the live position
+    Boolean reuse_first_source = config.gop_cache ? False : True;
+    ServerMediaSession *sms = ServerMediaSession::createNew(*state.env, stream.name, "", "");
+    FrameRingMediaSubsession* video = FrameRingMediaSubsession::createNew(*state.env, *video_ring, stream.max_bitrate / 1000, reuse_first_source);
+    video->setKeyFrameOnPlay(config.key_frame_on_play);
+    video->setPacing(config.pacing, stream.fps ? 1000000 / stream.fps : 0);
+    sms->addSubsession(video);
+    state.server->addServerMediaSession(sms);
+    served.sms = sms;
+    zlog_info(c, "Serving stream %d at rtsp://<camera>:%u/%s", i, config.port, stream.name);
+}
+
+// Takes the stream's path away from new clients, those already playing carry on until they leave
+static void stop_serving(int i) {
+    served_stream& served = state.streams[i];
+    if (served.sms) {
+        state.server->removeServerMediaSession(served.sms);
+        served.sms = nullptr;
+    }
+    if (served.abr) {
+        delete served.abr;
+        served.abr = nullptr;
+        // Back to the full rate, the streamer keeps it within its own range
+        served.reader->sendControl(CONTROL_CMD_BITRATE, state.config.streams[i].max_bitrate);
+        if (i == 0 && state.config.abr_min_fps) {
+            served.reader->sendControl(CONTROL_CMD_FPS, 0);
+        }
+    }
+}
+
+// Anything that ends up in the stream's session or bitrate controller
+static Boolean stream_changed(int i, const rtsp_settings& a, const rtsp_settings& b) {
+    const rtsp_stream_settings& sa = a.streams[i];
+    const rtsp_stream_settings& sb = b.streams[i];
+    return !same_string(sa.name, sb.name) || sa.min_bitrate != sb.min_bitrate || sa.max_bitrate != sb.max_bitrate ||
+           sa.fps != sb.fps || sa.width != sb.width || sa.height != sb.height || a.gop_cache != b.gop_cache ||
+           a.key_frame_on_play != b.key_frame_on_play || a.pacing != b.pacing || a.abr != b.abr ||
+           (i == 0 && a.abr_min_fps != b.abr_min_fps);
+}
+
+// Re-reads streamer.ini and applies what changed: the credentials in place,
+// and a new session for each stream whose settings changed
+static void config_changed(void*, int) {
+    if (!config_watch_changed(state.watch, STREAMER_INI)) {
+        return;
+    }
+    rtsp_settings fresh;
+    if (!load_settings(fresh)) {
+        zlog_error(c, "Failed to reload %s, keeping the running settings", STREAMER_INI);
+        return;
+    }
+    zlog_info(c, "%s changed, applying the new settings", STREAMER_INI);
+    rtsp_settings old = state.config;
+
+    // Only needed when setting up the sockets, these keep their startup values
+    if (fresh.port != old.port || !same_string(fresh.multicast, old.multicast) || fresh.multicast_port != old.multicast_port ||
+        fresh.multicast_ttl != old.multicast_ttl || fresh.multicast_ssm != old.multicast_ssm ||
+        fresh.stats != old.stats || fresh.metrics_port != old.metrics_port) {
+        zlog_warn(c, "port, multicast, stats and metrics_port only change after a restart");
+    }
+    fresh.port = old.port;
+    std::swap(fresh.multicast, old.multicast);
+    fresh.multicast_port = old.multicast_port;
+    fresh.multicast_ttl = old.multicast_ttl;
+    fresh.multicast_ssm = old.multicast_ssm;
+    fresh.stats = old.stats;
+    fresh.metrics_port = old.metrics_port;
+    // The multicast session of stream 0 runs with these, the other streams keep them too so they all agree
+    if (multicast.reader) {
+        if (fresh.gop_cache != old.gop_cache || fresh.key_frame_on_play != old.key_frame_on_play ||
+            fresh.pacing != old.pacing || fresh.abr != old.abr || fresh.abr_min_fps != old.abr_min_fps) {
+            zlog_warn(c, "Stream 0 is served over multicast, gop_cache, key_frame_on_play, pacing, abr and abr_min_fps only change after a restart");
+        }
+        fresh.gop_cache = old.gop_cache;
+        fresh.key_frame_on_play = old.key_frame_on_play;
+        fresh.pacing = old.pacing;
+        fresh.abr = old.abr;
+        fresh.abr_min_fps = old.abr_min_fps;
+    }
+
+    if (!same_string(fresh.user, old.user) || !same_string(fresh.pwd, old.pwd)) {
+        // Sessions already authenticated are not asked again
+        delete state.server->setAuthenticationDatabase(auth_database(fresh));
+        zlog_info(c, "RTSP credentials %s", fresh.user && fresh.pwd ? "changed" : "removed");
+    }
+
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        if (!stream_changed(i, fresh, old)) {
+            continue;
+        }
+        if (i == 0 && multicast.reader) {
+            zlog_warn(c, "Stream 0 is served over multicast, its changes need a restart");
+            rtsp_stream_settings kept = old.streams[0];
+            old.streams[0] = fresh.streams[0];
+            fresh.streams[0] = kept;
+            continue;
+        }
+        stop_serving(i);
+    }
+    state.config = fresh;
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        const served_stream& served = state.streams[i];
+        if (served.sms == nullptr && served.abr == nullptr && !(i == 0 && multicast.reader)) {
+            serve_stream(i);
+        }
+    }
+    free_settings(old);
+}
+
 int main(int argc, char *argv[]) {
     // init zlog
     if (zlog_init("zlog.conf") < 0) {
@@ -42,53 +374,105 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    zlog_category_t *c = zlog_get_category("server");
+    c = zlog_get_category("server");
 
     zlog_info(c, "rRTSPServer v%d.%d.%d started", VER_MAJOR, VER_MINOR, VER_PATCH);
 
-    rtsp_settings config;
-    if (ini_parse("streamer.ini", parse_ini, &config) < 0) {
-        zlog_fatal(c, "Failed to load streamer.ini");
+    rtsp_settings& config = state.config;
+    if (!load_settings(config)) {
+        zlog_fatal(c, "Failed to load %s", STREAMER_INI);
         return EXIT_FAILURE;
     }
 
-    // if the strings are empty strings set them to nullptr
-    if (config.user && strcmp(config.user, "") == 0) {
-        config.user = nullptr;
-    }
-    if (config.pwd && strcmp(config.pwd, "") == 0) {
-        config.pwd = nullptr;
-    }
-
     zlog_debug(c, "RTSP settings:");
     zlog_debug(c, "  Username: %s", config.user ? config.user : "None");
     zlog_debug(c, "  Password: %s", config.pwd ? config.pwd : "None");
     zlog_debug(c, "  Port: %u", config.port);
-    zlog_debug(c, "  Stream Name: %s", config.name);
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        if (has_name(config.streams[i].name)) {
+            zlog_debug(c, "  Stream %d Name: %s", i, config.streams[i].name);
+        }
+    }
+    zlog_debug(c, "  GOP cache: %s", config.gop_cache ? "on" : "off");
+    zlog_debug(c, "  Keyframe on play: %s", config.key_frame_on_play ? "on" : "off");
+    zlog_debug(c, "  Adaptive bitrate: %s", config.abr ? "on" : "off");
+    zlog_debug(c, "  Latency stats: %s", config.stats ? "on" : "off");
+    if (config.metrics_port) {
+        zlog_debug(c, "  Metrics port: %u", config.metrics_port);
+    }
+    zlog_debug(c, "  Pacing: %u%% of the frame interval", config.pacing);
+    if (config.multicast) {
+        zlog_debug(c, "  Multicast: %s:%u ttl %u%s", config.multicast, config.multicast_port, config.multicast_ttl,
+                   config.multicast_ssm ? " SSM" : "");
+    }
+
+#ifdef MERGED_STREAMER
+    if (stream_init(&stream_config)) {
+        return EXIT_FAILURE;
+    }
+    // Still named so tools can inspect them, but only read in this process
+    if (stream_create_rings(&stream_config, stream_rings)) {
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, terminate);
+    signal(SIGTERM, terminate);
+#endif
 
     // Begin by setting up our usage environment:
     TaskScheduler *scheduler = BasicTaskScheduler::createNew();
     BasicUsageEnvironment *env = BasicUsageEnvironment::createNew(*scheduler);
-
-    UserAuthenticationDatabase *authDB = nullptr;
-    if ((config.user != nullptr) && (config.pwd != nullptr)) {
-        authDB = new UserAuthenticationDatabase;
-        authDB->addUserRecord(config.user, config.pwd);
-    }
+    state.env = env;
 
     // Create the RTSP server:
-    RTSPServer *rtspServer = RTSPServer::createNew(*env, config.port, authDB);
+    RTSPServer *rtspServer = RTSPServer::createNew(*env, config.port, auth_database(config));
     if (rtspServer == nullptr) {
         zlog_fatal(c, "Failed to create RTSP server: %s", env->getResultMsg());
         exit(EXIT_FAILURE);
     }
+    state.server = rtspServer;
+
+    // Sinks send straight from the shared packetized frames, the buffer only
+    // holds a single packet when live555 does the sending itself
+    OutPacketBuffer::maxSize = 2 * RTP_MAX_PACKET_SIZE;
+    if (config.stats) {
+        state.stats = StatsServer::createNew(*env);
+        if (state.stats == nullptr) {
+            zlog_error(c, "Failed to open the stats socket %s", STATS_SOCKET);
+        }
+    }
+    if (config.metrics_port) {
+        state.metrics = MetricsServer::createNew(*env, config.metrics_port);
+        if (state.metrics == nullptr) {
+            zlog_error(c, "Failed to listen for metrics on port %u", config.metrics_port);
+        } else {
+            zlog_info(c, "Serving metrics on port %u", config.metrics_port);
+        }
+    }
+    // One session per stream, each reading its own ring
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        serve_stream(i);
+    }
+    state.watch = config_watch_open(STREAMER_INI);
+    if (state.watch < 0) {
+        zlog_warn(c, "Failed to watch %s, changes need a restart", STREAMER_INI);
+    } else {
+        env->taskScheduler().setBackgroundHandling(state.watch, SOCKET_READABLE, config_changed, nullptr);
+    }
+#ifdef MERGED_STREAMER
+    // Only start capturing once the readers are listening for frames
+    pthread_t capture;
+    if (pthread_create(&capture, nullptr, capture_thread, nullptr)) {
+        zlog_fatal(c, "Failed to start the capture thread");
+        exit(EXIT_FAILURE);
+    }
+    check_capture(env);
+    env->taskScheduler().doEventLoop(&capture_done);
 
-    OutPacketBuffer::maxSize = 300000;
-    Boolean reuse_first_source = True;
-    ServerMediaSession *sms= ServerMediaSession::createNew(*env, config.name, "", "");
-    sms->addSubsession(H264VideoFileServerMediaSubsession::createNew(*env, VIDEO_SINK, reuse_first_source));
-    rtspServer->addServerMediaSession(sms);
+    pthread_join(capture, nullptr);
+    stream_release(stream_rings);
+#else
     env->taskScheduler().doEventLoop(); // does not return
+#endif
 
     return 0;
 }
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <zlog.h>
+#include <stats_server.h>
+
+StatsServer* StatsServer::createNew(UsageEnvironment& env) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, STATS_SOCKET, sizeof(addr.sun_path) - 1);
+    // Left behind by a previous run
+    unlink(addr.sun_path);
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) || listen(fd, 4)) {
+        close(fd);
+        return nullptr;
+    }
+    return new StatsServer(env, fd);
+}
+
+StatsServer::StatsServer(UsageEnvironment& env, int socket) : fEnv(env), fSocket(socket) {
+    env.taskScheduler().setBackgroundHandling(fSocket, SOCKET_READABLE, incomingConnection, this);
+}
+
+StatsServer::~StatsServer() {
+    fEnv.taskScheduler().disableBackgroundHandling(fSocket);
+    close(fSocket);
+    unlink(STATS_SOCKET);
+}
+
+void StatsServer::incomingConnection(void* clientData, int) {
+    static_cast<StatsServer*>(clientData)->incomingConnection();
+}
+
+void StatsServer::incomingConnection() {
+    int client = accept4(fSocket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+        return;
+    }
+    // A few KB at most, fits the socket buffer so a slow reader cannot stall the event loop
+    struct timeval timeout = {0, 100000};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    std::string text = report();
+    if (send(client, text.data(), text.size(), MSG_NOSIGNAL) < 0) {
+        zlog_warn(zlog_get_category("server"), "Failed to send the latency stats: %s", strerror(errno));
+    }
+    close(client);
+}
+
+static void appendHistogram(std::string& out, const char* stream, const char* stage, const histogram& h) {
+    char line[256];
+    if (h.count == 0) {
+        snprintf(line, sizeof(line), "%s %-6s no samples\n", stream, stage);
+        out += line;
+        return;
+    }
+    snprintf(line, sizeof(line), "%s %-6s count %u min %llu mean %llu p50 %llu p99 %llu max %llu\n",
+             stream, stage, h.count, (unsigned long long) h.min, (unsigned long long) (h.sum / h.count),
+             (unsigned long long) histogram_percentile(&h, 50), (unsigned long long) histogram_percentile(&h, 99),
+             (unsigned long long) h.max);
+    out += line;
+    out += "  buckets";
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (h.buckets[i] == 0) {
+            continue;
+        }
+        // Upper bound of the bucket, the last one is open
+        if (i == HISTOGRAM_BUCKETS - 1) {
+            snprintf(line, sizeof(line), " +inf:%u", h.buckets[i]);
+        } else {
+            snprintf(line, sizeof(line), " %llu:%u", (unsigned long long) ((uint64_t) 2 << i), h.buckets[i]);
+        }
+        out += line;
+    }
+    out += "\n";
+}
+
+std::string StatsServer::report() const {
+    std::string out = "# stream stage, latency in us since the server started\n";
+    for (const FrameRingReader* reader : fReaders) {
+        const StreamLatency& latency = reader->latency();
+        appendHistogram(out, reader->name(), "encode", latency.encode);
+        appendHistogram(out, reader->name(), "queue", latency.queue);
+        appendHistogram(out, reader->name(), "ring", latency.ring);
+        appendHistogram(out, reader->name(), "send", latency.send);
+        appendHistogram(out, reader->name(), "total", latency.total);
+    }
+    return out;
+}
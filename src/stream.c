@@ -16,389 +16,1010 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
-#include <fcntl.h>
 #include <signal.h>
-#include <rtsisp.h>
-#include <rtscamkit.h>
-#include <rtsavapi.h>
+#include <pthread.h>
+#include <rtsdef.h>
+#include <rtsavdef.h>
 #include <rtsvideo.h>
-#include <rts_pthreadpool.h>
-#include <sys/stat.h>
-#include <sys/ioctl.h>
 #include <rts_io_adc.h>
 #include <sys/resource.h>
 #include <zlog.h>
 #include <ini.h>
 #include <ver.h>
 #include <globals.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <frame_ring.h>
+#include <frame_queue.h>
+#include <histogram.h>
+#include <hal.h>
+#include <stream.h>
+#include <control.h>
+#include <metrics.h>
+#include <ir_ctrl.h>
+#include <isp_ctrl.h>
+#include <config_watch.h>
 
 uint8_t g_exit = RTS_FALSE;
-// This is used for "debouncing" the IR mode changes
 int8_t g_ir_cut_mode = -1; // 0 = day, 1 = night
 
-zlog_category_t *c;
+static zlog_category_t *c;
 
+// Exported by stream_metrics(), updated with relaxed atomics from the capture,
+// writer and IR threads. 32 bit so they stay lock free on the SoC, rate()
+// copes with the wrap.
 typedef struct {
-    int32_t noise_reduction;
-    int32_t ldc;
-    int32_t detail_enhancement;
-    int32_t three_dnr;
-    int32_t mirror;
-    int32_t flip;
-    int32_t adc_cutoff_inverted;
-    int32_t adc_cutoff;
-    int32_t in_out_door_mode;
-    int32_t dehaze;
-    uint32_t min_bitrate;
-    uint32_t max_bitrate;
-    uint32_t width;
-    uint32_t height;
-    uint32_t fps;
-    uint8_t invert_ir_cut;
-} streamer_settings;
+    uint8_t enabled;
+    uint32_t frames_encoded;
+    uint32_t frames_dropped; // Skipped while the writer was behind or too big for the ring
+    uint32_t bytes_written;
+    uint32_t bitrate;        // Max bitrate the encoder reports after the last change
+} stream_counters;
+
+static stream_counters counters[VIDEO_STREAMS];
+static int32_t g_adc_value = -1; // Filtered light sensor reading
+
+// IR configuration published by the capture loop, picked up by the IR thread on its next sample
+static pthread_mutex_t ir_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static ir_ctrl_config ir_config_pending;
+static uint8_t ir_config_published = RTS_FALSE;
+static uint8_t ir_restore_pending = RTS_FALSE; // Rebuilt channels came up in day mode
 
 typedef struct {
-    PthreadPool tpool;
     int32_t isp;
     int32_t h264_enc;
+} video_pipeline;
+
+typedef struct {
+    pthread_t ir_thread;
+    uint8_t ir_thread_running;
+    video_pipeline video[VIDEO_STREAMS];
     int32_t audio_chn;
     int32_t audio_enc;
 } handlers;
 
-#define ADC_ITERATIONS 15
+// State of a stream, shared by the capture loop and the writer thread
+typedef struct {
+    frame_ring *ring; // NULL when the stream is disabled
+    frame_queue queue;
+    // Capture loop only
+    uint8_t key_frame_pending;
+    uint8_t resync; // The queue overflowed, skip frames until the next keyframe
+    uint64_t last_key_frame;
+    uint32_t frames_skipped;
+    // Writer thread only
+    uint32_t frames_dropped;
+    histogram latency; // Encoder timestamp to ring write completion
+} video_output;
+
+typedef struct {
+    video_output *outputs;
+    int event; // Rung by the capture loop after queueing frames
+    uint8_t running;
+    uint32_t latency_report; // Seconds, 0 when not measuring
+    uint64_t last_report;
+} frame_writer;
 
-static void terminate() {
+// The light sensor is read this often, ir_ctrl filters the readings
+#define IR_SAMPLE_MS 500
+// Left to other apps driving the IR cut at boot
+#ifndef IR_START_DELAY_S
+#define IR_START_DELAY_S 30
+#endif
+// Defaults for [isp] ir_hysteresis (ADC counts), ir_dwell (seconds) and ir_luma_night
+#define IR_HYSTERESIS 50
+#define IR_DWELL_S 10
+#define IR_LUMA_NIGHT 40
+// Default minimum time between keyframes requested over the control channel
+#define KEY_FRAME_INTERVAL_MS 1000
+// Upper bound on how long the capture loop sleeps without a frame notification
+#define FRAME_WAIT_TIMEOUT_MS 1000
+// ISP buffers when [encoder] isp_buf_num is not set
+#define ISP_BUF_NUM 2
+// How long a scraper has to send its request
+#define METRICS_REQUEST_TIMEOUT_MS 500
+
+// Same clock as the encoder timestamps
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t now_ms(void) {
+    return now_us() / 1000;
+}
+
+void stop_stream(void) {
     g_exit = RTS_TRUE;
 }
 
-uint8_t set_c_vbr(const int h264_ch, const uint32_t max_bitrate, const uint32_t min_bitrate) {
+// current is set to the max bitrate the encoder ended up with
+uint8_t set_c_vbr(const int h264_ch, const uint32_t max_bitrate, const uint32_t min_bitrate, uint32_t *current) {
     struct rts_video_h264_ctrl *h264_ctl = NULL;
 
-    int ret = rts_av_query_h264_ctrl(h264_ch, &h264_ctl);
-    if (h264_ctl == NULL)
+    int ret = hal_query_h264_ctrl(h264_ch, &h264_ctl);
+    if (ret || h264_ctl == NULL) {
+        zlog_error(c, "Failed to query the H264 ctrl of channel %d, ret %d", h264_ch, ret);
+        if (h264_ctl) {
+            hal_release_h264_ctrl(h264_ctl);
+        }
         return RTS_FALSE;
-    rts_av_get_h264_ctrl(h264_ctl);
+    }
+    hal_get_h264_ctrl(h264_ctl);
 
-    if (!ret) {
-        h264_ctl->bitrate_mode = RTS_BITRATE_MODE_C_VBR;
-        h264_ctl->max_bitrate = max_bitrate;
-        h264_ctl->min_bitrate = min_bitrate;
-        rts_av_set_h264_ctrl(h264_ctl);
-        rts_av_release_h264_ctrl(h264_ctl);
-        zlog_info(c, "Set encoder to CVBR mode with max_bitrate=%d, min_bitrate=%d", max_bitrate, min_bitrate);
+    h264_ctl->bitrate_mode = RTS_BITRATE_MODE_C_VBR;
+    h264_ctl->max_bitrate = max_bitrate;
+    h264_ctl->min_bitrate = min_bitrate;
+    ret = hal_set_h264_ctrl(h264_ctl);
+    hal_get_h264_ctrl(h264_ctl);
+    __atomic_store_n(current, h264_ctl->max_bitrate, __ATOMIC_RELAXED);
+    hal_release_h264_ctrl(h264_ctl);
+    if (ret) {
+        zlog_error(c, "Failed to set CVBR mode on channel %d, ret %d", h264_ch, ret);
+        return RTS_FALSE;
     }
+    zlog_info(c, "Set encoder to CVBR mode with max_bitrate=%d, min_bitrate=%d", max_bitrate, min_bitrate);
     return RTS_TRUE;
 }
 
 void set_fps(const uint8_t fps) {
-    uint32_t id = RTS_VIDEO_CTRL_ID_EXPOSURE_PRIORITY;
-    struct rts_video_control ctrl;
-
-    rts_av_get_isp_ctrl(id, &ctrl);
     if (fps) {
-        ctrl.current_value = RTS_ISP_AE_PRIORITY_MANUAL;
-        rts_av_set_isp_ctrl(id, &ctrl);
+        isp_ctrl_set(RTS_VIDEO_CTRL_ID_EXPOSURE_PRIORITY, RTS_ISP_AE_PRIORITY_MANUAL);
 
-        uint8_t tmp = rts_av_get_isp_dynamic_fps();
-        rts_av_set_isp_dynamic_fps(fps);
+        uint8_t tmp = hal_get_isp_dynamic_fps();
+        hal_set_isp_dynamic_fps(fps);
 
-        zlog_info(c, "Changed sensor fps from %d to %d", tmp, rts_av_get_isp_dynamic_fps());
+        zlog_info(c, "Changed sensor fps from %d to %d", tmp, hal_get_isp_dynamic_fps());
     } else {
-        ctrl.current_value = RTS_ISP_AE_PRIORITY_AUTO;
-        rts_av_set_isp_ctrl(id, &ctrl);
-        zlog_info(c, "Sensor fps is %d", rts_av_get_isp_dynamic_fps());
+        isp_ctrl_set(RTS_VIDEO_CTRL_ID_EXPOSURE_PRIORITY, RTS_ISP_AE_PRIORITY_AUTO);
+        zlog_info(c, "Sensor fps is %d", hal_get_isp_dynamic_fps());
     }
 }
 
-static uint8_t is_valid_value(int value, const struct rts_video_control *ctrl) {
-    return (value >= ctrl->minimum && value <= ctrl->maximum && (value - ctrl->minimum) % ctrl->step == 0);
-}
-
-uint8_t change_isp_setting(enum enum_rts_video_ctrl_id type, int value) {
-    struct rts_video_control ctrl;
-    int ret;
-    ret = rts_av_get_isp_ctrl(type, &ctrl);
-    if (ret) {
-        zlog_error(c, "Failed to change get control for %s", ctrl.name);
-        return RTS_FALSE;
-    }
-    if (!is_valid_value(value, &ctrl)) {
-        zlog_error(c, "Invalid value %d for %s (min: %d, max: %d, step: %d)", value, ctrl.name, ctrl.minimum, ctrl.maximum, ctrl.step);
-        zlog_warn(c, "Setting to default value %d", ctrl.default_value);
-        value = ctrl.default_value;
-    }
-    ctrl.current_value = value;
-    ret = rts_av_set_isp_ctrl(type, &ctrl);
-    if (ret) {
-        zlog_error(c, "Failed to set new value for %d: ret = %d", type, ret);
-        return RTS_FALSE;
-    }
-    zlog_info(c, "Changed %s to %d", ctrl.name, value);
-
-    return RTS_TRUE;
-}
-
 void get_all_isp_options() {
     struct rts_video_control ctrl;
 
     fprintf(stdout, "Name,Min,Max,Step,Default,Current\n");
 
     for (int i = 1; i < RTS_VIDEO_CTRL_ID_RESERVED; i++) {
-        int ret = rts_av_get_isp_ctrl(i, &ctrl);
+        int ret = hal_get_isp_ctrl(i, &ctrl);
         if (ret)
             continue;
         fprintf(stdout, "%s,%d,%d,%d,%d,%d\n", ctrl.name, ctrl.minimum, ctrl.maximum, ctrl.step, ctrl.default_value, ctrl.current_value);
     }
 }
 
-int change_ir_cut(int action) {
-    int driver = open("/dev/cpld_periph", O_RDWR);
-    if (action == 0) {
-        ioctl(driver, _IOC(_IOC_NONE, 0x70, 0x15, 0), 0);
+static void set_ir_mode(int8_t night, const ir_ctrl *ir) {
+    zlog_info(c, "Switching to %s mode, ADC %d, luma %d, gain %d", night ? "night" : "day", ir_ctrl_level(ir),
+              ir->luma < 0 ? -1 : ir->luma / 256, ir->gain < 0 ? -1 : ir->gain / 256);
+    zlog_debug(c, "IR control: ISP day/night statistic %d, IR reflection %d", hal_get_isp_daynight_statis(), ir->reflection);
+    // Any frame caught between the steps is gray rather than tinted by IR light:
+    // the image goes gray before the filter comes out, and the filter is back before colour returns
+    isp_ctrl_txn txn;
+    isp_ctrl_begin(&txn);
+    if (night) {
+        isp_ctrl_add(&txn, RTS_VIDEO_CTRL_ID_GRAY_MODE, 1);
+        isp_ctrl_add(&txn, RTS_VIDEO_CTRL_ID_IR_MODE, 1);
+        isp_ctrl_add(&txn, ISP_CTRL_IR_CUT, 1);
     } else {
-        ioctl(driver, _IOC(_IOC_NONE, 0x70, 0x16, 0), 0);
+        isp_ctrl_add(&txn, ISP_CTRL_IR_CUT, 0);
+        isp_ctrl_add(&txn, RTS_VIDEO_CTRL_ID_IR_MODE, 0);
+        isp_ctrl_add(&txn, RTS_VIDEO_CTRL_ID_GRAY_MODE, 0);
     }
-    close(driver);
-    return RTS_TRUE;
+    isp_ctrl_commit(&txn);
+    __atomic_store_n(&g_ir_cut_mode, night, __ATOMIC_RELAXED);
 }
 
-static void check_ir_mode(const int32_t cutoff_inverted, const int32_t cutoff, const uint8_t invert) {
-    // ADC return 3297 in total darkness and <100 in just a little bit of light.
-    // The ADC is very noisy
-    int32_t adc_value_0 = 0;
-    int32_t adc_value_1 = 0;
-    int32_t adc_value_2 = 0;
-    int32_t adc_value_3 = 0;
-    // Read the ADC value multiple times to get a stable reading
-    for (int i = 0; i < ADC_ITERATIONS; i++) {
-        adc_value_0 += rts_io_adc_get_value(ADC_CHANNEL_0);
-        adc_value_1 += rts_io_adc_get_value(ADC_CHANNEL_1);
-        adc_value_2 += rts_io_adc_get_value(ADC_CHANNEL_2);
-        adc_value_3 += rts_io_adc_get_value(ADC_CHANNEL_3);
-        // Sleep for a short time to allow the ADC to stabilize
-        sleep(1);
+// The ADC is the average of the four channels, a single reading is noisy but the filter in ir_ctrl smooths it
+static void read_light(ir_sample *sample, uint8_t isp) {
+    sample->adc = (hal_adc_get_value(ADC_CHANNEL_0) + hal_adc_get_value(ADC_CHANNEL_1) +
+                   hal_adc_get_value(ADC_CHANNEL_2) + hal_adc_get_value(ADC_CHANNEL_3)) / 4;
+    if (!isp || hal_get_isp_ae_statis(&sample->luma, &sample->gain)) {
+        sample->luma = -1;
+        sample->gain = -1;
     }
-    adc_value_0 = adc_value_0 / ADC_ITERATIONS;
-    adc_value_1 = adc_value_1 / ADC_ITERATIONS;
-    adc_value_2 = adc_value_2 / ADC_ITERATIONS;
-    adc_value_3 = adc_value_3 / ADC_ITERATIONS;
+}
 
-    uint32_t adc_value = (adc_value_0 + adc_value_1 + adc_value_2 + adc_value_3) / 4;
+static void publish_ir_config(const streamer_settings *settings) {
+    ir_ctrl_config ir_config = {
+        .strategy = ir_strategy_find(settings->ir_strategy),
+        .luma_night = settings->ir_luma_night,
+        .gain_night = settings->ir_gain_night,
+        .cutoff = settings->invert_ir_cut ? settings->adc_cutoff_inverted : settings->adc_cutoff,
+        .hysteresis = settings->ir_hysteresis,
+        .inverted = settings->invert_ir_cut,
+        .dwell_ms = settings->ir_dwell * 1000,
+    };
+    if (!ir_config.strategy) {
+        zlog_error(c, "Unknown IR strategy %s, using adc", settings->ir_strategy);
+        ir_config.strategy = &ir_strategy_adc;
+    }
+    pthread_mutex_lock(&ir_config_lock);
+    ir_config_pending = ir_config;
+    ir_config_published = RTS_TRUE;
+    pthread_mutex_unlock(&ir_config_lock);
+}
 
-    if ((invert && adc_value > cutoff_inverted) || (adc_value < cutoff)) {
-        if (g_ir_cut_mode != 0) {
-            zlog_debug(c, "IR control: ADC_tot=%d, ADC_0=%d, ADC_1=%d, ADC_2=%d, ADC_3=%d cutoff=%d", adc_value, adc_value_0, adc_value_1, adc_value_2, adc_value_3, invert ? cutoff_inverted : cutoff);
-            zlog_info(c, "Switching to day mode");
-            change_isp_setting(RTS_VIDEO_CTRL_ID_GRAY_MODE, 0);
-            change_isp_setting(RTS_VIDEO_CTRL_ID_IR_MODE, 0);
-            change_ir_cut(0);
-            g_ir_cut_mode = 0;
-        }
-    } else {
-        if (g_ir_cut_mode != 1) {
-            zlog_debug(c, "IR control: ADC_tot=%d, ADC_0=%d, ADC_1=%d, ADC_2=%d, ADC_3=%d cutoff=%d", adc_value, adc_value_0, adc_value_1, adc_value_2, adc_value_3, invert ? cutoff_inverted : cutoff);
-            zlog_info(c, "Switching to night mode");
-            change_isp_setting(RTS_VIDEO_CTRL_ID_GRAY_MODE, 1);
-            change_isp_setting(RTS_VIDEO_CTRL_ID_IR_MODE, 1);
-            change_ir_cut(1);
-            g_ir_cut_mode = 1;
-        }
+// True when a configuration was published since the last call
+static uint8_t take_ir_config(ir_ctrl_config *ir_config) {
+    pthread_mutex_lock(&ir_config_lock);
+    uint8_t published = ir_config_published;
+    if (published) {
+        *ir_config = ir_config_pending;
+        ir_config_published = RTS_FALSE;
     }
+    pthread_mutex_unlock(&ir_config_lock);
+    return published;
 }
 
-static void ir_ctrl_thread(void *arg) {
+// Has the IR thread set its current mode again on its next sample
+static void restore_ir_mode(void) {
+    pthread_mutex_lock(&ir_config_lock);
+    ir_restore_pending = RTS_TRUE;
+    pthread_mutex_unlock(&ir_config_lock);
+}
+
+static uint8_t take_ir_restore(void) {
+    pthread_mutex_lock(&ir_config_lock);
+    uint8_t pending = ir_restore_pending;
+    ir_restore_pending = RTS_FALSE;
+    pthread_mutex_unlock(&ir_config_lock);
+    return pending;
+}
+
+// Started once publish_ir_config() has been called
+static void *ir_ctrl_thread(void *arg) {
     zlog_info(c, "Starting IR control thread");
-    const streamer_settings *settings = (streamer_settings *) arg;
+    ir_ctrl_config ir_config;
+    take_ir_config(&ir_config);
+    ir_ctrl ir;
+    ir_ctrl_init(&ir, &ir_config);
     // Wait for any other apps controlling the IR cut to end
-    sleep(30);
-    zlog_info(c, "Beginning IR control");
+    for (int i = 0; i < IR_START_DELAY_S && g_exit == RTS_FALSE; i++) {
+        sleep(1);
+    }
+    zlog_info(c, "Beginning IR control with the %s strategy, cutoff %d +/- %d, dwell %u s", ir.config.strategy->name,
+              ir.config.cutoff, ir.config.hysteresis, ir.config.dwell_ms / 1000);
     while (g_exit == RTS_FALSE) {
-        check_ir_mode(settings->adc_cutoff_inverted, settings->adc_cutoff, settings->invert_ir_cut);
-        sleep(30 - ADC_ITERATIONS);
+        if (take_ir_config(&ir_config)) {
+            ir_ctrl_configure(&ir, &ir_config);
+            zlog_info(c, "IR control now uses the %s strategy, cutoff %d +/- %d, dwell %u s", ir.config.strategy->name,
+                      ir.config.cutoff, ir.config.hysteresis, ir.config.dwell_ms / 1000);
+        }
+        if (take_ir_restore() && ir.mode >= 0) {
+            set_ir_mode(ir.mode, &ir);
+        }
+        // Only the fused strategy looks at the ISP
+        uint8_t isp = ir.config.strategy != &ir_strategy_adc;
+        ir_sample sample;
+        read_light(&sample, isp);
+        int8_t night = ir_ctrl_sample(&ir, &sample, now_ms());
+        __atomic_store_n(&g_adc_value, ir_ctrl_level(&ir), __ATOMIC_RELAXED);
+        if (night >= 0) {
+            set_ir_mode(night, &ir);
+        }
+        usleep(IR_SAMPLE_MS * 1000);
     }
     zlog_info(c, "IR control thread exiting");
+    return NULL;
 }
 
-uint8_t create_sink(FILE** sink, const char* path) {
-    // remove any existing fifo file
-    if (unlink(path) == 0) {
-        zlog_debug(c, "Removed existing fifo file %s", path);
+// Tears down one stream's channels, set up by create_video_pipeline()
+static void destroy_video_pipeline(video_pipeline *v) {
+    if (v->h264_enc >= 0) {
+        hal_stop_recv(v->h264_enc);
     }
-    // create a new fifo file
-    if (mkfifo(path, 0755) < 0) {
-        zlog_fatal(c, "Failed to create fifo file %s", path);
-        return RTS_FALSE;
+    if (v->isp >= 0 && v->h264_enc >= 0) {
+        hal_unbind(v->isp, v->h264_enc);
     }
-    // open the fifo file for writing
-    *sink = fopen(path, "wb");
-    if (!*sink) {
-        zlog_fatal(c, "Failed to open fifo file %s", path);
-        return RTS_FALSE;
+    if (v->h264_enc >= 0) {
+        hal_disable_chn(v->h264_enc);
+        hal_destroy_chn(v->h264_enc);
     }
-    zlog_info(c, "Created sink at %s", path);
-    signal(SIGPIPE, SIG_IGN);
-    return RTS_TRUE;
+    if (v->isp >= 0) {
+        hal_disable_chn(v->isp);
+        hal_destroy_chn(v->isp);
+    }
+    v->isp = -1;
+    v->h264_enc = -1;
 }
 
-
-void kill_stream(const handlers *h) {
+// Tears down the channels and the IR thread, the rings and the HAL stay up
+static void release_stream(handlers *h) {
     g_exit = RTS_TRUE;
-    sleep(2); // Give the IR control thread time to exit
-    rts_pthreadpool_destroy(h->tpool);
-    if (h->isp >= 0) {
-        rts_av_disable_chn(h->isp);
-        rts_av_destroy_chn(h->isp);
+    // The IR control thread checks g_exit at least once a second
+    if (h->ir_thread_running) {
+        pthread_join(h->ir_thread, NULL);
     }
-    if (h->h264_enc >= 0) {
-        rts_av_stop_recv(h->h264_enc);
-        rts_av_disable_chn(h->h264_enc);
-        rts_av_destroy_chn(h->h264_enc);
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        destroy_video_pipeline(&h->video[i]);
     }
     if (h->audio_chn >= 0) {
-        rts_av_disable_chn(h->audio_chn);
-        rts_av_destroy_chn(h->audio_chn);
+        hal_disable_chn(h->audio_chn);
+        hal_destroy_chn(h->audio_chn);
     }
     if (h->audio_enc >= 0) {
-        rts_av_stop_recv(h->audio_enc);
-        rts_av_disable_chn(h->audio_enc);
-        rts_av_destroy_chn(h->audio_enc);
-    }
-    if (h->isp >= 0 && h->h264_enc >= 0) {
-        rts_av_unbind(h->isp, h->h264_enc);
+        hal_stop_recv(h->audio_enc);
+        hal_disable_chn(h->audio_enc);
+        hal_destroy_chn(h->audio_enc);
     }
     if (h->audio_chn >= 0 && h->audio_enc >= 0) {
-        rts_av_unbind(h->audio_chn, h->audio_enc);
+        hal_unbind(h->audio_chn, h->audio_enc);
     }
-
-    rts_av_release();
     zlog_info(c, "Stream stopped and resources released");
+}
+
+// For errors the capture loop can not recover from, ends the process
+void kill_stream(handlers *h) {
+    release_stream(h);
+    hal_release();
     _exit(1);
 }
 
-int start_stream(streamer_settings config) {
+uint8_t stream_enabled(const video_stream_settings *video) {
+    return video->width && video->height && video->fps;
+}
+
+// Creates the ISP channel and H.264 encoder of one stream and binds them
+static uint8_t create_video_pipeline(video_pipeline *v, int index, const video_stream_settings *video) {
     struct rts_isp_attr isp_attr;
     struct rts_h264_attr h264_attr;
     struct rts_av_profile profile;
 
-    handlers h = {
-        .tpool = NULL,
-        .isp = -1,
-        .h264_enc = -1,
-    };
-
-    // -- VIDEO SETUP --
-    isp_attr.isp_id = 0;
-    isp_attr.isp_buf_num = 2;
-    h.isp = rts_av_create_isp_chn(&isp_attr);
+    // Each stream is scaled by the ISP from the same sensor
+    isp_attr.isp_id = index;
+    isp_attr.isp_buf_num = video->isp_buf_num ? video->isp_buf_num : ISP_BUF_NUM;
+    v->isp = hal_create_isp_chn(&isp_attr);
 
-    if (h.isp < 0) {
-        zlog_fatal(c, "Failed to create ISP channel, ret %d", h.isp);
-        kill_stream(&h);
+    if (v->isp < 0) {
+        zlog_fatal(c, "Failed to create ISP channel for stream %d, ret %d", index, v->isp);
+        return RTS_FALSE;
     }
-    zlog_debug(c, "ISP channel created: %d", h.isp);
+    zlog_debug(c, "ISP channel created: %d", v->isp);
 
     profile.fmt = RTS_V_FMT_YUV420SEMIPLANAR;
-    profile.video.width = config.width;
-    profile.video.height = config.height;
+    profile.video.width = video->width;
+    profile.video.height = video->height;
     profile.video.numerator = 1;
-    profile.video.denominator = config.fps;
+    profile.video.denominator = video->fps;
 
-    int ret = rts_av_set_profile(h.isp, &profile);
+    int ret = hal_set_profile(v->isp, &profile);
     if (ret) {
-        zlog_fatal(c, "Failed to set ISP profile, ret %d", ret);
-        kill_stream(&h);
+        zlog_fatal(c, "Failed to set ISP profile for stream %d, ret %d", index, ret);
+        return RTS_FALSE;
     }
     h264_attr.level = H264_LEVEL_4;
     h264_attr.qp = -1;
-    h264_attr.bps = config.max_bitrate;
-    h264_attr.gop = config.fps * 2;
+    h264_attr.bps = video->max_bitrate;
+    h264_attr.gop = video->gop ? video->gop : video->fps * 2;
     h264_attr.videostab = 0;
     h264_attr.rotation = RTS_AV_ROTATION_0;
-    h.h264_enc = rts_av_create_h264_chn(&h264_attr);
-    if (h.h264_enc < 0) {
-        zlog_fatal(c, "Failed to create H264 channel, ret %d", h.h264_enc);
-        kill_stream(&h);
+    v->h264_enc = hal_create_h264_chn(&h264_attr);
+    if (v->h264_enc < 0) {
+        zlog_fatal(c, "Failed to create H264 channel for stream %d, ret %d", index, v->h264_enc);
+        return RTS_FALSE;
+    }
+    zlog_debug(c, "H264 channel created: %d", v->h264_enc);
+    if (video->waiting_limit) {
+        ret = hal_set_waiting_limit(v->h264_enc, video->waiting_limit);
+        if (ret) {
+            zlog_error(c, "Failed to set the waiting limit of stream %d to %u, ret %d", index, video->waiting_limit, ret);
+        }
     }
-    zlog_debug(c, "H264 channel created: %d", h.h264_enc);
 
-    ret = rts_av_bind(h.isp, h.h264_enc);
+    ret = hal_bind(v->isp, v->h264_enc);
     if (ret) {
         zlog_fatal(c, "Failed to bind ISP & H264 encoder to RTS AV API, ret %d", ret);
-        kill_stream(&h);
+        return RTS_FALSE;
     }
-    rts_av_enable_chn(h.isp);
-    rts_av_enable_chn(h.h264_enc);
-    change_isp_setting(RTS_VIDEO_CTRL_ID_NOISE_REDUCTION, config.noise_reduction);
-    change_isp_setting(RTS_VIDEO_CTRL_ID_LDC, config.ldc);
-    change_isp_setting(RTS_VIDEO_CTRL_ID_DETAIL_ENHANCEMENT, config.detail_enhancement);
-    change_isp_setting(RTS_VIDEO_CTRL_ID_3DNR, config.three_dnr);
-    change_isp_setting(RTS_VIDEO_CTRL_ID_MIRROR, config.mirror);
-    change_isp_setting(RTS_VIDEO_CTRL_ID_FLIP, config.flip);
-    change_isp_setting(RTS_VIDEO_CTRL_ID_IN_OUT_DOOR_MODE, config.in_out_door_mode);
-    change_isp_setting(RTS_VIDEO_CTRL_ID_DEHAZE, config.dehaze);
-
-    h.tpool = rts_pthreadpool_init(1);
-    if (!h.tpool) {
-        kill_stream(&h);
+    hal_enable_chn(v->isp);
+    hal_enable_chn(v->h264_enc);
+    zlog_info(c, "Stream %d: %ux%u at %u fps, %d ISP buffers", index, video->width, video->height, video->fps, isp_attr.isp_buf_num);
+    return RTS_TRUE;
+}
+
+// Applies a rate picked by the server's bitrate controller, within the configured range
+static uint8_t handle_rate_control(struct control_msg *msg, const handlers *h, const streamer_settings *config) {
+    const video_stream_settings *video = &config->video[msg->stream];
+    if (msg->cmd == CONTROL_CMD_BITRATE) {
+        uint32_t bitrate = msg->value > 0 ? (uint32_t) msg->value : 0;
+        if (bitrate > video->max_bitrate) {
+            bitrate = video->max_bitrate;
+        }
+        if (bitrate < video->min_bitrate) {
+            bitrate = video->min_bitrate;
+        }
+        if (!set_c_vbr(h->video[msg->stream].h264_enc, bitrate, video->min_bitrate, &counters[msg->stream].bitrate)) {
+            return CONTROL_ERR_FAILED;
+        }
+        msg->value = __atomic_load_n(&counters[msg->stream].bitrate, __ATOMIC_RELAXED);
+        return CONTROL_OK;
+    }
+    if (msg->stream != 0) {
+        // The sensor feeds every stream, substreams just get fewer frames to drop
+        return CONTROL_ERR_UNKNOWN;
+    }
+    uint32_t fps = msg->value > 0 ? (uint32_t) msg->value : 0;
+    if (fps == 0 || fps > video->fps) {
+        fps = video->fps;
+    }
+    set_fps(fps);
+    msg->value = hal_get_isp_dynamic_fps();
+    return CONTROL_OK;
+}
+
+static uint8_t set_isp_control(struct control_msg *msg) {
+    struct rts_video_control ctrl;
+    if (isp_ctrl_get(msg->id, &ctrl)) {
+        return CONTROL_ERR_UNKNOWN;
+    }
+    // Unlike streamer.ini, a bad value is refused rather than replaced by the default
+    if (!isp_ctrl_in_range(&ctrl, msg->value)) {
+        msg->value = ctrl.current_value;
+        return CONTROL_ERR_RANGE;
+    }
+    uint8_t ok = isp_ctrl_set(msg->id, msg->value);
+    if (isp_ctrl_get(msg->id, &ctrl) == 0) {
+        msg->value = ctrl.current_value;
+    }
+    return ok ? CONTROL_OK : CONTROL_ERR_FAILED;
+}
+
+// gop is set to the value the encoder ended up with
+static uint8_t set_h264_gop(int h264_ch, int32_t *gop) {
+    struct rts_video_h264_ctrl *h264_ctl = NULL;
+    if (hal_query_h264_ctrl(h264_ch, &h264_ctl) || h264_ctl == NULL) {
+        return RTS_FALSE;
+    }
+    hal_get_h264_ctrl(h264_ctl);
+    h264_ctl->gop = *gop;
+    int ret = hal_set_h264_ctrl(h264_ctl);
+    hal_get_h264_ctrl(h264_ctl);
+    *gop = h264_ctl->gop;
+    hal_release_h264_ctrl(h264_ctl);
+    if (ret) {
+        return RTS_FALSE;
+    }
+    zlog_info(c, "Set the GOP of encoder channel %d to %d frames", h264_ch, *gop);
+    return RTS_TRUE;
+}
+
+static uint8_t set_gop(int h264_ch, struct control_msg *msg) {
+    if (msg->value < 1) {
+        return CONTROL_ERR_RANGE;
+    }
+    return set_h264_gop(h264_ch, &msg->value) ? CONTROL_OK : CONTROL_ERR_FAILED;
+}
+
+static uint8_t set_roi(int h264_ch, const video_stream_settings *video, struct control_msg *msg) {
+    struct rts_video_roi_attr *attr = NULL;
+    if (hal_query_h264_roi(h264_ch, &attr) || attr == NULL) {
+        return CONTROL_ERR_FAILED;
+    }
+    uint8_t status = CONTROL_OK;
+    uint8_t enable = msg->rect[2] > msg->rect[0] && msg->rect[3] > msg->rect[1];
+    if (msg->id >= (uint32_t) attr->count) {
+        status = CONTROL_ERR_UNKNOWN;
+    } else {
+        struct rts_video_roi_ctrl *roi = &attr->roi[msg->id];
+        uint8_t in_range = msg->value >= roi->min && msg->value <= roi->max &&
+                           (roi->step <= 0 || (msg->value - roi->min) % roi->step == 0);
+        if (enable && (!in_range || msg->rect[2] > video->width || msg->rect[3] > video->height)) {
+            status = CONTROL_ERR_RANGE;
+        } else {
+            roi->enable = enable;
+            if (enable) {
+                roi->area.left = msg->rect[0];
+                roi->area.top = msg->rect[1];
+                roi->area.right = msg->rect[2];
+                roi->area.bottom = msg->rect[3];
+                roi->value = msg->value;
+            }
+            if (hal_set_h264_roi(attr)) {
+                status = CONTROL_ERR_FAILED;
+            } else {
+                zlog_info(c, "ROI %u of encoder channel %d %s", msg->id, h264_ch, enable ? "set" : "disabled");
+            }
+        }
+    }
+    hal_release_h264_roi(attr);
+    return status;
+}
+
+// Applies a request from the control channel, and answers it when the sender is waiting for the outcome
+static void handle_control(int control, struct control_msg *msg, const control_peer *peer, const handlers *h,
+                           const streamer_settings *config, video_output *outputs) {
+    uint8_t status;
+    if (msg->stream >= VIDEO_STREAMS || !outputs[msg->stream].ring) {
+        status = CONTROL_ERR_UNKNOWN;
+    } else if (msg->cmd == CONTROL_CMD_KEY_FRAME) {
+        outputs[msg->stream].key_frame_pending = RTS_TRUE;
+        status = CONTROL_OK;
+    } else if (msg->cmd == CONTROL_CMD_BITRATE || msg->cmd == CONTROL_CMD_FPS) {
+        status = handle_rate_control(msg, h, config);
+    } else if (msg->cmd == CONTROL_CMD_ISP) {
+        status = set_isp_control(msg);
+    } else if (msg->cmd == CONTROL_CMD_GOP) {
+        status = set_gop(h->video[msg->stream].h264_enc, msg);
+    } else if (msg->cmd == CONTROL_CMD_ROI) {
+        status = set_roi(h->video[msg->stream].h264_enc, &config->video[msg->stream], msg);
+    } else {
+        status = CONTROL_ERR_UNKNOWN;
+    }
+    control_reply(control, peer, msg, status);
+}
+
+// Hands every frame the encoder has ready to the writer thread, returns how many were queued.
+// The encoder is drained even when the writer stalls, frames that do not fit are dropped.
+static uint32_t capture_frames(int chn, int index, video_output *out) {
+    struct rts_av_buffer *vid_buffer = NULL;
+    uint32_t queued = 0;
+    while (hal_recv(chn, &vid_buffer) == 0) {
+        if (!vid_buffer) {
+            continue;
+        }
+        __atomic_fetch_add(&counters[index].frames_encoded, 1, __ATOMIC_RELAXED);
+        uint8_t key = (vid_buffer->flags & RTSTREAM_PKT_FLAG_KEY) != 0;
+        if (key) {
+            // A natural keyframe answers any request made before it
+            out->key_frame_pending = RTS_FALSE;
+            out->last_key_frame = now_ms();
+            out->resync = RTS_FALSE;
+        }
+        // Frames after a gap would reference ones the readers never got
+        if (out->resync || !frame_queue_push(&out->queue, vid_buffer, now_us())) {
+            if (!out->resync) {
+                zlog_warn(c, "Writer is falling behind on stream %d, skipping to the next keyframe", index);
+                out->resync = RTS_TRUE;
+                out->key_frame_pending = RTS_TRUE;
+            }
+            out->frames_skipped++;
+            __atomic_fetch_add(&counters[index].frames_dropped, 1, __ATOMIC_RELAXED);
+            hal_put_buffer(vid_buffer);
+        } else {
+            queued++;
+        }
+        vid_buffer = NULL;
+    }
+    return queued;
+}
+
+static void write_frame(const frame_writer *w, int index, struct rts_av_buffer *vid_buffer, uint64_t recv_time) {
+    video_output *out = &w->outputs[index];
+    uint32_t flags = (vid_buffer->flags & RTSTREAM_PKT_FLAG_KEY) ? FRAME_RING_FLAG_KEY : 0;
+    if (!frame_ring_write(out->ring, vid_buffer->vm_addr, vid_buffer->bytesused, flags, vid_buffer->timestamp, recv_time)) {
+        out->frames_dropped++;
+        __atomic_fetch_add(&counters[index].frames_dropped, 1, __ATOMIC_RELAXED);
+        zlog_error(c, "Dropped a %u byte frame that does not fit in the video ring (%u dropped)", vid_buffer->bytesused, out->frames_dropped);
+        hal_put_buffer(vid_buffer);
+        return;
+    }
+    __atomic_fetch_add(&counters[index].bytes_written, vid_buffer->bytesused, __ATOMIC_RELAXED);
+    if (w->latency_report) {
+        // recv_time is on our clock, the encoder's timestamp need not be
+        uint64_t now = now_us();
+        if (now >= recv_time) {
+            histogram_add(&out->latency, now - recv_time);
+        }
+    }
+    // Release the video buffer
+    hal_put_buffer(vid_buffer);
+}
+
+// Moves queued frames into the rings, so a slow write never holds up the encoder
+static void *writer_thread(void *arg) {
+    frame_writer *w = (frame_writer *) arg;
+    while (__atomic_load_n(&w->running, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = {.fd = w->event, .events = POLLIN};
+        if (poll(&pfd, 1, FRAME_WAIT_TIMEOUT_MS) > 0) {
+            uint64_t events;
+            if (read(w->event, &events, sizeof(events)) < 0) {
+                zlog_error(c, "Failed to read the writer event");
+            }
+        }
+        for (int i = 0; i < VIDEO_STREAMS; i++) {
+            video_output *out = &w->outputs[i];
+            struct rts_av_buffer *vid_buffer;
+            uint64_t recv_time;
+            while (out->ring && (vid_buffer = frame_queue_pop(&out->queue, &recv_time))) {
+                write_frame(w, i, vid_buffer, recv_time);
+            }
+        }
+        if (w->latency_report && now_ms() - w->last_report >= (uint64_t) w->latency_report * 1000) {
+            for (int i = 0; i < VIDEO_STREAMS; i++) {
+                if (w->outputs[i].ring) {
+                    char title[48];
+                    snprintf(title, sizeof(title), "Stream %d receive to ring latency", i);
+                    histogram_log(&w->outputs[i].latency, c, title);
+                    histogram_reset(&w->outputs[i].latency);
+                }
+            }
+            w->last_report = now_ms();
+        }
+    }
+    return NULL;
+}
+
+static uint8_t start_writer(frame_writer *w, pthread_t *thread) {
+    w->event = eventfd(0, EFD_CLOEXEC);
+    w->running = RTS_TRUE;
+    if (w->event < 0) {
+        return RTS_FALSE;
+    }
+    if (pthread_create(thread, NULL, writer_thread, w)) {
+        close(w->event);
+        w->event = -1;
+        return RTS_FALSE;
+    }
+    return RTS_TRUE;
+}
+
+// Stops the writer and writes the frames it did not get to, so no encoder
+// buffer is still held once it returns
+static void stop_writer(frame_writer *w, pthread_t thread) {
+    const uint64_t one = 1;
+    __atomic_store_n(&w->running, RTS_FALSE, __ATOMIC_RELEASE);
+    if (write(w->event, &one, sizeof(one)) < 0) {
+        zlog_error(c, "Failed to wake the writer thread");
+    }
+    pthread_join(thread, NULL);
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        struct rts_av_buffer *vid_buffer;
+        uint64_t recv_time;
+        while ((vid_buffer = frame_queue_pop(&w->outputs[i].queue, &recv_time))) {
+            write_frame(w, i, vid_buffer, recv_time);
+        }
+    }
+    close(w->event);
+    w->event = -1;
+}
+
+// The [isp] settings applied through isp_ctrl, at startup and when they change
+static const struct {
+    uint32_t id;
+    size_t offset;
+} isp_settings[] = {
+    {RTS_VIDEO_CTRL_ID_NOISE_REDUCTION, offsetof(streamer_settings, noise_reduction)},
+    {RTS_VIDEO_CTRL_ID_LDC, offsetof(streamer_settings, ldc)},
+    {RTS_VIDEO_CTRL_ID_DETAIL_ENHANCEMENT, offsetof(streamer_settings, detail_enhancement)},
+    {RTS_VIDEO_CTRL_ID_3DNR, offsetof(streamer_settings, three_dnr)},
+    {RTS_VIDEO_CTRL_ID_MIRROR, offsetof(streamer_settings, mirror)},
+    {RTS_VIDEO_CTRL_ID_FLIP, offsetof(streamer_settings, flip)},
+    {RTS_VIDEO_CTRL_ID_IN_OUT_DOOR_MODE, offsetof(streamer_settings, in_out_door_mode)},
+    {RTS_VIDEO_CTRL_ID_DEHAZE, offsetof(streamer_settings, dehaze)},
+};
+
+static int32_t isp_setting(const streamer_settings *config, size_t offset) {
+    return *(const int32_t *) ((const char *) config + offset);
+}
+
+// Applies the [isp] settings of config that differ from running, all of them when running is NULL.
+// Unchanged ones are left alone, they may have been changed over the control channel since.
+static void apply_isp_settings(const streamer_settings *config, const streamer_settings *running) {
+    isp_ctrl_txn isp;
+    isp_ctrl_begin(&isp);
+    for (size_t i = 0; i < sizeof(isp_settings) / sizeof(isp_settings[0]); i++) {
+        int32_t value = isp_setting(config, isp_settings[i].offset);
+        if (!running || value != isp_setting(running, isp_settings[i].offset)) {
+            isp_ctrl_add(&isp, isp_settings[i].id, value);
+        }
+    }
+    if (isp.count && isp_ctrl_commit(&isp)) {
+        zlog_error(c, "Some ISP settings could not be applied");
+    }
+}
+
+static uint8_t ir_settings_changed(const streamer_settings *a, const streamer_settings *b) {
+    return a->adc_cutoff != b->adc_cutoff || a->adc_cutoff_inverted != b->adc_cutoff_inverted ||
+           a->invert_ir_cut != b->invert_ir_cut || a->ir_hysteresis != b->ir_hysteresis || a->ir_dwell != b->ir_dwell ||
+           a->ir_luma_night != b->ir_luma_night || a->ir_gain_night != b->ir_gain_night ||
+           strcmp(a->ir_strategy, b->ir_strategy) != 0;
+}
+
+// A new resolution or frame rate needs new channels, anything else is changed on the running encoder
+static uint8_t needs_rebuild(const video_stream_settings *a, const video_stream_settings *b) {
+    return a->width != b->width || a->height != b->height || a->fps != b->fps ||
+           a->isp_buf_num != b->isp_buf_num || a->waiting_limit != b->waiting_limit;
+}
+
+// Replaces the channels of a stream while the others keep running. The writer
+// is paused so no buffer of the old encoder is still in use when it goes away;
+// the ring stays, readers pick up the new SPS/PPS with the first keyframe.
+static uint8_t rebuild_video_pipeline(handlers *h, int index, const video_stream_settings *video,
+                                      const video_stream_settings *old, frame_writer *w, pthread_t *writer_tid) {
+    video_pipeline *v = &h->video[index];
+    video_output *out = &w->outputs[index];
+    stop_writer(w, *writer_tid);
+    destroy_video_pipeline(v);
+
+    uint8_t ok = create_video_pipeline(v, index, video);
+    if (!ok) {
+        zlog_error(c, "Failed to rebuild stream %d, going back to its previous settings", index);
+        destroy_video_pipeline(v);
+        if (!create_video_pipeline(v, index, old)) {
+            zlog_fatal(c, "Failed to restore stream %d", index);
+            kill_stream(h);
+        }
+        video = old;
+    }
+    // The new ISP channel starts from the defaults, none of the cached controls hold any more
+    isp_ctrl_invalidate();
+    set_c_vbr(v->h264_enc, video->max_bitrate, video->min_bitrate, &counters[index].bitrate);
+    // The new encoder starts with an IDR, nothing from the old one may follow it
+    out->resync = RTS_FALSE;
+    out->key_frame_pending = RTS_FALSE;
+    out->last_key_frame = now_ms();
+    hal_start_recv(v->h264_enc);
+    if (!start_writer(w, writer_tid)) {
+        zlog_fatal(c, "Failed to restart the writer thread");
+        kill_stream(h);
+    }
+    return ok;
+}
+
+static int load_config(streamer_settings *config);
+
+// Re-reads streamer.ini and applies whatever changed to the running pipeline
+static void reload_config(handlers *h, streamer_settings *config, frame_writer *w, pthread_t *writer_tid) {
+    streamer_settings fresh;
+    if (load_config(&fresh)) {
+        zlog_error(c, "Failed to reload %s, keeping the running settings", STREAMER_INI);
+        return;
+    }
+    zlog_info(c, "%s changed, applying the new settings", STREAMER_INI);
+
+    if (ir_settings_changed(&fresh, config)) {
+        publish_ir_config(&fresh);
+    }
+
+    uint8_t sensor_fps = RTS_FALSE;
+    uint8_t rebuilt = RTS_FALSE;
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        video_stream_settings *video = &fresh.video[i];
+        const video_stream_settings *old = &config->video[i];
+        // The rings, and the server sessions reading them, are only set up at startup
+        if (stream_enabled(video) != (w->outputs[i].ring != NULL)) {
+            zlog_warn(c, "Stream %d is %s by %s only after a restart", i, w->outputs[i].ring ? "disabled" : "enabled", STREAMER_INI);
+            *video = *old;
+            continue;
+        }
+        if (!w->outputs[i].ring) {
+            continue;
+        }
+        if (needs_rebuild(video, old)) {
+            zlog_info(c, "Rebuilding stream %d for %ux%u at %u fps", i, video->width, video->height, video->fps);
+            if (!rebuild_video_pipeline(h, i, video, old, w, writer_tid)) {
+                *video = *old;
+            }
+            sensor_fps |= i == 0;
+            rebuilt = RTS_TRUE;
+            continue;
+        }
+        if (video->max_bitrate != old->max_bitrate || video->min_bitrate != old->min_bitrate) {
+            set_c_vbr(h->video[i].h264_enc, video->max_bitrate, video->min_bitrate, &counters[i].bitrate);
+        }
+        if (video->gop != old->gop) {
+            int32_t gop = video->gop ? video->gop : video->fps * 2;
+            set_h264_gop(h->video[i].h264_enc, &gop);
+        }
+    }
+    if (sensor_fps) {
+        set_fps(fresh.video[0].fps);
+    }
+    // A rebuilt ISP channel lost every setting, not just the ones that changed
+    apply_isp_settings(&fresh, rebuilt ? NULL : config);
+    // Gray mode and IR mode are ISP settings too, left to the IR thread so it can not race a switch
+    if (rebuilt) {
+        restore_ir_mode();
     }
+    if (fresh.latency_report != config->latency_report || fresh.metrics_port != config->metrics_port) {
+        zlog_warn(c, "latency_report and metrics_port only change after a restart");
+        fresh.latency_report = config->latency_report;
+        fresh.metrics_port = config->metrics_port;
+    }
+    *config = fresh;
+}
 
-    rts_pthreadpool_add_task(h.tpool, ir_ctrl_thread, (void *)&config, NULL);
-    set_c_vbr(h.h264_enc, config.max_bitrate, config.min_bitrate);
-    set_fps(config.fps);
-    rts_av_start_recv(h.h264_enc);
+int start_stream(streamer_settings config, frame_ring **video_rings) {
+    handlers h = {
+        .ir_thread_running = RTS_FALSE,
+        .audio_chn = -1,
+        .audio_enc = -1,
+    };
+    video_output outputs[VIDEO_STREAMS];
+    memset(outputs, 0, sizeof(outputs));
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        frame_queue_init(&outputs[i].queue);
+        histogram_reset(&outputs[i].latency);
+    }
 
-    FILE *video_stream = NULL;
-    if (create_sink(&video_stream, VIDEO_SINK) == RTS_FALSE) {
-        zlog_fatal(c, "Failed to create video sink, ret %d", ret);
+    // -- VIDEO SETUP --
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        h.video[i].isp = -1;
+        h.video[i].h264_enc = -1;
+    }
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        if (!video_rings[i]) {
+            continue;
+        }
+        if (!create_video_pipeline(&h.video[i], i, &config.video[i])) {
+            kill_stream(&h);
+        }
+        outputs[i].ring = video_rings[i];
+        counters[i].enabled = RTS_TRUE;
+    }
+    apply_isp_settings(&config, NULL);
+
+    publish_ir_config(&config);
+    if (pthread_create(&h.ir_thread, NULL, ir_ctrl_thread, NULL)) {
+        zlog_fatal(c, "Failed to start IR control thread");
         kill_stream(&h);
     }
+    h.ir_thread_running = RTS_TRUE;
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        if (h.video[i].h264_enc >= 0) {
+            set_c_vbr(h.video[i].h264_enc, config.video[i].max_bitrate, config.video[i].min_bitrate, &counters[i].bitrate);
+        }
+    }
+    // The sensor runs at the main stream's rate, substreams drop frames from it
+    set_fps(config.video[0].fps);
 
-    // Try load the V4L device
-    int vfd = rts_isp_v4l2_open(isp_attr.isp_id);
-    if (vfd > 0) {
-        zlog_debug(c, "Opened the V4L2 fd %d", vfd);
-        rts_isp_v4l2_close(vfd);
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        if (h.video[i].h264_enc >= 0) {
+            hal_start_recv(h.video[i].h264_enc);
+        }
     }
+
     // Toggle IR Cut at startup (disabled as of V03 as dispatch binary does this auto)
-    change_ir_cut(1); // Always start as if it was day time
+    isp_ctrl_set(ISP_CTRL_IR_CUT, 1); // Always start as if it was day time
     zlog_info(c, "Starting imager streamer");
-    struct rts_av_buffer *vid_buffer = NULL;
+    int control = control_listen();
+    if (control < 0) {
+        zlog_error(c, "Failed to open the control socket %s, keyframe and rate requests are ignored", CONTROL_SOCKET);
+    }
+
+    int watch = config_watch_open(STREAMER_INI);
+    if (watch < 0) {
+        zlog_warn(c, "Failed to watch %s, changes need a restart", STREAMER_INI);
+    }
+
+    frame_writer writer = {
+        .outputs = outputs,
+        .latency_report = config.latency_report,
+        .last_report = now_ms(),
+    };
+    pthread_t writer_tid;
+    if (!start_writer(&writer, &writer_tid)) {
+        zlog_fatal(c, "Failed to start the writer thread");
+        kill_stream(&h);
+    }
+
     while (g_exit == RTS_FALSE) {
+        // Sleep until an encoder has a frame, the timeout only bounds how long an exit request waits
+        hal_wait_frame(FRAME_WAIT_TIMEOUT_MS);
+
+        struct control_msg msg;
+        control_peer peer;
+        while (control >= 0 && control_recv(control, &msg, &peer)) {
+            handle_control(control, &msg, &peer, &h, &config, outputs);
+        }
+        if (watch >= 0 && config_watch_changed(watch, STREAMER_INI)) {
+            reload_config(&h, &config, &writer, &writer_tid);
+        }
+
         // Handle video
-        if (rts_av_poll(h.h264_enc)) {
-            usleep(1000);
-            continue;
+        uint32_t queued = 0;
+        for (int i = 0; i < VIDEO_STREAMS; i++) {
+            video_output *out = &outputs[i];
+            if (!out->ring) {
+                continue;
+            }
+            // A burst of new clients is served by a single IDR, later ones wait for the interval to pass
+            if (out->key_frame_pending && now_ms() - out->last_key_frame >= config.key_frame_interval) {
+                if (hal_request_key_frame(h.video[i].h264_enc) == 0) {
+                    zlog_debug(c, "Requested a keyframe on stream %d", i);
+                }
+                out->key_frame_pending = RTS_FALSE;
+                out->last_key_frame = now_ms();
+            }
+            queued += capture_frames(h.video[i].h264_enc, i, out);
+        }
+        if (queued) {
+            const uint64_t one = 1;
+            if (write(writer.event, &one, sizeof(one)) < 0) {
+                zlog_error(c, "Failed to wake the writer thread");
+            }
         }
+    }
 
-        if (rts_av_recv(h.h264_enc, &vid_buffer)) {
-            usleep(1000);
-            continue;
+    stop_writer(&writer, writer_tid);
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        if (outputs[i].frames_skipped) {
+            zlog_info(c, "Stream %d skipped %u frames while the writer was behind", i, outputs[i].frames_skipped);
         }
+    }
+    config_watch_close(watch);
+    control_close(control, RTS_TRUE);
+    release_stream(&h);
+    return 0;
+}
 
-        if (vid_buffer) {
-            if (fwrite(vid_buffer->vm_addr, 1, vid_buffer->bytesused, video_stream) != vid_buffer->bytesused) {
-                zlog_error(c, "Possible SIGPIPE break from stream disconnection, skipping flush");
-            } else {
-                fflush(video_stream);
+void stream_metrics(metrics_buffer *b) {
+    static const struct {
+        const char *name;
+        const char *type;
+        size_t offset;
+    } fields[] = {
+        {"imager_frames_encoded_total", "counter", offsetof(stream_counters, frames_encoded)},
+        {"imager_frames_dropped_total", "counter", offsetof(stream_counters, frames_dropped)},
+        {"imager_ring_bytes_written_total", "counter", offsetof(stream_counters, bytes_written)},
+        {"imager_bitrate_bps", "gauge", offsetof(stream_counters, bitrate)},
+    };
+    for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++) {
+        metrics_printf(b, "# TYPE %s %s\n", fields[f].name, fields[f].type);
+        for (int i = 0; i < VIDEO_STREAMS; i++) {
+            if (!counters[i].enabled) {
+                continue;
             }
-            // Release the video buffer
-            rts_av_put_buffer(vid_buffer);
-            vid_buffer = NULL;
+            uint32_t *value = (uint32_t *) ((char *) &counters[i] + fields[f].offset);
+            metrics_printf(b, "%s{stream=\"%d\"} %u\n", fields[f].name, i, __atomic_load_n(value, __ATOMIC_RELAXED));
         }
-
-        usleep(1000); // Iterate every 1ms
     }
+    // Both stay unknown until the IR thread made its first check
+    int8_t night = __atomic_load_n(&g_ir_cut_mode, __ATOMIC_RELAXED);
+    if (night >= 0) {
+        metrics_printf(b, "# TYPE imager_ir_night gauge\nimager_ir_night %d\n", night);
+    }
+    int32_t adc = __atomic_load_n(&g_adc_value, __ATOMIC_RELAXED);
+    if (adc >= 0) {
+        metrics_printf(b, "# TYPE imager_adc_value gauge\nimager_adc_value %d\n", adc);
+    }
+}
 
-    kill_stream(&h);
+// [encoder] configures the main stream, [substream1] and [substream2] the others
+static int video_section(const char *section) {
+    if (strcmp(section, "encoder") == 0) {
+        return 0;
+    }
+    if (strncmp(section, "substream", 9) == 0 && section[9] >= '1' && section[9] < '0' + VIDEO_STREAMS && section[10] == 0) {
+        return section[9] - '0';
+    }
+    return -1;
+}
 
-    return ret;
+static void parse_video(video_stream_settings *video, const char *name, const char *value) {
+    if (strcmp(name, "min_bitrate") == 0) {
+        sscanf(value, "%u", &video->min_bitrate);
+    } else if (strcmp(name, "max_bitrate") == 0) {
+        sscanf(value, "%u", &video->max_bitrate);
+    } else if (strcmp(name, "width") == 0) {
+        sscanf(value, "%u", &video->width);
+    } else if (strcmp(name, "height") == 0) {
+        sscanf(value, "%u", &video->height);
+    } else if (strcmp(name, "fps") == 0) {
+        sscanf(value, "%u", &video->fps);
+    } else if (strcmp(name, "gop") == 0) {
+        sscanf(value, "%u", &video->gop);
+    } else if (strcmp(name, "isp_buf_num") == 0) {
+        sscanf(value, "%u", &video->isp_buf_num);
+    } else if (strcmp(name, "waiting_limit") == 0) {
+        sscanf(value, "%u", &video->waiting_limit);
+    }
 }
 
 static int parse_ini(void *user, const char *section, const char *name, const char *value) {
     streamer_settings *config = (streamer_settings *) user;
+    int video = video_section(section);
 
+    if (video >= 0) {
+        parse_video(&config->video[video], name, value);
+    }
     if (MATCH("isp", "noise_reduction")) {
         sscanf(value, "%d", &config->noise_reduction);
     } else if (MATCH("isp", "ldc")) {
@@ -415,28 +1036,146 @@ static int parse_ini(void *user, const char *section, const char *name, const ch
         sscanf(value, "%d", &config->adc_cutoff_inverted);
     } else if (MATCH("isp", "adc_cutoff")) {
         sscanf(value, "%d", &config->adc_cutoff);
-    } else if (MATCH("encoder", "min_bitrate")) {
-        sscanf(value, "%d", &config->min_bitrate);
-    } else if (MATCH("encoder", "max_bitrate")) {
-        sscanf(value, "%d", &config->max_bitrate);
-    } else if (MATCH("encoder", "width")) {
-        sscanf(value, "%d", &config->width);
-    } else if (MATCH("encoder", "height")) {
-        sscanf(value, "%d", &config->height);
-    } else if (MATCH("encoder", "fps")) {
-        sscanf(value, "%d", &config->fps);
+    } else if (MATCH("encoder", "key_frame_interval")) {
+        sscanf(value, "%u", &config->key_frame_interval);
+    } else if (MATCH("encoder", "latency_report")) {
+        sscanf(value, "%u", &config->latency_report);
+    } else if (MATCH("encoder", "metrics_port")) {
+        sscanf(value, "%hu", &config->metrics_port);
     } else if (MATCH("isp", "invert_ir_cut")) {
-        sscanf(value, "%d", &config->invert_ir_cut);
+        // %d would write a whole int into the uint8_t
+        int invert = 0;
+        sscanf(value, "%d", &invert);
+        config->invert_ir_cut = invert != 0;
     } else if (MATCH("isp", "in_out_door_mode")) {
         sscanf(value, "%d", &config->in_out_door_mode);
     } else if (MATCH("isp", "dehaze")) {
         sscanf(value, "%d", &config->dehaze);
+    } else if (MATCH("isp", "ir_hysteresis")) {
+        sscanf(value, "%d", &config->ir_hysteresis);
+    } else if (MATCH("isp", "ir_dwell")) {
+        sscanf(value, "%u", &config->ir_dwell);
+    } else if (MATCH("isp", "ir_strategy")) {
+        snprintf(config->ir_strategy, sizeof(config->ir_strategy), "%s", value);
+    } else if (MATCH("isp", "ir_luma_night")) {
+        sscanf(value, "%d", &config->ir_luma_night);
+    } else if (MATCH("isp", "ir_gain_night")) {
+        sscanf(value, "%d", &config->ir_gain_night);
     }
 
     return 1;
 }
 
 
+int stream_create_rings(const streamer_settings *config, frame_ring **video_rings) {
+    memset(video_rings, 0, VIDEO_STREAMS * sizeof(*video_rings));
+    if (!stream_enabled(&config->video[0])) {
+        zlog_fatal(c, "The main stream needs a width, height and fps in [encoder]");
+        return -1;
+    }
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        if (!stream_enabled(&config->video[i])) {
+            continue;
+        }
+        char name[64];
+        frame_ring_name(VIDEO_RING, i, name, sizeof(name));
+        video_rings[i] = frame_ring_create(name);
+        if (!video_rings[i]) {
+            zlog_fatal(c, "Failed to create video ring %s", name);
+            stream_close_rings(video_rings);
+            return -1;
+        }
+        zlog_info(c, "Created video ring at %s", name);
+    }
+    return 0;
+}
+
+void stream_close_rings(frame_ring **video_rings) {
+    for (int i = 0; i < VIDEO_STREAMS; i++) {
+        frame_ring_close(video_rings[i]);
+        video_rings[i] = NULL;
+    }
+}
+
+void stream_release(frame_ring **video_rings) {
+    stream_close_rings(video_rings);
+    hal_release();
+}
+
+// Defaults overridden by streamer.ini, into a fresh struct both at startup and on reload
+static int load_config(streamer_settings *config) {
+    memset(config, 0, sizeof(*config));
+    config->key_frame_interval = KEY_FRAME_INTERVAL_MS;
+    config->ir_hysteresis = IR_HYSTERESIS;
+    config->ir_dwell = IR_DWELL_S;
+    snprintf(config->ir_strategy, sizeof(config->ir_strategy), "%s", ir_strategy_adc.name);
+    config->ir_luma_night = IR_LUMA_NIGHT;
+    return ini_parse(STREAMER_INI, parse_ini, config) < 0 ? -1 : 0;
+}
+
+int stream_init(streamer_settings *config) {
+    c = zlog_get_category("imager");
+    zlog_info(c, "RTS Imager Streamer v%d.%d.%d started", VER_MAJOR, VER_MINOR, VER_PATCH);
+
+    if (load_config(config)) {
+        zlog_fatal(c, "Failed to load %s", STREAMER_INI);
+        return -1;
+    }
+
+    if (hal_init()) {
+        zlog_fatal(c, "Failed to initialize RTS AV");
+        return -1;
+    }
+    return 0;
+}
+
+#ifndef MERGED_STREAMER
+static void terminate() {
+    stop_stream();
+}
+
+// Answers one scrape at a time, the capture loop never waits on it
+static void *metrics_thread(void *arg) {
+    int listener = (int) (intptr_t) arg;
+    static metrics_buffer b;
+    while (g_exit == RTS_FALSE) {
+        struct pollfd pfd = {.fd = listener, .events = POLLIN};
+        if (poll(&pfd, 1, FRAME_WAIT_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        if (!metrics_read_request(client, METRICS_REQUEST_TIMEOUT_MS)) {
+            close(client);
+            continue;
+        }
+        metrics_reset(&b);
+        stream_metrics(&b);
+        metrics_process(&b);
+        metrics_respond(client, &b);
+    }
+    close(listener);
+    return NULL;
+}
+
+static void start_metrics(uint16_t port) {
+    int listener = metrics_listen(port);
+    pthread_t thread;
+    if (listener < 0) {
+        zlog_error(c, "Failed to listen for metrics on port %u", port);
+        return;
+    }
+    if (pthread_create(&thread, NULL, metrics_thread, (void *) (intptr_t) listener)) {
+        zlog_error(c, "Failed to start the metrics thread");
+        close(listener);
+        return;
+    }
+    pthread_detach(thread);
+    zlog_info(c, "Serving metrics on port %u", port);
+}
+
 int main(int argc, char *argv[]) {
     setpriority(PRIO_PROCESS, getpid(), -5);
     signal(SIGINT, terminate);
@@ -448,17 +1187,8 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    c = zlog_get_category("imager");
-    zlog_info(c, "RTS Imager Streamer v%d.%d.%d started", VER_MAJOR, VER_MINOR, VER_PATCH);
-
     streamer_settings config;
-    if (ini_parse("streamer.ini", parse_ini, &config) < 0) {
-        zlog_fatal(c, "Failed to load streamer.ini");
-        return -1;
-    }
-
-    if (rts_av_init()) {
-        zlog_fatal(c, "Failed to initialize RTS AV");
+    if (stream_init(&config)) {
         return -1;
     }
 
@@ -471,11 +1201,11 @@ int main(int argc, char *argv[]) {
     // zlog_debug(c, "  Flip: %d", config.flip);
     // zlog_debug(c, "  ADC cutoff: %d", config.adc_cutoff);
     // zlog_debug(c, "  ADC cutoff (inverted): %d", config.adc_cutoff_inverted);
-    // zlog_debug(c, "  Min bitrate: %d", config.min_bitrate);
-    // zlog_debug(c, "  Max bitrate: %d", config.max_bitrate);
-    // zlog_debug(c, "  Width: %d", config.width);
-    // zlog_debug(c, "  Height: %d", config.height);
-    // zlog_debug(c, "  FPS: %d", config.fps);
+    // zlog_debug(c, "  Min bitrate: %d", config.video[0].min_bitrate);
+    // zlog_debug(c, "  Max bitrate: %d", config.video[0].max_bitrate);
+    // zlog_debug(c, "  Width: %d", config.video[0].width);
+    // zlog_debug(c, "  Height: %d", config.video[0].height);
+    // zlog_debug(c, "  FPS: %d", config.video[0].fps);
     // zlog_debug(c, "  Invert IR Cut: %d", config.invert_ir_cut);
     // zlog_debug(c, "  In/Out Door Mode: %d", config.in_out_door_mode);
     // zlog_debug(c, "  Dehaze: %d", config.dehaze);
@@ -483,8 +1213,17 @@ int main(int argc, char *argv[]) {
     // Uncomment to get all possible ISP options printed to stdout
     // get_all_isp_options();
 
-    start_stream(config);
+    frame_ring *video_rings[VIDEO_STREAMS];
+    if (stream_create_rings(&config, video_rings)) {
+        hal_release();
+        return -1;
+    }
 
-    rts_av_release();
-    return 0;
+    if (config.metrics_port) {
+        start_metrics(config.metrics_port);
+    }
+    int ret = start_stream(config, video_rings);
+    stream_release(video_rings);
+    return ret;
 }
+#endif
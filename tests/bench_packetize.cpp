@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <BasicUsageEnvironment.hh>
+#include <frame_ring_source.h>
+#include <frame_ring_sink.h>
+#include "h264_synth.h"
+#include "test.h"
+
+// Microbenchmark of the send path: frames packetized once into descriptors
+// and gathered straight from the ring, SEND_BATCH packets per sendmmsg() like
+// FrameRingRTPSink or one sendmsg() per packet, against copying every packet
+// into a buffer before sending it like MultiFramedRTPSink.
+// The UDP packets go to a loopback socket nobody reads, which is the same
+// for all paths.
+
+#define FRAMES 3000
+#define WARMUP 100
+
+static const h264_synth video = {.pictures = FRAMES, .gop = 30, .key_size = 100000, .size = 12000};
+
+static uint8_t picture[256 * 1024];
+static char ring_name[64];
+static frame_ring* ring;
+static FrameRingReader* reader;
+static int tx = -1;
+
+struct path_stats {
+    double cpu_us;  // Thread CPU time
+    uint64_t bytes; // RTP payload bytes
+    uint64_t packets;
+    uint64_t calls; // Send syscalls
+};
+
+static uint64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static double thread_cpu_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fill_header(u_int8_t* header, uint16_t seq, Boolean last) {
+    header[0] = 0x80;
+    header[1] = (last ? 0x80 : 0) | 96;
+    header[2] = seq >> 8;
+    header[3] = seq;
+    memset(header + 4, 0, 8);
+}
+
+static int gather(struct iovec* iov, const u_int8_t* header, const RTPPayload& payload) {
+    int parts = 0;
+    iov[parts].iov_base = const_cast<u_int8_t*>(header);
+    iov[parts++].iov_len = RTP_HEADER_SIZE;
+    if (payload.fuSize) {
+        iov[parts].iov_base = const_cast<u_int8_t*>(payload.fu);
+        iov[parts++].iov_len = payload.fuSize;
+    }
+    iov[parts].iov_base = const_cast<u_int8_t*>(payload.data);
+    iov[parts++].iov_len = payload.size;
+    return parts;
+}
+
+// The FrameRingRTPSink way: headers from an arena, the payload from the ring,
+// a batch per sendmmsg() and the rest of a short batch in the next call
+static void send_batched(int fd, const PacketizedFrame& frame, uint16_t& seq, path_stats& stats) {
+    static u_int8_t headers[SEND_BATCH][RTP_HEADER_SIZE];
+    static struct iovec iov[SEND_BATCH][3];
+    static struct mmsghdr messages[SEND_BATCH];
+    size_t count = frame.packets.size();
+    for (size_t start = 0; start < count; start += SEND_BATCH) {
+        unsigned batch = std::min<size_t>(count - start, SEND_BATCH);
+        for (unsigned i = 0; i < batch; i++) {
+            fill_header(headers[i], seq++, start + i + 1 == count);
+            memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+            messages[i].msg_hdr.msg_iov = iov[i];
+            messages[i].msg_hdr.msg_iovlen = gather(iov[i], headers[i], frame.packets[start + i]);
+        }
+        for (unsigned done = 0; done < batch;) {
+            int sent = sendmmsg(fd, messages + done, batch - done, MSG_DONTWAIT);
+            stats.calls++;
+            if (sent <= 0) {
+                if (sent < 0 && errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            for (int i = 0; i < sent; i++) {
+                stats.bytes += messages[done + i].msg_len - RTP_HEADER_SIZE;
+            }
+            stats.packets += sent;
+            done += sent;
+        }
+    }
+}
+
+// One sendmsg() per packet, what FrameRingRTPSink did before batching
+static void send_gathered(int fd, const PacketizedFrame& frame, uint16_t& seq, path_stats& stats) {
+    size_t count = frame.packets.size();
+    for (size_t i = 0; i < count; i++) {
+        const RTPPayload& payload = frame.packets[i];
+        u_int8_t header[RTP_HEADER_SIZE];
+        fill_header(header, seq++, i + 1 == count);
+        struct iovec iov[3];
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = gather(iov, header, payload);
+        sendmsg(fd, &msg, MSG_DONTWAIT);
+        stats.calls++;
+        stats.packets++;
+        stats.bytes += payload.fuSize + payload.size;
+    }
+}
+
+// What the server did before: each packet copied out of the frame and sent by itself
+static void send_copied(int fd, const frame_ring_frame& frame, uint16_t& seq, path_stats& stats) {
+    u_int8_t packet[RTP_MAX_PACKET_SIZE];
+    const unsigned maxPayload = RTP_MAX_PACKET_SIZE - RTP_HEADER_SIZE;
+    for (unsigned n = 0; n < frame.nal_count; n++) {
+        const u_int8_t* nal = frame.data + frame.nals[n].offset;
+        unsigned size = frame.nals[n].size;
+        Boolean lastNal = n + 1 == frame.nal_count;
+        if (size <= maxPayload) {
+            fill_header(packet, seq++, lastNal);
+            memcpy(packet + RTP_HEADER_SIZE, nal, size);
+            send(fd, packet, RTP_HEADER_SIZE + size, MSG_DONTWAIT);
+            stats.calls++;
+            stats.packets++;
+            stats.bytes += size;
+            continue;
+        }
+        for (unsigned offset = 1; offset < size;) {
+            unsigned chunk = std::min(size - offset, maxPayload - 2);
+            Boolean end = offset + chunk == size;
+            fill_header(packet, seq++, lastNal && end);
+            packet[RTP_HEADER_SIZE] = (nal[0] & 0xe0) | 28;
+            packet[RTP_HEADER_SIZE + 1] = (offset == 1 ? 0x80 : 0) | (end ? 0x40 : 0) | (nal[0] & 0x1f);
+            memcpy(packet + RTP_HEADER_SIZE + 2, nal + offset, chunk);
+            send(fd, packet, RTP_HEADER_SIZE + 2 + chunk, MSG_DONTWAIT);
+            stats.calls++;
+            stats.packets++;
+            stats.bytes += 2 + chunk;
+            offset += chunk;
+        }
+    }
+}
+
+static void report(const char* name, const path_stats& stats, unsigned frames) {
+    fprintf(stderr, "%-8s %7.2f us/frame %7.1f MB/s of payload per CPU second %5.1f packets %4.1f syscalls per frame\n", name,
+            stats.cpu_us / frames, stats.bytes / stats.cpu_us, (double) stats.packets / frames, (double) stats.calls / frames);
+}
+
+// Writes picture n to the ring and reads it back
+static Boolean write_picture(uint32_t n, frame_ring_frame& frame) {
+    uint32_t size = h264_synth_picture(&video, n, picture);
+    uint64_t now = monotonic_us();
+    if (!frame_ring_write(ring, picture, size, 0, now, now)) {
+        return False;
+    }
+    return frame_ring_peek(ring, frame_ring_head(ring) - 1, &frame) == FRAME_RING_OK;
+}
+
+// The descriptors have to put the frame back together exactly, start codes aside
+static void test_reassembly() {
+    frame_ring_frame frame;
+    CHECK(write_picture(0, frame));
+    std::shared_ptr<const PacketizedFrame> packets = reader->packetize(frame);
+    CHECK(packets != nullptr);
+    if (packets == nullptr) {
+        return;
+    }
+    static uint8_t rebuilt[sizeof(picture)];
+    size_t size = 0;
+    unsigned payloadSize = 0;
+    for (const RTPPayload& payload : packets->packets) {
+        CHECK(RTP_HEADER_SIZE + payload.fuSize + payload.size <= RTP_MAX_PACKET_SIZE);
+        payloadSize += payload.fuSize + payload.size;
+        if (payload.fuSize == 0 || (payload.fu[1] & 0x80)) {
+            memcpy(rebuilt + size, "\0\0\0\1", 4);
+            size += 4;
+        }
+        if (payload.fuSize && (payload.fu[1] & 0x80)) {
+            rebuilt[size++] = (payload.fu[0] & 0xe0) | (payload.fu[1] & 0x1f);
+        }
+        memcpy(rebuilt + size, payload.data, payload.size);
+        size += payload.size;
+    }
+    CHECK_EQ(payloadSize, packets->payloadSize);
+    CHECK_EQ(size, frame.size);
+    CHECK(memcmp(rebuilt, frame.data, frame.size) == 0);
+    CHECK(packets->keyFrame);
+    // Asked again for the same frame, another client gets the same descriptors
+    CHECK(reader->packetize(frame) == packets);
+}
+
+static void test_send_paths() {
+    path_stats batched = {}, gathered = {}, copied = {};
+    uint16_t seq = 0;
+    for (uint32_t n = 0; n < FRAMES + WARMUP; n++) {
+        frame_ring_frame frame;
+        if (!write_picture(n % FRAMES, frame)) {
+            test_failures++;
+            return;
+        }
+        path_stats ignored = {};
+        Boolean counted = n >= WARMUP;
+
+        double start = thread_cpu_us();
+        std::shared_ptr<const PacketizedFrame> packets = reader->packetize(frame);
+        if (packets == nullptr) {
+            test_failures++;
+            return;
+        }
+        double packetized = thread_cpu_us();
+        send_batched(tx, *packets, seq, counted ? batched : ignored);
+        double first = thread_cpu_us();
+        send_gathered(tx, *packets, seq, counted ? gathered : ignored);
+        double second = thread_cpu_us();
+        send_copied(tx, frame, seq, counted ? copied : ignored);
+        double third = thread_cpu_us();
+        if (counted) {
+            // Packetizing is shared by the clients, charged to both gathering paths
+            batched.cpu_us += first - start;
+            gathered.cpu_us += second - first + packetized - start;
+            copied.cpu_us += third - second;
+        }
+    }
+    report("batched", batched, FRAMES);
+    report("gathered", gathered, FRAMES);
+    report("copied", copied, FRAMES);
+    // Same packets either way
+    CHECK_EQ(batched.packets, copied.packets);
+    CHECK_EQ(batched.bytes, copied.bytes);
+    CHECK_EQ(gathered.packets, copied.packets);
+    CHECK_EQ(gathered.bytes, copied.bytes);
+    // A call per packet without batching, about one per frame with it
+    CHECK_EQ(gathered.calls, copied.calls);
+    CHECK(batched.calls * 4 < gathered.calls);
+}
+
+int main() {
+    test_init();
+    snprintf(ring_name, sizeof(ring_name), "/bench_packetize_%d", (int) getpid());
+    ring = frame_ring_create(ring_name);
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    tx = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (ring == nullptr || rx < 0 || tx < 0 || bind(rx, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        getsockname(rx, (struct sockaddr*) &addr, &len) < 0 || connect(tx, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Failed to set up the ring and sockets\n");
+        return 1;
+    }
+
+    TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+    UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+    reader = new FrameRingReader(*env, ring_name, 0, ring);
+    RUN_TEST(test_reassembly);
+    RUN_TEST(test_send_paths);
+    delete reader;
+    env->reclaim();
+    delete scheduler;
+
+    frame_ring_close(ring);
+    shm_unlink(ring_name);
+    close(rx);
+    close(tx);
+    return test_finish();
+}
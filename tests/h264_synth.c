@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "h264_synth.h"
+
+// Plausible 1080p High profile parameter sets
+static const uint8_t sps[] = {0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84};
+static const uint8_t pps[] = {0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+static const uint8_t start_code[] = {0x00, 0x00, 0x00, 0x01};
+
+uint32_t h264_synth_picture_size(const h264_synth *synth, uint32_t n) {
+    if (n % synth->gop == 0) {
+        return 3 * sizeof(start_code) + sizeof(sps) + sizeof(pps) + synth->key_size;
+    }
+    return sizeof(start_code) + synth->size;
+}
+
+static void write_slice(uint8_t *slice, uint32_t size, uint32_t n, uint8_t key) {
+    slice[0] = key ? 0x65 : 0x41;
+    // 7 bits per byte with the top bit set, the payload never contains a start code
+    for (int i = 0; i < H264_SYNTH_COUNTER_SIZE; i++) {
+        slice[1 + i] = (uint8_t) (0x80 | ((n >> (7 * i)) & 0x7f));
+    }
+    for (uint32_t i = 1 + H264_SYNTH_COUNTER_SIZE; i < size; i++) {
+        slice[i] = (uint8_t) (0x80 | ((n + i) & 0x7f));
+    }
+}
+
+uint32_t h264_synth_counter(const uint8_t *slice) {
+    uint32_t n = 0;
+    for (int i = 0; i < H264_SYNTH_COUNTER_SIZE; i++) {
+        n |= (uint32_t) (slice[1 + i] & 0x7f) << (7 * i);
+    }
+    return n;
+}
+
+uint32_t h264_synth_picture(const h264_synth *synth, uint32_t n, uint8_t *picture) {
+    uint32_t size = 0;
+    uint8_t key = n % synth->gop == 0;
+    if (key) {
+        memcpy(picture + size, start_code, sizeof(start_code));
+        size += sizeof(start_code);
+        memcpy(picture + size, sps, sizeof(sps));
+        size += sizeof(sps);
+        memcpy(picture + size, start_code, sizeof(start_code));
+        size += sizeof(start_code);
+        memcpy(picture + size, pps, sizeof(pps));
+        size += sizeof(pps);
+    }
+    memcpy(picture + size, start_code, sizeof(start_code));
+    size += sizeof(start_code);
+    uint32_t slice_size = key ? synth->key_size : synth->size;
+    write_slice(picture + size, slice_size, n, key);
+    return size + slice_size;
+}
+
+int h264_synth_write(const char *path, const h264_synth *synth) {
+    if (synth->gop == 0 || synth->size <= H264_SYNTH_COUNTER_SIZE || synth->key_size <= H264_SYNTH_COUNTER_SIZE) {
+        return -1;
+    }
+    uint32_t max = h264_synth_picture_size(synth, 0);
+    if (h264_synth_picture_size(synth, 1) > max) {
+        max = h264_synth_picture_size(synth, 1);
+    }
+    uint8_t *picture = malloc(max);
+    FILE *f = fopen(path, "wb");
+    if (!picture || !f) {
+        free(picture);
+        if (f) {
+            fclose(f);
+        }
+        return -1;
+    }
+    int ret = 0;
+    for (uint32_t n = 0; n < synth->pictures && ret == 0; n++) {
+        uint32_t size = h264_synth_picture(synth, n, picture);
+        if (fwrite(picture, 1, size, f) != size) {
+            ret = -1;
+        }
+    }
+    if (fclose(f) != 0) {
+        ret = -1;
+    }
+    free(picture);
+    return ret;
+}
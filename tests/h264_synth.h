@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef H264_SYNTH_H
+#define H264_SYNTH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Writes an Annex B stream the simulator can play back: a keyframe (SPS, PPS
+// and an IDR slice) every gop pictures and single slice P frames in between.
+// Every slice carries its picture number right after the NAL header so a
+// receiver can tell which picture a packet belongs to. Nothing in it decodes,
+// the streamer and the server only look at the NAL headers.
+
+#define H264_SYNTH_COUNTER_SIZE 4
+
+typedef struct {
+    uint32_t pictures; // Length of the recording, the simulator loops it
+    uint32_t gop;
+    uint32_t key_size; // Size of an IDR slice including its NAL header
+    uint32_t size;     // Size of a P slice including its NAL header
+} h264_synth;
+
+// Returns 0 on success
+int h264_synth_write(const char *path, const h264_synth *synth);
+// Size of picture n in the file, start codes included
+uint32_t h264_synth_picture_size(const h264_synth *synth, uint32_t n);
+// Writes picture n as it is in the file to picture, returns its size
+uint32_t h264_synth_picture(const h264_synth *synth, uint32_t n, uint8_t *picture);
+// Picture number of a slice, the NAL header at slice[0]
+uint32_t h264_synth_counter(const uint8_t *slice);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //H264_SYNTH_H
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <rtsisp.h>
+#include <rtsavapi.h>
+#include <rtsvideo.h>
+#include <rts_io_adc.h>
+#include "rtstream_fake.h"
+
+#define FAKE_H264_CHN 1
+
+rtstream_fake fake_stream = {.fps = 20};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t encoder;
+static volatile int receiving;
+static struct rts_av_callback callback;
+static struct rts_av_buffer buffers[RTSTREAM_FAKE_BUFFERS];
+static uint8_t state[RTSTREAM_FAKE_BUFFERS]; // 0 free, 1 ready, 2 held by the caller
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Like the hardware, a frame is only produced into a free buffer
+static void *encode(void *arg) {
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (receiving) {
+        next.tv_nsec += 1000000000L / fake_stream.fps;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        struct rts_av_buffer *frame = NULL;
+        pthread_mutex_lock(&lock);
+        struct rts_av_callback cb = callback;
+        fake_stream.frames++;
+        for (int i = 0; i < RTSTREAM_FAKE_BUFFERS; i++) {
+            if (state[i] == 0) {
+                state[i] = 1;
+                frame = &buffers[i];
+                frame->timestamp = now_us();
+                break;
+            }
+        }
+        if (!frame) {
+            fake_stream.dropped++;
+        }
+        pthread_mutex_unlock(&lock);
+        if (frame && cb.func) {
+            fake_stream.callbacks++;
+            cb.func(cb.priv, NULL, frame);
+        }
+    }
+    return NULL;
+}
+
+int rts_av_init(void) {
+    return 0;
+}
+
+int rts_av_release(void) {
+    return 0;
+}
+
+int rts_av_create_isp_chn(struct rts_isp_attr *attr) {
+    return 0;
+}
+
+int rts_av_create_h264_chn(struct rts_h264_attr *attr) {
+    return FAKE_H264_CHN;
+}
+
+int rts_av_set_profile(unsigned int chnno, struct rts_av_profile *profile) {
+    return 0;
+}
+
+int rts_av_bind(unsigned int src, unsigned int dst) {
+    return 0;
+}
+
+int rts_av_unbind(unsigned int src, unsigned int dst) {
+    return 0;
+}
+
+int rts_av_enable_chn(unsigned int chnno) {
+    return 0;
+}
+
+int rts_av_disable_chn(unsigned int chnno) {
+    return 0;
+}
+
+int rts_av_destroy_chn(unsigned int chnno) {
+    return 0;
+}
+
+int rts_av_set_callback(unsigned int chnno, struct rts_av_callback *cb, int before) {
+    if (fake_stream.refuse_callbacks || chnno != FAKE_H264_CHN) {
+        return -1;
+    }
+    pthread_mutex_lock(&lock);
+    callback = *cb;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int rts_av_start_recv(unsigned int chnno) {
+    if (chnno != FAKE_H264_CHN || receiving) {
+        return chnno == FAKE_H264_CHN ? 0 : -1;
+    }
+    memset(state, 0, sizeof(state));
+    for (int i = 0; i < RTSTREAM_FAKE_BUFFERS; i++) {
+        buffers[i].index = (uint32_t) i;
+    }
+    receiving = 1;
+    if (pthread_create(&encoder, NULL, encode, NULL)) {
+        receiving = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int rts_av_stop_recv(unsigned int chnno) {
+    if (chnno == FAKE_H264_CHN && receiving) {
+        receiving = 0;
+        pthread_join(encoder, NULL);
+        callback.func = NULL;
+    }
+    return 0;
+}
+
+int rts_av_poll(unsigned int chnno) {
+    int ready = 0;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < RTSTREAM_FAKE_BUFFERS; i++) {
+        ready |= state[i] == 1;
+    }
+    pthread_mutex_unlock(&lock);
+    return ready ? 0 : -1;
+}
+
+int rts_av_recv(unsigned int chnno, struct rts_av_buffer **ppbuf) {
+    // Oldest ready frame first
+    struct rts_av_buffer *oldest = NULL;
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < RTSTREAM_FAKE_BUFFERS; i++) {
+        if (state[i] == 1 && (!oldest || buffers[i].timestamp < oldest->timestamp)) {
+            oldest = &buffers[i];
+        }
+    }
+    if (oldest) {
+        state[oldest->index] = 2;
+    }
+    pthread_mutex_unlock(&lock);
+    *ppbuf = oldest;
+    return oldest ? 0 : -1;
+}
+
+int rts_av_put_buffer(struct rts_av_buffer *buffer) {
+    pthread_mutex_lock(&lock);
+    state[buffer->index] = 0;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int rts_av_set_waiting_limit(unsigned int chnno, long limit) {
+    return 0;
+}
+
+int rts_av_get_isp_ctrl(uint32_t id, struct rts_video_control *pctrl) {
+    return -1;
+}
+
+int rts_av_set_isp_ctrl(uint32_t id, struct rts_video_control *pctrl) {
+    return -1;
+}
+
+int rts_av_query_isp_ae(struct rts_isp_ae_ctrl **ae) {
+    return -1;
+}
+
+void rts_av_release_isp_ae(struct rts_isp_ae_ctrl *ae) {
+}
+
+int rts_av_get_isp_ae(struct rts_isp_ae_ctrl *ae) {
+    return -1;
+}
+
+int rts_av_refresh_isp_ae_statis(struct rts_isp_ae_ctrl *ae) {
+    return -1;
+}
+
+int rts_av_get_isp_daynight_statis(void) {
+    return -1;
+}
+
+int rts_av_set_isp_dynamic_fps(uint8_t fps) {
+    return 0;
+}
+
+int rts_av_get_isp_dynamic_fps(void) {
+    return 0;
+}
+
+int rts_av_query_h264_ctrl(unsigned int chnno, struct rts_video_h264_ctrl **ppctrl) {
+    return -1;
+}
+
+void rts_av_release_h264_ctrl(struct rts_video_h264_ctrl *ctrl) {
+}
+
+int rts_av_set_h264_ctrl(struct rts_video_h264_ctrl *ctrl) {
+    return -1;
+}
+
+int rts_av_get_h264_ctrl(struct rts_video_h264_ctrl *ctrl) {
+    return -1;
+}
+
+int rts_av_request_h264_key_frame(unsigned int chnno) {
+    return 0;
+}
+
+int rts_av_query_h264_roi(unsigned int chnno, struct rts_video_roi_attr **attr) {
+    return -1;
+}
+
+void rts_av_release_h264_roi(struct rts_video_roi_attr *attr) {
+}
+
+int rts_av_set_h264_roi(struct rts_video_roi_attr *attr) {
+    return -1;
+}
+
+int rts_io_adc_get_value(int adc_channel) {
+    return 0;
+}
+
+int rts_isp_v4l2_open(int isp_id) {
+    return -1;
+}
+
+int rts_isp_v4l2_close(int fd) {
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTSTREAM_FAKE_H
+#define RTSTREAM_FAKE_H
+
+#include <stdint.h>
+
+// Stand-in for the rtstream, rtsisp and rtsio libraries so src/hal_rts.c
+// links on the host. One encoder channel produces empty frames at a fixed
+// rate from its own thread once receiving starts, and calls the frame
+// callback for each like rtstream's async callbacks. Everything else
+// succeeds without doing anything.
+
+#define RTSTREAM_FAKE_BUFFERS 4
+
+typedef struct {
+    uint32_t fps;              // Frame rate of the channel, set before hal_start_recv()
+    uint8_t refuse_callbacks;  // rts_av_set_callback() fails, as on firmware without async callbacks
+    uint64_t frames;           // Produced
+    uint64_t dropped;          // Produced while every buffer was held
+    uint64_t callbacks;        // Frame callbacks made
+} rtstream_fake;
+
+extern rtstream_fake fake_stream;
+
+#endif //RTSTREAM_FAKE_H
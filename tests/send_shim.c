@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include "send_shim.h"
+
+static int (*real_sendmmsg)(int, struct mmsghdr *, unsigned int, int);
+static send_shim_stats *stats;
+static unsigned long short_every;
+static unsigned long fail_every;
+
+__attribute__((constructor)) static void send_shim_init(void) {
+    real_sendmmsg = (int (*)(int, struct mmsghdr *, unsigned int, int)) dlsym(RTLD_NEXT, "sendmmsg");
+    const char *path = getenv(SEND_SHIM_STATS);
+    if (path == NULL) {
+        return;
+    }
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    void *map = mmap(NULL, sizeof(send_shim_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    stats = map;
+    const char *every = getenv(SEND_SHIM_SHORT_EVERY);
+    short_every = every ? strtoul(every, NULL, 10) : 0;
+    every = getenv(SEND_SHIM_FAIL_EVERY);
+    fail_every = every ? strtoul(every, NULL, 10) : 0;
+}
+
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    if (stats == NULL) {
+        return real_sendmmsg(sockfd, msgvec, vlen, flags);
+    }
+    uint64_t call = __atomic_add_fetch(&stats->calls, 1, __ATOMIC_RELAXED);
+    if (fail_every && call % fail_every == 0) {
+        __atomic_add_fetch(&stats->failed_calls, 1, __ATOMIC_RELAXED);
+        errno = EAGAIN;
+        return -1;
+    }
+    if (short_every && call % short_every == 0 && vlen > 1) {
+        __atomic_add_fetch(&stats->short_calls, 1, __ATOMIC_RELAXED);
+        vlen /= 2;
+    }
+    int sent = real_sendmmsg(sockfd, msgvec, vlen, flags);
+    if (sent > 0) {
+        __atomic_add_fetch(&stats->packets, (uint64_t) sent, __ATOMIC_RELAXED);
+    }
+    return sent;
+}
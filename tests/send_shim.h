@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEND_SHIM_H
+#define SEND_SHIM_H
+
+#include <stdint.h>
+
+// LD_PRELOAD library wrapping sendmmsg(). It counts the calls and packets in a
+// file the test maps as well and can make calls come up short or fail, as a
+// full socket buffer would. Configured through the environment:
+//   SEND_SHIM_STATS       file holding a send_shim_stats, required
+//   SEND_SHIM_SHORT_EVERY every nth call sends only the first half of the batch
+//   SEND_SHIM_FAIL_EVERY  every nth call fails with EAGAIN without sending
+
+#define SEND_SHIM_STATS "SEND_SHIM_STATS"
+#define SEND_SHIM_SHORT_EVERY "SEND_SHIM_SHORT_EVERY"
+#define SEND_SHIM_FAIL_EVERY "SEND_SHIM_FAIL_EVERY"
+
+typedef struct {
+    uint64_t calls;
+    uint64_t packets; // Handed to the kernel
+    uint64_t short_calls;
+    uint64_t failed_calls;
+} send_shim_stats;
+
+#endif //SEND_SHIM_H
@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "streamer_harness.h"
+
+#define STARTUP_TIMEOUT_MS 5000
+#define STOP_TIMEOUT_MS 5000
+#define RTSP_TIMEOUT_S 5
+
+static const char *const scratch_files[] = {"sim.h264", "streamer.ini", "zlog.conf"};
+
+uint64_t test_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int write_file(const char *dir, const char *name, const char *text) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return -1;
+    }
+    fputs(text, f);
+    return fclose(f);
+}
+
+// A free TCP port on loopback, for the servers the streamer opens
+static uint16_t free_port(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    uint16_t port = 0;
+    if (fd >= 0 && bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+        getsockname(fd, (struct sockaddr *) &addr, &len) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return port;
+}
+
+static int tcp_connect(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    struct timeval tv = {.tv_sec = RTSP_TIMEOUT_S};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+int streamer_start(streamer *s, const char *binary, const h264_synth *video, const char *ini) {
+    memset(s, 0, sizeof(*s));
+    s->pid = -1;
+    snprintf(s->dir, sizeof(s->dir), "/tmp/rtsp_streamer_test.XXXXXX");
+    if (!mkdtemp(s->dir)) {
+        fprintf(stderr, "Failed to create a scratch directory: %s\n", strerror(errno));
+        return -1;
+    }
+    s->rtsp_port = free_port();
+    s->metrics_port = free_port();
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/sim.h264", s->dir);
+    if (h264_synth_write(path, video) != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+    char config[2048];
+    snprintf(config, sizeof(config),
+             "[encoder]\nwidth=1920\nheight=1080\nfps=20\nmax_bitrate=1024000\nmin_bitrate=512000\n"
+             "[rtsp]\nport=%u\nname=stream\nmetrics_port=%u\ngop_cache=1\nkey_frame_on_play=0\n%s",
+             s->rtsp_port, s->metrics_port, ini ? ini : "");
+    if (write_file(s->dir, "streamer.ini", config) != 0 ||
+        write_file(s->dir, "zlog.conf", "[global]\nstrict init = true\n\n[rules]\n*.WARN          >stderr;\n") != 0) {
+        fprintf(stderr, "Failed to write the streamer configuration\n");
+        return -1;
+    }
+
+    s->pid = fork();
+    if (s->pid < 0) {
+        return -1;
+    }
+    if (s->pid == 0) {
+        // Do not outlive a test that crashed
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (chdir(s->dir) == 0) {
+            execl(binary, binary, (char *) NULL);
+        }
+        fprintf(stderr, "Failed to run %s: %s\n", binary, strerror(errno));
+        _exit(127);
+    }
+
+    for (int waited = 0; waited < STARTUP_TIMEOUT_MS; waited += 50) {
+        if (waitpid(s->pid, NULL, WNOHANG) == s->pid) {
+            fprintf(stderr, "%s exited during startup\n", binary);
+            s->pid = -1;
+            return -1;
+        }
+        int fd = tcp_connect(s->rtsp_port);
+        if (fd >= 0) {
+            close(fd);
+            return 0;
+        }
+        usleep(50 * 1000);
+    }
+    fprintf(stderr, "%s did not open port %u\n", binary, s->rtsp_port);
+    return -1;
+}
+
+void streamer_stop(streamer *s) {
+    if (s->pid > 0) {
+        kill(s->pid, SIGTERM);
+        int waited = 0;
+        while (waitpid(s->pid, NULL, WNOHANG) == 0) {
+            if (waited >= STOP_TIMEOUT_MS) {
+                fprintf(stderr, "rtsp_streamer did not stop, killing it\n");
+                kill(s->pid, SIGKILL);
+                waitpid(s->pid, NULL, 0);
+                break;
+            }
+            usleep(50 * 1000);
+            waited += 50;
+        }
+        s->pid = -1;
+    }
+    if (s->dir[0]) {
+        char path[128];
+        for (size_t i = 0; i < sizeof(scratch_files) / sizeof(scratch_files[0]); i++) {
+            snprintf(path, sizeof(path), "%s/%s", s->dir, scratch_files[i]);
+            unlink(path);
+        }
+        rmdir(s->dir);
+        s->dir[0] = 0;
+    }
+}
+
+double streamer_cpu_seconds(const streamer *s) {
+    char path[64];
+    char stat[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) s->pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    size_t len = fread(stat, 1, sizeof(stat) - 1, f);
+    fclose(f);
+    stat[len] = 0;
+    // The command name may contain spaces, the fields start after its closing parenthesis
+    const char *fields = strrchr(stat, ')');
+    unsigned long utime, stime;
+    if (!fields || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double) (utime + stime) / (double) sysconf(_SC_CLK_TCK);
+}
+
+int streamer_metric(const streamer *s, const char *name, double *value) {
+    int fd = tcp_connect(s->metrics_port);
+    if (fd < 0) {
+        return -1;
+    }
+    static const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    if (send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) < 0) {
+        close(fd);
+        return -1;
+    }
+    static char response[64 * 1024];
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(response) - 1 && (n = recv(fd, response + len, sizeof(response) - 1 - len, 0)) > 0) {
+        len += (size_t) n;
+    }
+    close(fd);
+    response[len] = 0;
+
+    size_t name_len = strlen(name);
+    for (const char *line = response; line && *line; line = strchr(line, '\n')) {
+        if (*line == '\n') {
+            line++;
+        }
+        if (strncmp(line, name, name_len) == 0 && line[name_len] == ' ') {
+            *value = strtod(line + name_len + 1, NULL);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int rtsp_connect(rtsp_client *c, uint16_t port, const char *path) {
+    memset(c, 0, sizeof(*c));
+    c->rtp = c->rtcp = -1;
+    snprintf(c->url, sizeof(c->url), "rtsp://127.0.0.1:%u/%s", port, path);
+    snprintf(c->track, sizeof(c->track), "%s", c->url);
+    c->fd = tcp_connect(port);
+    return c->fd >= 0 ? 0 : -1;
+}
+
+// Value of a header in a response, up to the end of the line or a ';'
+static int header_value(const char *response, const char *name, char *value, size_t size) {
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(response, "\r\n"); line; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, name, name_len) == 0 && line[2 + name_len] == ':') {
+            const char *start = line + 3 + name_len;
+            start += strspn(start, " ");
+            size_t len = strcspn(start, ";\r\n");
+            if (len >= size) {
+                len = size - 1;
+            }
+            memcpy(value, start, len);
+            value[len] = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int rtsp_request(rtsp_client *c, const char *method, const char *url, const char *headers, char *response, size_t size) {
+    char local[4096];
+    if (!response) {
+        response = local;
+        size = sizeof(local);
+    }
+    char request[1024];
+    char session[96] = "";
+    if (c->session[0]) {
+        snprintf(session, sizeof(session), "Session: %s\r\n", c->session);
+    }
+    int len = snprintf(request, sizeof(request), "%s %s RTSP/1.0\r\nCSeq: %u\r\nUser-Agent: streamer_harness\r\n%s%s\r\n",
+                       method, url, ++c->cseq, session, headers ? headers : "");
+    if (send(c->fd, request, (size_t) len, MSG_NOSIGNAL) != len) {
+        return -1;
+    }
+
+    // Headers, then as much body as Content-Length announces
+    size_t received = 0;
+    char *body = NULL;
+    while (!body) {
+        ssize_t n = recv(c->fd, response + received, size - 1 - received, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        received += (size_t) n;
+        response[received] = 0;
+        body = strstr(response, "\r\n\r\n");
+        if (!body && received >= size - 1) {
+            return -1;
+        }
+    }
+    body += 4;
+    char value[32];
+    size_t content = header_value(response, "Content-Length", value, sizeof(value)) == 0 ? strtoul(value, NULL, 10) : 0;
+    size_t total = (size_t) (body - response) + content;
+    if (total >= size) {
+        return -1;
+    }
+    while (received < total) {
+        ssize_t n = recv(c->fd, response + received, total - received, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        received += (size_t) n;
+    }
+    response[received] = 0;
+
+    int status;
+    if (sscanf(response, "RTSP/1.0 %d", &status) != 1) {
+        return -1;
+    }
+    return status;
+}
+
+int rtsp_describe(rtsp_client *c, char *sdp, size_t size) {
+    char response[4096];
+    int status = rtsp_request(c, "DESCRIBE", c->url, "Accept: application/sdp\r\n", response, sizeof(response));
+    if (status != 200) {
+        return status;
+    }
+    const char *body = strstr(response, "\r\n\r\n") + 4;
+    snprintf(sdp, size, "%s", body);
+
+    // The video track is set up on its own URL
+    const char *media = strstr(body, "m=video");
+    const char *control = media ? strstr(media, "a=control:") : NULL;
+    if (control) {
+        control += strlen("a=control:");
+        int len = (int) strcspn(control, "\r\n");
+        if (strncmp(control, "rtsp://", 7) == 0) {
+            snprintf(c->track, sizeof(c->track), "%.*s", len, control);
+        } else {
+            snprintf(c->track, sizeof(c->track), "%s/%.*s", c->url, len, control);
+        }
+    }
+    return status;
+}
+
+uint16_t udp_bind_pair(int *even, int *odd) {
+    static uint16_t next;
+    if (next == 0) {
+        next = (uint16_t) (30000 + (getpid() * 2) % 20000);
+    }
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        uint16_t port = next;
+        next = next >= 65000 ? 30000 : next + 2;
+        int fds[2];
+        int bound = 0;
+        for (; bound < 2; bound++) {
+            fds[bound] = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port + bound),
+                                       .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+            if (fds[bound] < 0 || bind(fds[bound], (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+                if (fds[bound] >= 0) {
+                    close(fds[bound]);
+                }
+                break;
+            }
+            // Keyframes arrive as a burst
+            int buffer = 1024 * 1024;
+            setsockopt(fds[bound], SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+        }
+        if (bound == 2) {
+            *even = fds[0];
+            *odd = fds[1];
+            return port;
+        }
+        if (bound == 1) {
+            close(fds[0]);
+        }
+    }
+    return 0;
+}
+
+int udp_join(const char *group, uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    int buffer = 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY)};
+    // Joined on the interface the route to the group goes through, the one the sender uses too
+    struct ip_mreq mreq = {.imr_interface.s_addr = htonl(INADDR_ANY)};
+    if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int rtsp_setup(rtsp_client *c, uint16_t client_port) {
+    if (client_port == 0) {
+        client_port = udp_bind_pair(&c->rtp, &c->rtcp);
+        if (client_port == 0) {
+            return -1;
+        }
+    }
+    c->client_port = client_port;
+    char transport[128];
+    snprintf(transport, sizeof(transport), "Transport: RTP/AVP;unicast;client_port=%u-%u\r\n", client_port, client_port + 1);
+    char response[2048];
+    int status = rtsp_request(c, "SETUP", c->track, transport, response, sizeof(response));
+    if (status != 200) {
+        return status;
+    }
+    header_value(response, "Session", c->session, sizeof(c->session));
+    const char *server_port = strstr(response, "server_port=");
+    if (server_port) {
+        c->server_port = (uint16_t) strtoul(server_port + strlen("server_port="), NULL, 10);
+    }
+    return status;
+}
+
+int rtsp_setup_multicast(rtsp_client *c, char *transport, size_t size) {
+    char response[2048];
+    int status = rtsp_request(c, "SETUP", c->track, "Transport: RTP/AVP;multicast\r\n", response, sizeof(response));
+    if (status != 200) {
+        return status;
+    }
+    header_value(response, "Session", c->session, sizeof(c->session));
+    // The whole header, its parameters are separated by ';' as well
+    const char *value = strstr(response, "\r\nTransport:");
+    if (value) {
+        value += strlen("\r\nTransport:");
+        value += strspn(value, " ");
+        snprintf(transport, size, "%.*s", (int) strcspn(value, "\r\n"), value);
+    } else {
+        transport[0] = 0;
+    }
+    return status;
+}
+
+int rtsp_play(rtsp_client *c) {
+    return rtsp_request(c, "PLAY", c->url, "Range: npt=0.000-\r\n", NULL, 0);
+}
+
+void rtsp_close(rtsp_client *c) {
+    if (c->fd >= 0) {
+        if (c->session[0]) {
+            rtsp_request(c, "TEARDOWN", c->url, NULL, NULL, 0);
+        }
+        close(c->fd);
+        c->fd = -1;
+    }
+    if (c->rtp >= 0) {
+        close(c->rtp);
+        c->rtp = -1;
+    }
+    if (c->rtcp >= 0) {
+        close(c->rtcp);
+        c->rtcp = -1;
+    }
+}
+
+int rtp_recv(int fd, uint8_t *buf, size_t size, int timeout_ms, rtp_packet *p) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    for (;;) {
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready <= 0) {
+            return ready;
+        }
+        ssize_t n = recv(fd, buf, size, 0);
+        if (n < 0) {
+            return -1;
+        }
+        p->arrival_us = test_now_us();
+        if (n < 12 || (buf[0] >> 6) != 2) {
+            continue;
+        }
+        size_t header = 12 + 4 * (buf[0] & 0x0f);
+        if ((buf[0] & 0x10) && (size_t) n >= header + 4) {
+            header += 4 + 4 * ((buf[header + 2] << 8) | buf[header + 3]);
+        }
+        if ((size_t) n <= header) {
+            continue;
+        }
+        p->marker = (buf[1] & 0x80) != 0;
+        p->seq = (uint16_t) ((buf[2] << 8) | buf[3]);
+        p->timestamp = ((uint32_t) buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
+        p->ssrc = ((uint32_t) buf[8] << 24) | (buf[9] << 16) | (buf[10] << 8) | buf[11];
+        p->payload = buf + header;
+        p->payload_size = (uint32_t) ((size_t) n - header);
+        return 1;
+    }
+}
+
+uint8_t rtp_nal_type(const rtp_packet *p) {
+    uint8_t type = p->payload[0] & 0x1f;
+    if (type == 28) {
+        // FU-A, the original type is in the FU header of the first fragment
+        return p->payload_size > 1 && (p->payload[1] & 0x80) ? p->payload[1] & 0x1f : 0;
+    }
+    if (type == 24) {
+        // STAP-A, the type of the first aggregated NAL
+        return p->payload_size > 3 ? p->payload[3] & 0x1f : 0;
+    }
+    return type;
+}
+
+int64_t rtp_picture(const rtp_packet *p) {
+    uint8_t type = rtp_nal_type(p);
+    if (type != 1 && type != 5) {
+        return -1;
+    }
+    // A fragment has the FU header where the NAL header was
+    const uint8_t *slice = (p->payload[0] & 0x1f) == 28 ? p->payload + 1 : p->payload;
+    if (p->payload + p->payload_size < slice + 1 + H264_SYNTH_COUNTER_SIZE) {
+        return -1;
+    }
+    return h264_synth_counter(slice);
+}
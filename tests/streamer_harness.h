@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAMER_HARNESS_H
+#define STREAMER_HARNESS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include "h264_synth.h"
+
+// Runs the simulator build of rtsp_streamer in a scratch directory and talks
+// to it like a client would: RTSP over TCP and RTP over UDP on loopback.
+
+typedef struct {
+    pid_t pid;
+    char dir[64];
+    uint16_t rtsp_port;
+    uint16_t metrics_port;
+} streamer;
+
+// Starts binary playing the synthetic recording with the settings in ini appended
+// to the defaults (sections included), returns 0 once it accepts RTSP connections
+int streamer_start(streamer *s, const char *binary, const h264_synth *video, const char *ini);
+void streamer_stop(streamer *s);
+// User and system CPU time the process used so far
+double streamer_cpu_seconds(const streamer *s);
+// Reads a sample from the metrics endpoint, the name includes its labels
+int streamer_metric(const streamer *s, const char *name, double *value);
+
+typedef struct {
+    int fd;
+    uint32_t cseq;
+    char url[128];
+    char track[192];
+    char session[64];
+    int rtp;
+    int rtcp;
+    uint16_t client_port;
+    uint16_t server_port; // RTP, RTCP is the next one
+} rtsp_client;
+
+int rtsp_connect(rtsp_client *c, uint16_t port, const char *path);
+// Sends a request on the session and returns the status code, the response is optional
+int rtsp_request(rtsp_client *c, const char *method, const char *url, const char *headers, char *response, size_t size);
+int rtsp_describe(rtsp_client *c, char *sdp, size_t size);
+// Binds an RTP/RTCP pair and sets up unicast delivery to it, or to
+// client_port and the next port when one is given
+int rtsp_setup(rtsp_client *c, uint16_t client_port);
+// Asks for the stream on its multicast group, the Transport header of the response goes to transport
+int rtsp_setup_multicast(rtsp_client *c, char *transport, size_t size);
+int rtsp_play(rtsp_client *c);
+// Tears the session down and closes every socket
+void rtsp_close(rtsp_client *c);
+
+// Binds an even/odd pair of UDP ports on loopback, returns the even port or 0
+uint16_t udp_bind_pair(int *even, int *odd);
+// A socket receiving group on port, -1 when the group can not be joined
+int udp_join(const char *group, uint16_t port);
+
+typedef struct {
+    uint16_t seq;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    uint8_t marker;
+    const uint8_t *payload;
+    uint32_t payload_size;
+    uint64_t arrival_us;
+} rtp_packet;
+
+// Returns 1 for a packet, 0 on timeout and -1 on error, the packet points into buf
+int rtp_recv(int fd, uint8_t *buf, size_t size, int timeout_ms, rtp_packet *p);
+// Type of the NAL unit the packet starts, 0 for the middle of a fragmented one
+uint8_t rtp_nal_type(const rtp_packet *p);
+// Picture number of the synthetic slice the packet starts, -1 when it does not start one
+int64_t rtp_picture(const rtp_packet *p);
+
+uint64_t test_now_us(void);
+
+#endif //STREAMER_HARNESS_H
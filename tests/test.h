@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <zlog.h>
+
+// Minimal checks for the host tests, a failed check is reported and the
+// test carries on so one run shows every failure.
+
+#define TEST_SKIPPED 77 // Exit code ctest reports as skipped (SKIP_RETURN_CODE)
+
+static int test_failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        long long _a = (long long) (a), _b = (long long) (b); \
+        if (_a != _b) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define RUN_TEST(test) \
+    do { \
+        int _before = test_failures; \
+        test(); \
+        fprintf(stderr, "%s %s\n", test_failures == _before ? "PASS" : "FAIL", #test); \
+    } while (0)
+
+// Logs at warning level and above go to stderr, see tests/zlog.conf
+static inline void test_init(void) {
+    if (zlog_init(TEST_ZLOG_CONF) < 0) {
+        fprintf(stderr, "Failed to initialize zlog from %s\n", TEST_ZLOG_CONF);
+    }
+}
+
+static inline int test_finish(void) {
+    zlog_fini();
+    return test_failures ? 1 : 0;
+}
+
+#endif //TEST_H
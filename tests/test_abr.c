@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "streamer_harness.h"
+#include "test.h"
+
+// Puts a lossy UDP proxy between the server and a client that sends RTCP
+// receiver reports, and follows the encoder bitrate the server's bitrate
+// controller picks through the metrics endpoint.
+
+#define MAX_BITRATE 1024000
+#define MIN_BITRATE 256000
+#define BITRATE_METRIC "imager_bitrate_bps{stream=\"0\"}"
+#define LOSS_METRIC "rtsp_rtcp_fraction_lost{stream=\"0\"}"
+#define REPORT_INTERVAL_US 500000
+
+static const h264_synth video = {.pictures = 200, .gop = 20, .key_size = 20000, .size = 3000};
+
+// Receiver side of RFC 3550 appendix A.3
+typedef struct {
+    uint8_t started;
+    uint32_t ssrc;
+    uint16_t max_seq;
+    uint32_t cycles;
+    uint32_t base_seq;
+    uint32_t received;
+    uint32_t expected_prior;
+    uint32_t received_prior;
+} receiver_stats;
+
+typedef struct {
+    rtsp_client rtsp;
+    int proxy;     // Where the server sends RTP
+    int rtp;       // Where the proxy forwards what it lets through
+    struct sockaddr_in rtp_addr;
+    struct sockaddr_in server_rtcp;
+    uint32_t loss_percent;
+    uint32_t random;
+    uint32_t forwarded;
+    uint32_t dropped;
+    receiver_stats stats;
+    uint64_t next_report;
+} session;
+
+static void note_packet(receiver_stats *s, const rtp_packet *p) {
+    if (!s->started) {
+        s->started = 1;
+        s->ssrc = p->ssrc;
+        s->base_seq = p->seq;
+        s->max_seq = p->seq;
+    } else if ((uint16_t) (p->seq - s->max_seq) < 0x8000) {
+        if (p->seq < s->max_seq) {
+            s->cycles += 0x10000;
+        }
+        s->max_seq = p->seq;
+    }
+    s->received++;
+}
+
+static void send_report(session *s) {
+    receiver_stats *st = &s->stats;
+    if (!st->started) {
+        return;
+    }
+    uint32_t extended_max = st->cycles + st->max_seq;
+    uint32_t expected = extended_max - st->base_seq + 1;
+    int32_t lost = (int32_t) (expected - st->received);
+    uint32_t expected_interval = expected - st->expected_prior;
+    uint32_t received_interval = st->received - st->received_prior;
+    st->expected_prior = expected;
+    st->received_prior = st->received;
+    int32_t lost_interval = (int32_t) (expected_interval - received_interval);
+    uint8_t fraction = expected_interval == 0 || lost_interval <= 0 ? 0 : (uint8_t) ((lost_interval << 8) / expected_interval);
+    if (lost < 0) {
+        lost = 0;
+    }
+
+    // RR with a single report block, no SDES: the server only looks at the block
+    uint32_t rr[8];
+    rr[0] = htonl(0x80000000 | (1 << 24) | (201 << 16) | 7);
+    rr[1] = htonl(0x52455354); // Our SSRC
+    rr[2] = htonl(st->ssrc);
+    rr[3] = htonl(((uint32_t) fraction << 24) | ((uint32_t) lost & 0xffffff));
+    rr[4] = htonl(extended_max);
+    rr[5] = 0; // Jitter
+    rr[6] = 0; // No SR received yet
+    rr[7] = 0;
+    sendto(s->rtsp.rtcp, rr, sizeof(rr), 0, (struct sockaddr *) &s->server_rtcp, sizeof(s->server_rtcp));
+}
+
+static int start_session(session *s, const streamer *st) {
+    memset(s, 0, sizeof(*s));
+    s->proxy = s->rtp = -1;
+    s->random = 12345;
+    char sdp[2048];
+    if (rtsp_connect(&s->rtsp, st->rtsp_port, "stream") != 0 || rtsp_describe(&s->rtsp, sdp, sizeof(sdp)) != 200) {
+        return -1;
+    }
+    // The server sends RTP to the proxy and RTCP straight to the client, on the next port
+    uint16_t port = udp_bind_pair(&s->proxy, &s->rtsp.rtcp);
+    s->rtp = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    s->rtp_addr.sin_family = AF_INET;
+    s->rtp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(s->rtp_addr);
+    if (port == 0 || s->rtp < 0 || bind(s->rtp, (struct sockaddr *) &s->rtp_addr, sizeof(s->rtp_addr)) < 0 ||
+        getsockname(s->rtp, (struct sockaddr *) &s->rtp_addr, &len) < 0) {
+        return -1;
+    }
+    if (rtsp_setup(&s->rtsp, port) != 200 || rtsp_play(&s->rtsp) != 200) {
+        return -1;
+    }
+    s->server_rtcp.sin_family = AF_INET;
+    s->server_rtcp.sin_port = htons(s->rtsp.server_port + 1);
+    s->server_rtcp.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    s->next_report = test_now_us() + REPORT_INTERVAL_US;
+    return 0;
+}
+
+static void close_session(session *s) {
+    rtsp_close(&s->rtsp);
+    if (s->proxy >= 0) {
+        close(s->proxy);
+    }
+    if (s->rtp >= 0) {
+        close(s->rtp);
+    }
+}
+
+// Proxies and receives for a while, reporting every REPORT_INTERVAL_US
+static void run(session *s, uint64_t us) {
+    struct pollfd pfds[2] = {{.fd = s->proxy, .events = POLLIN}, {.fd = s->rtp, .events = POLLIN}};
+    uint8_t buf[2048];
+    uint64_t end = test_now_us() + us;
+    while (test_now_us() < end) {
+        if (test_now_us() >= s->next_report) {
+            send_report(s);
+            s->next_report += REPORT_INTERVAL_US;
+        }
+        if (poll(pfds, 2, 20) <= 0) {
+            continue;
+        }
+        if (pfds[0].revents & POLLIN) {
+            ssize_t n = recv(s->proxy, buf, sizeof(buf), 0);
+            s->random = s->random * 1103515245 + 12345;
+            if (n > 0 && (s->random >> 16) % 100 < s->loss_percent) {
+                s->dropped++;
+            } else if (n > 0) {
+                sendto(s->rtp, buf, (size_t) n, 0, (struct sockaddr *) &s->rtp_addr, sizeof(s->rtp_addr));
+                s->forwarded++;
+            }
+        }
+        rtp_packet p;
+        if ((pfds[1].revents & POLLIN) && rtp_recv(s->rtp, buf, sizeof(buf), 0, &p) == 1) {
+            note_packet(&s->stats, &p);
+        }
+    }
+}
+
+static double bitrate(const streamer *st) {
+    double value = -1;
+    if (streamer_metric(st, BITRATE_METRIC, &value) != 0) {
+        fprintf(stderr, "No %s in the metrics\n", BITRATE_METRIC);
+    }
+    return value;
+}
+
+static const char *binary;
+
+static void test_abr(void) {
+    streamer st;
+    char ini[256];
+    snprintf(ini, sizeof(ini), "abr=1\n[encoder]\nmax_bitrate=%d\nmin_bitrate=%d\n", MAX_BITRATE, MIN_BITRATE);
+    if (streamer_start(&st, binary, &video, ini) != 0) {
+        test_failures++;
+        streamer_stop(&st);
+        return;
+    }
+    session s;
+    if (start_session(&s, &st) != 0) {
+        fprintf(stderr, "Failed to start a session\n");
+        test_failures++;
+        close_session(&s);
+        streamer_stop(&st);
+        return;
+    }
+
+    // A clean link keeps the full rate
+    run(&s, 5000000);
+    CHECK_EQ(bitrate(&st), MAX_BITRATE);
+
+    // 20% loss is well above ABR_LOSS_HIGH, the rate comes down every interval
+    s.loss_percent = 20;
+    double lowest = MAX_BITRATE;
+    for (int i = 0; i < 10; i++) {
+        run(&s, 1000000);
+        double rate = bitrate(&st);
+        if (rate >= 0 && rate < lowest) {
+            lowest = rate;
+        }
+    }
+    double loss = -1;
+    CHECK_EQ(streamer_metric(&st, LOSS_METRIC, &loss), 0);
+    fprintf(stderr, "Lossy link: %u forwarded, %u dropped, reported loss %.3f, bitrate down to %.0f\n", s.forwarded,
+            s.dropped, loss, lowest);
+    // A single report covers about 25 packets, it only has to be in the neighbourhood
+    CHECK(loss > 0.05 && loss < 0.4);
+    CHECK(lowest <= MAX_BITRATE * 0.75 * 0.75);
+    CHECK(lowest >= MIN_BITRATE);
+
+    // Once the loss is gone the rate climbs back after ABR_STABLE_INTERVALS clean reports
+    s.loss_percent = 0;
+    double recovered = lowest;
+    for (int i = 0; i < 20 && recovered <= lowest; i++) {
+        run(&s, 1000000);
+        recovered = bitrate(&st);
+    }
+    fprintf(stderr, "Clean link again: bitrate back up to %.0f\n", recovered);
+    CHECK(recovered > lowest);
+    CHECK(recovered <= MAX_BITRATE);
+
+    close_session(&s);
+    streamer_stop(&st);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <rtsp_streamer>\n", argv[0]);
+        return 1;
+    }
+    binary = argv[1];
+    test_init();
+    RUN_TEST(test_abr);
+    return test_finish();
+}
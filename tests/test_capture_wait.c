@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The capture loop's wait in src/hal_rts.c, against tests/rtstream_fake.c:
+// woken by the encoder's frame callback through the eventfd, and polling
+// every 1 ms when the callback can not be set.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <hal.h>
+#include "rtstream_fake.h"
+#include "test.h"
+
+#define FPS 50
+#define RUN_US 2000000
+#define FRAME_WAIT_TIMEOUT_MS 1000 // As in stream.c
+#define MAX_FRAMES (FPS * 3)
+
+typedef struct {
+    uint32_t wakeups;
+    uint32_t frames;
+    uint64_t latency[MAX_FRAMES]; // Encoder timestamp to hal_recv(), us
+} capture_stats;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t median(capture_stats *s) {
+    qsort(s->latency, s->frames, sizeof(s->latency[0]), compare_u64);
+    return s->frames ? s->latency[s->frames / 2] : 0;
+}
+
+// The loop of start_stream() and capture_frames(), minus the queue
+static void capture_for(int chn, uint64_t us, capture_stats *s) {
+    memset(s, 0, sizeof(*s));
+    uint64_t end = now_us() + us;
+    while (now_us() < end) {
+        hal_wait_frame(FRAME_WAIT_TIMEOUT_MS);
+        s->wakeups++;
+        struct rts_av_buffer *buffer = NULL;
+        while (hal_recv(chn, &buffer) == 0) {
+            if (s->frames < MAX_FRAMES) {
+                s->latency[s->frames++] = now_us() - buffer->timestamp;
+            }
+            hal_put_buffer(buffer);
+        }
+    }
+}
+
+static int start_encoder(void) {
+    struct rts_h264_attr attr = {0};
+    if (hal_init()) {
+        return -1;
+    }
+    int chn = hal_create_h264_chn(&attr);
+    if (chn < 0 || hal_start_recv(chn)) {
+        return -1;
+    }
+    return chn;
+}
+
+static void test_frame_event(void) {
+    fake_stream = (rtstream_fake) {.fps = FPS};
+    int chn = start_encoder();
+    CHECK(chn >= 0);
+    capture_stats s;
+    capture_for(chn, RUN_US, &s);
+    fprintf(stderr, "frame event: %u frames, %u wakeups, median latency %llu us\n", s.frames, s.wakeups,
+            (unsigned long long) median(&s));
+    CHECK(fake_stream.callbacks > 0);
+    CHECK_EQ(fake_stream.dropped, 0);
+    CHECK(s.frames >= FPS * RUN_US / 1000000 * 9 / 10);
+    // Woken once per frame, not polling
+    CHECK(s.wakeups <= s.frames + FPS / 10);
+    CHECK(median(&s) < 1000);
+
+    // With the encoder stopped the wait blocks until the timeout, once the last event is read
+    hal_stop_recv(chn);
+    hal_wait_frame(0);
+    uint64_t start = now_us();
+    hal_wait_frame(200);
+    CHECK(now_us() - start >= 190000);
+    hal_release();
+}
+
+static void test_polling_fallback(void) {
+    fake_stream = (rtstream_fake) {.fps = FPS, .refuse_callbacks = 1};
+    int chn = start_encoder();
+    CHECK(chn >= 0);
+    capture_stats s;
+    capture_for(chn, RUN_US, &s);
+    fprintf(stderr, "polling: %u frames, %u wakeups, median latency %llu us\n", s.frames, s.wakeups,
+            (unsigned long long) median(&s));
+    CHECK_EQ(fake_stream.callbacks, 0);
+    CHECK_EQ(fake_stream.dropped, 0);
+    CHECK(s.frames >= FPS * RUN_US / 1000000 * 9 / 10);
+    // Every 1 ms or so, whatever the timeout asked for
+    CHECK(s.wakeups >= RUN_US / 1000 / 4);
+    CHECK(median(&s) < 2000);
+    hal_stop_recv(chn);
+    hal_release();
+}
+
+int main(void) {
+    test_init();
+    RUN_TEST(test_frame_event);
+    RUN_TEST(test_polling_fallback);
+    return test_finish();
+}
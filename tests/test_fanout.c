@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "streamer_harness.h"
+#include "test.h"
+
+// Fans the main stream out to more and more clients: every client has to get
+// every picture in full, and the CPU the server spends per extra client is
+// reported next to what the first one costs.
+
+#define PICTURES 400
+#define CLIENTS 4
+#define WINDOW_US (5 * 1000000ULL)
+
+static const h264_synth video = {.pictures = PICTURES, .gop = 40, .key_size = 30000, .size = 4000};
+
+typedef struct {
+    rtsp_client rtsp;
+    uint32_t packets;
+    int32_t next_seq;     // -1 until the first packet
+    uint32_t seq_gaps;
+    int64_t picture;      // Picture of the last slice, -1 until the first one
+    uint32_t picture_size; // Reassembled size of its slice so far
+    uint32_t pictures;
+    uint32_t picture_gaps;
+    uint32_t bad_sizes;
+} client;
+
+static client clients[CLIENTS];
+
+static int start_client(client *c, const streamer *s) {
+    memset(c, 0, sizeof(*c));
+    c->next_seq = -1;
+    c->picture = -1;
+    char sdp[2048];
+    if (rtsp_connect(&c->rtsp, s->rtsp_port, "stream") != 0 || rtsp_describe(&c->rtsp, sdp, sizeof(sdp)) != 200 ||
+        rtsp_setup(&c->rtsp, 0) != 200 || rtsp_play(&c->rtsp) != 200) {
+        fprintf(stderr, "Failed to start a client\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void end_picture(client *c) {
+    if (c->picture < 0) {
+        return;
+    }
+    uint32_t expected = c->picture % video.gop == 0 ? video.key_size : video.size;
+    if (c->picture_size != expected) {
+        c->bad_sizes++;
+    }
+    c->pictures++;
+}
+
+static void receive(client *c, const rtp_packet *p) {
+    c->packets++;
+    if (c->next_seq >= 0 && p->seq != (uint16_t) c->next_seq) {
+        c->seq_gaps++;
+    }
+    c->next_seq = (uint16_t) (p->seq + 1);
+
+    int64_t picture = rtp_picture(p);
+    uint8_t fragment = (p->payload[0] & 0x1f) == 28;
+    if (picture >= 0) {
+        end_picture(c);
+        if (c->picture >= 0 && picture != (c->picture + 1) % PICTURES) {
+            c->picture_gaps++;
+        }
+        c->picture = picture;
+        // A fragment swaps the NAL header for the FU indicator and header
+        c->picture_size = fragment ? p->payload_size - 1 : p->payload_size;
+    } else if (fragment && rtp_nal_type(p) == 0) {
+        c->picture_size += p->payload_size - 2;
+    }
+}
+
+// Receives on the first count clients for a window, returns the CPU the streamer used meanwhile
+static double run_window(const streamer *s, int count) {
+    struct pollfd pfds[CLIENTS];
+    for (int i = 0; i < count; i++) {
+        pfds[i].fd = clients[i].rtsp.rtp;
+        pfds[i].events = POLLIN;
+    }
+    uint8_t buf[2048];
+    double cpu = streamer_cpu_seconds(s);
+    uint64_t end = test_now_us() + WINDOW_US;
+    while (test_now_us() < end) {
+        if (count == 0) {
+            usleep(100 * 1000);
+            continue;
+        }
+        if (poll(pfds, (nfds_t) count, 100) <= 0) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            rtp_packet p;
+            if ((pfds[i].revents & POLLIN) && rtp_recv(pfds[i].fd, buf, sizeof(buf), 0, &p) == 1) {
+                receive(&clients[i], &p);
+            }
+        }
+    }
+    return streamer_cpu_seconds(s) - cpu;
+}
+
+static const char *binary;
+
+static void test_fanout(void) {
+    streamer s;
+    if (streamer_start(&s, binary, &video, "gop_cache=1\n") != 0) {
+        test_failures++;
+        streamer_stop(&s);
+        return;
+    }
+    usleep(1000 * 1000);
+
+    double idle = run_window(&s, 0);
+    CHECK_EQ(start_client(&clients[0], &s), 0);
+    double one = run_window(&s, 1);
+    for (int i = 1; i < CLIENTS; i++) {
+        CHECK_EQ(start_client(&clients[i], &s), 0);
+    }
+    // Only count from here, the new clients started with a burst of cached frames
+    run_window(&s, CLIENTS);
+    for (int i = 0; i < CLIENTS; i++) {
+        clients[i].pictures = clients[i].seq_gaps = clients[i].picture_gaps = clients[i].bad_sizes = 0;
+    }
+    double all = run_window(&s, CLIENTS);
+
+    double first = one - idle;
+    double extra = (all - one) / (CLIENTS - 1);
+    double window = (double) WINDOW_US / 1e6;
+    fprintf(stderr, "CPU: %.1f%% idle, %.1f%% for the first client, %.1f%% per extra client\n",
+            100 * idle / window, 100 * first / window, 100 * extra / window);
+
+    uint32_t expected = (uint32_t) (WINDOW_US * 20 / 1000000);
+    for (int i = 0; i < CLIENTS; i++) {
+        client *c = &clients[i];
+        fprintf(stderr, "Client %d: %u packets, %u pictures, %u sequence gaps, %u missing pictures, %u incomplete\n", i,
+                c->packets, c->pictures, c->seq_gaps, c->picture_gaps, c->bad_sizes);
+        CHECK_EQ(c->seq_gaps, 0);
+        CHECK_EQ(c->picture_gaps, 0);
+        CHECK_EQ(c->bad_sizes, 0);
+        // 20 fps over the last window, give or take the pictures around its edges
+        CHECK(c->pictures + 2 >= expected && c->pictures <= expected + 2);
+        rtsp_close(&c->rtsp);
+    }
+    // Packetizing is shared, an extra client costs at most what the first one does (plus tick noise)
+    CHECK(extra <= 1.5 * first + 0.05);
+    streamer_stop(&s);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <rtsp_streamer>\n", argv[0]);
+        return 1;
+    }
+    binary = argv[1];
+    test_init();
+    RUN_TEST(test_fanout);
+    return test_finish();
+}
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <frame_ring.h>
+#include "test.h"
+
+static char ring_name[64];
+static frame_ring *writer;
+static frame_ring *reader;
+static uint8_t frame[FRAME_RING_DATA_SIZE / 2];
+
+struct nal_spec {
+    uint8_t type;
+    uint32_t size; // Including the NAL header
+    uint8_t long_start; // 4 byte start code
+};
+
+// Builds an Annex B frame, the payload bytes never form a start code
+static uint32_t build_frame(const struct nal_spec *nals, int count, uint8_t fill) {
+    uint32_t size = 0;
+    for (int i = 0; i < count; i++) {
+        if (nals[i].long_start) {
+            frame[size++] = 0;
+        }
+        frame[size++] = 0;
+        frame[size++] = 0;
+        frame[size++] = 1;
+        frame[size++] = (uint8_t) (0x60 | nals[i].type);
+        for (uint32_t j = 1; j < nals[i].size; j++) {
+            frame[size++] = (uint8_t) (0x80 | ((fill + j) & 0x7f));
+        }
+    }
+    return size;
+}
+
+static void setup(void) {
+    snprintf(ring_name, sizeof(ring_name), "/test_frame_ring_%d", (int) getpid());
+    shm_unlink(ring_name);
+    writer = frame_ring_create(ring_name);
+    reader = frame_ring_open(ring_name);
+}
+
+static void teardown(void) {
+    frame_ring_close(reader);
+    frame_ring_close(writer);
+    shm_unlink(ring_name);
+}
+
+static void test_empty(void) {
+    frame_ring_frame f;
+    CHECK_EQ(frame_ring_head(reader), 0);
+    CHECK_EQ(frame_ring_last_key(reader), FRAME_RING_SEQ_INVALID);
+    CHECK_EQ(frame_ring_peek(reader, 0, &f), FRAME_RING_EMPTY);
+}
+
+static void test_rejects_bad_sizes(void) {
+    uint32_t head = frame_ring_head(reader);
+    CHECK(!frame_ring_write(writer, frame, 0, 0, 0, 0));
+    CHECK(!frame_ring_write(writer, frame, FRAME_RING_DATA_SIZE / 2 + 1, 0, 0, 0));
+    CHECK_EQ(frame_ring_head(reader), head);
+}
+
+static void test_key_frame(void) {
+    const struct nal_spec nals[] = {{7, 10, 1}, {8, 4, 1}, {6, 20, 0}, {5, 5000, 1}};
+    uint32_t size = build_frame(nals, 4, 1);
+    uint32_t seq = frame_ring_head(reader);
+    CHECK(frame_ring_write(writer, frame, size, 0, 1234, 5678));
+
+    frame_ring_frame f;
+    CHECK_EQ(frame_ring_peek(reader, seq, &f), FRAME_RING_OK);
+    CHECK_EQ(f.seq, seq);
+    CHECK_EQ(f.size, size);
+    CHECK_EQ(f.timestamp, 1234);
+    CHECK_EQ(f.recv_time, 5678);
+    CHECK(f.flags & FRAME_RING_FLAG_KEY);
+    CHECK_EQ(frame_ring_last_key(reader), seq);
+    CHECK(memcmp(f.data, frame, size) == 0);
+
+    // Start codes are split off, including the leading zero of a 4 byte one
+    CHECK_EQ(f.nal_count, 4);
+    uint32_t offset = 0;
+    for (int i = 0; i < 4; i++) {
+        offset += nals[i].long_start ? 4 : 3;
+        CHECK_EQ(f.nals[i].offset, offset);
+        CHECK_EQ(f.nals[i].size, nals[i].size);
+        CHECK_EQ(f.data[f.nals[i].offset] & 0x1f, nals[i].type);
+        offset += nals[i].size;
+    }
+    CHECK(frame_ring_valid(reader, &f));
+    CHECK_EQ(frame_ring_peek(reader, seq + 1, &f), FRAME_RING_EMPTY);
+}
+
+static void test_slice_ends_index(void) {
+    // Whatever follows the first slice belongs to it, start codes included
+    const struct nal_spec nals[] = {{9, 2, 1}, {1, 300, 0}, {1, 200, 0}};
+    uint32_t size = build_frame(nals, 3, 2);
+    uint32_t key = frame_ring_last_key(reader);
+    uint32_t seq = frame_ring_head(reader);
+    CHECK(frame_ring_write(writer, frame, size, 0, 0, 0));
+
+    frame_ring_frame f;
+    CHECK_EQ(frame_ring_peek(reader, seq, &f), FRAME_RING_OK);
+    CHECK(!(f.flags & FRAME_RING_FLAG_KEY));
+    CHECK_EQ(frame_ring_last_key(reader), key);
+    CHECK_EQ(f.nal_count, 2);
+    CHECK_EQ(f.nals[0].size, 2);
+    CHECK_EQ(f.nals[1].offset, 4 + 2 + 3);
+    CHECK_EQ(f.nals[1].size, size - f.nals[1].offset);
+}
+
+static void test_trailing_start_code(void) {
+    const struct nal_spec nals[] = {{7, 10, 0}, {8, 4, 0}};
+    uint32_t size = build_frame(nals, 2, 3);
+    memcpy(frame + size, "\0\0\0\1", 4);
+    size += 4;
+    uint32_t seq = frame_ring_head(reader);
+    CHECK(frame_ring_write(writer, frame, size, 0, 0, 0));
+
+    frame_ring_frame f;
+    CHECK_EQ(frame_ring_peek(reader, seq, &f), FRAME_RING_OK);
+    CHECK_EQ(f.nal_count, 2);
+    CHECK_EQ(f.nals[1].size, 4);
+}
+
+static void test_no_start_code(void) {
+    memset(frame, 0x55, 1000);
+    uint32_t seq = frame_ring_head(reader);
+    CHECK(frame_ring_write(writer, frame, 1000, 0, 0, 0));
+
+    frame_ring_frame f;
+    CHECK_EQ(frame_ring_peek(reader, seq, &f), FRAME_RING_OK);
+    CHECK_EQ(f.nal_count, 0);
+}
+
+static void test_nal_table_full(void) {
+    struct nal_spec nals[FRAME_RING_MAX_NALS + 1];
+    for (int i = 0; i < FRAME_RING_MAX_NALS; i++) {
+        nals[i] = (struct nal_spec) {6, 8, 1};
+    }
+    nals[FRAME_RING_MAX_NALS] = (struct nal_spec) {5, 1000, 1};
+
+    // One NAL short of the limit still fits the slice in the last entry
+    uint32_t size = build_frame(nals + 1, FRAME_RING_MAX_NALS, 4);
+    uint32_t seq = frame_ring_head(reader);
+    CHECK(frame_ring_write(writer, frame, size, 0, 0, 0));
+    frame_ring_frame f;
+    CHECK_EQ(frame_ring_peek(reader, seq, &f), FRAME_RING_OK);
+    CHECK_EQ(f.nal_count, FRAME_RING_MAX_NALS);
+    CHECK_EQ(f.nals[FRAME_RING_MAX_NALS - 1].size, 1000);
+    CHECK(f.flags & FRAME_RING_FLAG_KEY);
+    CHECK_EQ(frame_ring_last_key(reader), seq);
+
+    // With the table full before the slice the frame is stored without NALs
+    size = build_frame(nals, FRAME_RING_MAX_NALS + 1, 5);
+    CHECK(frame_ring_write(writer, frame, size, 0, 0, 0));
+    CHECK_EQ(frame_ring_peek(reader, seq + 1, &f), FRAME_RING_OK);
+    CHECK_EQ(f.nal_count, 0);
+    CHECK(!(f.flags & FRAME_RING_FLAG_KEY));
+    CHECK_EQ(frame_ring_last_key(reader), seq);
+}
+
+static void test_slot_overrun(void) {
+    const struct nal_spec nals[] = {{1, 100, 1}};
+    uint32_t size = build_frame(nals, 1, 6);
+    uint32_t first = frame_ring_head(reader);
+    for (int i = 0; i <= FRAME_RING_SLOTS; i++) {
+        CHECK(frame_ring_write(writer, frame, size, 0, i, 0));
+    }
+
+    // The oldest slot was reused, the one after it is still readable
+    frame_ring_frame f;
+    CHECK_EQ(frame_ring_peek(reader, first, &f), FRAME_RING_OVERRUN);
+    CHECK_EQ(frame_ring_peek(reader, first + 1, &f), FRAME_RING_OK);
+    CHECK_EQ(f.timestamp, 1);
+    CHECK_EQ(frame_ring_peek(reader, frame_ring_head(reader) - 1, &f), FRAME_RING_OK);
+    CHECK_EQ(f.timestamp, FRAME_RING_SLOTS);
+}
+
+static void test_data_overrun(void) {
+    // Frames this large lap the data area long before the slots
+    const struct nal_spec nals[] = {{5, 300 * 1024, 1}};
+    uint32_t size = build_frame(nals, 1, 7);
+    uint32_t seq = frame_ring_head(reader);
+    CHECK(frame_ring_write(writer, frame, size, 0, 0, 0));
+    frame_ring_frame f;
+    CHECK_EQ(frame_ring_peek(reader, seq, &f), FRAME_RING_OK);
+
+    // A reader in the middle of copying the frame finds out through frame_ring_valid
+    int writes = 0;
+    while (frame_ring_valid(reader, &f) && writes < 8) {
+        CHECK(frame_ring_write(writer, frame, size, 0, 0, 0));
+        writes++;
+    }
+    CHECK(!frame_ring_valid(reader, &f));
+    CHECK(writes <= 4);
+    CHECK_EQ(frame_ring_peek(reader, seq, &f), FRAME_RING_OVERRUN);
+}
+
+static void test_data_wraparound(void) {
+    // Fill up to the end of the data area so the next frame starts at offset 0
+    frame_ring_frame f;
+    for (;;) {
+        CHECK_EQ(frame_ring_peek(reader, frame_ring_head(reader) - 1, &f), FRAME_RING_OK);
+        uint32_t left = FRAME_RING_DATA_SIZE - ((f.pos + f.size) & (FRAME_RING_DATA_SIZE - 1));
+        if (left == FRAME_RING_DATA_SIZE) {
+            break;
+        }
+        uint32_t size = left > FRAME_RING_DATA_SIZE / 4 ? FRAME_RING_DATA_SIZE / 4 : left;
+        memset(frame, 0x55, size);
+        CHECK(frame_ring_write(writer, frame, size, 0, 0, 0));
+    }
+
+    // 400 KiB frames, the third one does not fit in the tail and starts over at offset 0
+    const struct nal_spec nals[] = {{5, 400 * 1024, 1}};
+    uint32_t size = build_frame(nals, 1, 8);
+    uint32_t seq = frame_ring_head(reader);
+    for (int i = 0; i < 3; i++) {
+        frame[5] = (uint8_t) (0x80 | i);
+        CHECK(frame_ring_write(writer, frame, size, 0, i, 0));
+    }
+
+    frame_ring_frame first, second, third;
+    CHECK_EQ(frame_ring_peek(reader, seq + 2, &third), FRAME_RING_OK);
+    CHECK_EQ(frame_ring_peek(reader, seq + 1, &second), FRAME_RING_OK);
+    CHECK_EQ(frame_ring_peek(reader, seq, &first), FRAME_RING_OVERRUN);
+    CHECK_EQ(third.pos & (FRAME_RING_DATA_SIZE - 1), 0);
+    CHECK_EQ(third.pos - second.pos, FRAME_RING_DATA_SIZE - size);
+    CHECK_EQ(third.data[5], 0x82);
+    CHECK(memcmp(third.data + 6, frame + 6, size - 6) == 0);
+    CHECK_EQ(second.data[5], 0x81);
+    CHECK(frame_ring_valid(reader, &second));
+    CHECK(frame_ring_valid(reader, &third));
+    CHECK_EQ(third.nals[0].size, 400 * 1024);
+}
+
+// A producer that stops cleanly removes the ring, readers move to the next one and keep their doorbell
+static void test_restart(void) {
+    frame_ring_frame f;
+    CHECK(frame_ring_doorbell(reader) >= 0);
+    CHECK(!frame_ring_closed(reader));
+    frame_ring_close(writer);
+    writer = NULL;
+    CHECK(frame_ring_closed(reader));
+    CHECK(frame_ring_open(ring_name) == NULL);
+    // The reader's mapping outlives the name
+    CHECK_EQ(frame_ring_peek(reader, frame_ring_head(reader) - 1, &f), FRAME_RING_OK);
+
+    writer = frame_ring_create(ring_name);
+    frame_ring *next = writer ? frame_ring_reopen(reader) : NULL;
+    CHECK(next != NULL);
+    if (!next) {
+        return;
+    }
+    CHECK(!frame_ring_closed(next));
+    CHECK_EQ(frame_ring_head(next), 0);
+    const struct nal_spec nals[] = {{5, 100, 1}};
+    uint32_t size = build_frame(nals, 1, 9);
+    CHECK(frame_ring_write(writer, frame, size, 0, 0, 0));
+    uint32_t seq = FRAME_RING_SEQ_INVALID;
+    CHECK_EQ(recv(frame_ring_doorbell(next), &seq, sizeof(seq), 0), sizeof(seq));
+    CHECK_EQ(seq, 0);
+    // Only unmaps the old ring, the doorbell went to the new one
+    frame_ring_close(reader);
+    reader = next;
+    CHECK_EQ(frame_ring_peek(reader, 0, &f), FRAME_RING_OK);
+    CHECK_EQ(f.size, size);
+}
+
+int main(void) {
+    test_init();
+    setup();
+    if (!writer || !reader) {
+        fprintf(stderr, "Failed to create the ring %s\n", ring_name);
+        teardown();
+        return 1;
+    }
+    RUN_TEST(test_empty);
+    RUN_TEST(test_rejects_bad_sizes);
+    RUN_TEST(test_key_frame);
+    RUN_TEST(test_slice_ends_index);
+    RUN_TEST(test_trailing_start_code);
+    RUN_TEST(test_no_start_code);
+    RUN_TEST(test_nal_table_full);
+    RUN_TEST(test_slot_overrun);
+    RUN_TEST(test_data_overrun);
+    RUN_TEST(test_data_wraparound);
+    RUN_TEST(test_restart);
+    teardown();
+    return test_finish();
+}
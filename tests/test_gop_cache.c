@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include "streamer_harness.h"
+#include "test.h"
+
+// How long a client that connects at a random point of the GOP waits for a
+// picture it can decode, with and without the GOP cache.
+
+#define FPS 20
+#define GOP (3 * FPS)
+#define TRIALS 4
+#define MAX_CACHED_WAIT 0.5 // Seconds, a fraction of the 3 s GOP
+// The streamer holds a keyframe request until a second after the last keyframe
+#define MAX_REQUESTED_WAIT 1.2
+
+static const h264_synth video = {.pictures = 10 * GOP, .gop = GOP, .key_size = 30000, .size = 3000};
+
+// Seconds from PLAY until the last packet of the first keyframe, -1 when none came
+static double time_to_first_frame(const streamer *s) {
+    rtsp_client c;
+    char sdp[2048];
+    double seconds = -1;
+    if (rtsp_connect(&c, s->rtsp_port, "stream") != 0 || rtsp_describe(&c, sdp, sizeof(sdp)) != 200 ||
+        rtsp_setup(&c, 0) != 200) {
+        fprintf(stderr, "Failed to set up a session\n");
+        rtsp_close(&c);
+        return -1;
+    }
+    uint64_t start = test_now_us();
+    if (rtsp_play(&c) != 200) {
+        rtsp_close(&c);
+        return -1;
+    }
+
+    uint8_t buf[2048];
+    rtp_packet p;
+    int packets = 0;
+    int key = 0;
+    while (test_now_us() - start < 2ULL * GOP * 1000000 / FPS) {
+        if (rtp_recv(c.rtp, buf, sizeof(buf), 100, &p) <= 0) {
+            continue;
+        }
+        // Whatever reaches the client first has to be the start of a keyframe
+        uint8_t type = rtp_nal_type(&p);
+        if (packets++ == 0) {
+            CHECK_EQ(type, 7);
+        }
+        key |= type == 5;
+        if (key && p.marker) {
+            seconds = (double) (p.arrival_us - start) / 1e6;
+            break;
+        }
+    }
+    rtsp_close(&c);
+    return seconds;
+}
+
+// Connects TRIALS times at different points of the GOP, returns the mean wait and the longest one
+static void measure(const char *binary, const char *ini, double *mean, double *max) {
+    streamer s;
+    *mean = *max = -1;
+    if (streamer_start(&s, binary, &video, ini) != 0) {
+        test_failures++;
+        streamer_stop(&s);
+        return;
+    }
+    // Let the ring fill with a whole GOP
+    usleep(2 * GOP * 1000000 / FPS);
+    double total = 0;
+    for (int i = 0; i < TRIALS; i++) {
+        double wait = time_to_first_frame(&s);
+        CHECK(wait >= 0);
+        total += wait;
+        if (wait > *max) {
+            *max = wait;
+        }
+        usleep(1200 * 1000);
+    }
+    *mean = total / TRIALS;
+    streamer_stop(&s);
+}
+
+static const char *binary;
+
+static void test_gop_cache(void) {
+    double mean, max;
+    measure(binary, "gop_cache=1\nkey_frame_on_play=0\n", &mean, &max);
+    fprintf(stderr, "GOP cache: mean %.3f s, max %.3f s to the first picture\n", mean, max);
+    CHECK(max >= 0 && max < MAX_CACHED_WAIT);
+}
+
+static void test_key_frame_on_play(void) {
+    double mean, max;
+    measure(binary, "gop_cache=0\nkey_frame_on_play=1\n", &mean, &max);
+    fprintf(stderr, "Keyframe on play: mean %.3f s, max %.3f s to the first picture\n", mean, max);
+    CHECK(max >= 0 && max < MAX_REQUESTED_WAIT);
+}
+
+static void test_no_cache(void) {
+    // Waits for the next keyframe, 1.5 s on average, the same TRIALS
+    // connections all landing right before one is very unlikely
+    double mean, max;
+    measure(binary, "gop_cache=0\nkey_frame_on_play=0\n", &mean, &max);
+    fprintf(stderr, "No cache: mean %.3f s, max %.3f s to the first picture\n", mean, max);
+    CHECK(max > MAX_CACHED_WAIT);
+    CHECK(max < 1.5 * GOP / FPS);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <rtsp_streamer>\n", argv[0]);
+        return 1;
+    }
+    binary = argv[1];
+    test_init();
+    RUN_TEST(test_gop_cache);
+    RUN_TEST(test_key_frame_on_play);
+    RUN_TEST(test_no_cache);
+    return test_finish();
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <ir_ctrl.h>
+#include "test.h"
+
+// Replays light sensor traces through ir_ctrl the way the IR thread feeds it,
+// one sample every SAMPLE_MS, and checks how often and when it switches. The
+// scene follows the simulator: the ADC falls with light, a noisy reading, and
+// at night the IR LEDs light up nearby walls which brightens the reading.
+
+#define SAMPLE_MS 500
+#define ADC_DAY 50
+#define ADC_NIGHT 3297
+#define ADC_NOISE 100
+#define ADC_GLARE 20 // Headlights straight into the sensor
+#define REFLECTION 400
+#define CUTOFF 400
+#define HYSTERESIS 50
+#define DWELL_MS 10000
+#define LUMA_NIGHT 40
+// The median holds the reading back two samples, the average takes about four more to follow it
+#define FILTER_DELAY_MS 3000
+#define SEEDS 8
+#define MAX_SWITCHES 128
+
+typedef struct {
+    const char *name;
+    uint32_t duration_s;
+    double (*darkness)(double t); // 0 in daylight to 1 at night, t in seconds
+    int32_t reflection;           // ADC counts the IR LEDs take off the reading at night
+    uint8_t glare;                // Cars sweep their headlights across the sensor
+} trace;
+
+typedef struct {
+    unsigned count; // The first decision on startup included
+    uint64_t at_ms[MAX_SWITCHES];
+    int8_t mode[MAX_SWITCHES];
+} switches;
+
+// Dark within 10 minutes
+static double dusk(double t) {
+    return t < 600 ? t / 600 : 1;
+}
+
+// A street lit night, the reading stays 200 counts on the night side of the cutoff
+static double lit_night(double t) {
+    (void) t;
+    return (double) (CUTOFF + 200 - ADC_DAY) / (ADC_NIGHT - ADC_DAY);
+}
+
+// Day, night and back to day in 10 minutes like the simulator's adc_period
+static double day_night(double t) {
+    return (1 - cos(2 * M_PI * t / 600)) / 2;
+}
+
+static const trace dusk_trace = {"dusk", 900, dusk, 0, 0};
+static const trace headlights_trace = {"headlights", 600, lit_night, 0, 1};
+static const trace reflection_trace = {"reflection", 600, day_night, REFLECTION, 0};
+
+// The reading without noise at ms into the trace
+static int32_t reading(const trace *tr, uint64_t ms, int8_t mode) {
+    int32_t adc = ADC_DAY + (int32_t) (tr->darkness(ms / 1000.0) * (ADC_NIGHT - ADC_DAY));
+    return mode == 1 ? adc - tr->reflection : adc;
+}
+
+// The median and the average keep the noise within half its amplitude but lag
+// the reading by up to FILTER_DELAY_MS, so a switch at_ms has to come shortly
+// after the reading without noise was that close to a threshold between low and high
+static uint8_t switched_between(const trace *tr, uint64_t at_ms, int8_t mode, int32_t low, int32_t high) {
+    for (uint64_t ms = at_ms > FILTER_DELAY_MS ? at_ms - FILTER_DELAY_MS : 0; ms <= at_ms; ms += SAMPLE_MS) {
+        int32_t value = reading(tr, ms, mode);
+        if (value >= low - ADC_NOISE / 2 && value <= high + ADC_NOISE / 2) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint8_t switched_near(const trace *tr, uint64_t at_ms, int8_t mode, int32_t threshold) {
+    return switched_between(tr, at_ms, mode, threshold, threshold);
+}
+
+// The first time into the trace the AE runs out of gain and the image gets
+// darker than luma_night
+static uint64_t image_dark_ms(const trace *tr) {
+    for (uint64_t ms = 0; ms < tr->duration_s * 1000ULL; ms += SAMPLE_MS) {
+        if (16 * pow(100, tr->darkness(ms / 1000.0)) > 256 * 120 / LUMA_NIGHT) {
+            return ms;
+        }
+    }
+    return UINT64_MAX;
+}
+
+static uint32_t random_next(uint32_t *state) {
+    *state = *state * 1103515245 + 12345;
+    return *state >> 16;
+}
+
+static void read_scene(const trace *tr, uint64_t now_ms, int8_t mode, uint32_t *random, ir_sample *sample) {
+    double d = tr->darkness(now_ms / 1000.0);
+    int32_t noise = (int32_t) (random_next(random) % (2 * ADC_NOISE + 1)) - ADC_NOISE;
+    int32_t adc = reading(tr, now_ms, mode) + noise;
+    // A car every 30 s, its lights on the sensor for one or two samples
+    uint64_t car = now_ms % 30000;
+    if (tr->glare && car < (uint64_t) (1 + now_ms / 30000 % 2) * SAMPLE_MS) {
+        adc = ADC_GLARE;
+    }
+    sample->adc = adc < 0 ? 0 : adc;
+    if (mode == 1) {
+        // Lit by the IR LEDs whatever the time of day
+        sample->luma = 120;
+        sample->gain = 64;
+    } else {
+        // The AE makes up for light falling off 100 times until the gain runs out at 256
+        double needed = 16 * pow(100, d);
+        sample->gain = needed < 256 ? (int32_t) needed : 256;
+        sample->luma = (int32_t) (120 * sample->gain / needed);
+    }
+}
+
+static void replay(const trace *tr, const ir_strategy *strategy, uint32_t seed, switches *out) {
+    ir_ctrl_config config = {
+        .strategy = strategy,
+        .cutoff = CUTOFF,
+        .hysteresis = HYSTERESIS,
+        .dwell_ms = DWELL_MS,
+        .luma_night = LUMA_NIGHT,
+    };
+    ir_ctrl ir;
+    ir_ctrl_init(&ir, &config);
+    out->count = 0;
+    int8_t mode = -1;
+    uint32_t random = seed;
+    for (uint64_t now = 0; now < tr->duration_s * 1000ULL; now += SAMPLE_MS) {
+        ir_sample sample;
+        read_scene(tr, now, mode, &random, &sample);
+        int8_t wanted = ir_ctrl_sample(&ir, &sample, now);
+        if (wanted < 0) {
+            continue;
+        }
+        mode = wanted;
+        if (out->count < MAX_SWITCHES) {
+            out->at_ms[out->count] = now;
+            out->mode[out->count] = wanted;
+            out->count++;
+        }
+    }
+}
+
+static void print_switches(const char *name, uint32_t seed, const switches *s) {
+    fprintf(stderr, "%s, seed %u:", name, seed);
+    for (unsigned i = 0; i < s->count; i++) {
+        fprintf(stderr, " %s at %.1f s", s->mode[i] ? "night" : "day", s->at_ms[i] / 1000.0);
+    }
+    fprintf(stderr, "\n");
+}
+
+// Goes to night once, when the reading passes the cutoff and the hysteresis
+static void test_adc_dusk(void) {
+    for (uint32_t seed = 1; seed <= SEEDS; seed++) {
+        switches s;
+        replay(&dusk_trace, &ir_strategy_adc, seed, &s);
+        print_switches(dusk_trace.name, seed, &s);
+        CHECK_EQ(s.count, 2);
+        if (s.count == 2) {
+            // The first decision comes once the median window has filled
+            CHECK_EQ(s.mode[0], 0);
+            CHECK_EQ(s.at_ms[0], (IR_MEDIAN_WINDOW - 1) * SAMPLE_MS);
+            CHECK_EQ(s.mode[1], 1);
+            CHECK(switched_near(&dusk_trace, s.at_ms[1], 0, CUTOFF + HYSTERESIS));
+        }
+    }
+}
+
+// Headlights for up to a second never wake it from night, the median drops them
+static void test_adc_headlights(void) {
+    for (uint32_t seed = 1; seed <= SEEDS; seed++) {
+        switches s;
+        replay(&headlights_trace, &ir_strategy_adc, seed, &s);
+        CHECK_EQ(s.count, 1);
+        CHECK_EQ(s.mode[0], 1);
+    }
+}
+
+// The reflection it measures a settle time after going to night comes short
+// by what the dusk added to the reading meanwhile and by what the average has
+// yet to follow of the drop, and ir_ctrl takes off no more than leaves the
+// reading room to get past the day threshold. All three move the threshold up.
+static uint8_t switched_to_day(const trace *tr, uint64_t night_ms, uint64_t at_ms) {
+    int32_t drift = reading(tr, night_ms + IR_SETTLE_MS, 0) - reading(tr, night_ms, 0);
+    int32_t unsettled = (int32_t) (REFLECTION * pow(1 - IR_EMA_WEIGHT / 256.0, IR_SETTLE_MS / SAMPLE_MS - 2));
+    int32_t capped = REFLECTION > CUTOFF - 2 * HYSTERESIS ? REFLECTION - (CUTOFF - 2 * HYSTERESIS) : 0;
+    return switched_between(tr, at_ms, 0, CUTOFF - HYSTERESIS, CUTOFF - HYSTERESIS + drift + unsettled + capped);
+}
+
+// Takes the LEDs' reflection off the reading at night, so it does not flap:
+// startup, then night at dusk and day at dawn
+static void test_adc_reflection(void) {
+    const trace *tr = &reflection_trace;
+    for (uint32_t seed = 1; seed <= SEEDS; seed++) {
+        switches s;
+        replay(tr, &ir_strategy_adc, seed, &s);
+        print_switches(tr->name, seed, &s);
+        // Two switches after the startup decision
+        CHECK_EQ(s.count - 1, 2);
+        if (s.count != 3) {
+            continue;
+        }
+        CHECK_EQ(s.mode[0], 0);
+        CHECK_EQ(s.mode[1], 1);
+        CHECK(switched_near(tr, s.at_ms[1], 0, CUTOFF + HYSTERESIS));
+        CHECK_EQ(s.mode[2], 0);
+        CHECK(switched_to_day(tr, s.at_ms[1], s.at_ms[2]));
+    }
+}
+
+// Waits for the image to go dark as well before going to night
+static void test_fused_dusk(void) {
+    uint64_t dark_ms = image_dark_ms(&dusk_trace);
+    for (uint32_t seed = 1; seed <= SEEDS; seed++) {
+        switches s;
+        replay(&dusk_trace, &ir_strategy_fused, seed, &s);
+        print_switches(dusk_trace.name, seed, &s);
+        CHECK_EQ(s.count, 2);
+        if (s.count == 2) {
+            CHECK_EQ(s.mode[0], 0);
+            CHECK_EQ(s.at_ms[0], (IR_MEDIAN_WINDOW - 1) * SAMPLE_MS);
+            CHECK_EQ(s.mode[1], 1);
+            CHECK(s.at_ms[1] >= dark_ms && s.at_ms[1] <= dark_ms + FILTER_DELAY_MS);
+        }
+    }
+}
+
+// Under street lights the image is bright enough, so it stays in day
+// whatever the headlights do to the sensor
+static void test_fused_headlights(void) {
+    for (uint32_t seed = 1; seed <= SEEDS; seed++) {
+        switches s;
+        replay(&headlights_trace, &ir_strategy_fused, seed, &s);
+        CHECK_EQ(s.count, 1);
+        CHECK_EQ(s.mode[0], 0);
+    }
+}
+
+// Startup, night once the image is dark, and day once the sensor without the
+// reflection passes the day threshold
+static void test_fused_reflection(void) {
+    const trace *tr = &reflection_trace;
+    uint64_t dark_ms = image_dark_ms(tr);
+    for (uint32_t seed = 1; seed <= SEEDS; seed++) {
+        switches s;
+        replay(tr, &ir_strategy_fused, seed, &s);
+        print_switches(tr->name, seed, &s);
+        CHECK_EQ(s.count - 1, 2);
+        if (s.count != 3) {
+            continue;
+        }
+        CHECK_EQ(s.mode[0], 0);
+        CHECK_EQ(s.mode[1], 1);
+        CHECK(s.at_ms[1] >= dark_ms && s.at_ms[1] <= dark_ms + FILTER_DELAY_MS);
+        CHECK_EQ(s.mode[2], 0);
+        CHECK(switched_to_day(tr, s.at_ms[1], s.at_ms[2]));
+    }
+}
+
+int main(void) {
+    test_init();
+    RUN_TEST(test_adc_dusk);
+    RUN_TEST(test_adc_headlights);
+    RUN_TEST(test_adc_reflection);
+    RUN_TEST(test_fused_dusk);
+    RUN_TEST(test_fused_headlights);
+    RUN_TEST(test_fused_reflection);
+    return test_finish();
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "streamer_harness.h"
+#include "test.h"
+
+// Serves the main stream to a multicast group and receives it on two
+// sockets of this host, like two viewers on the LAN would.
+
+#define GROUP "239.255.42.42"
+#define RECEIVERS 2
+#define WINDOW_US (3 * 1000000ULL)
+#define MAX_PACKETS 8192
+
+static const h264_synth video = {.pictures = 200, .gop = 20, .key_size = 20000, .size = 3000};
+
+typedef struct {
+    int fd;
+    uint32_t count;
+    uint32_t ssrc;
+    uint16_t seq[MAX_PACKETS];
+    uint32_t hash[MAX_PACKETS];
+    uint32_t seq_gaps;
+    uint32_t key_frames;
+} receiver;
+
+static receiver receivers[RECEIVERS];
+
+static uint32_t fnv1a(const uint8_t *data, uint32_t size) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Whether multicast sent from this host comes back to it, it needs a route for the group
+static int multicast_loops(uint16_t port) {
+    int rx = udp_join(GROUP, port);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    int ok = 0;
+    if (rx >= 0 && tx >= 0) {
+        unsigned char ttl = 0;
+        setsockopt(tx, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+        inet_pton(AF_INET, GROUP, &addr.sin_addr);
+        struct pollfd pfd = {.fd = rx, .events = POLLIN};
+        char probe[8];
+        ok = sendto(tx, "probe", 5, 0, (struct sockaddr *) &addr, sizeof(addr)) == 5 && poll(&pfd, 1, 500) == 1 &&
+             recv(rx, probe, sizeof(probe), 0) == 5;
+    }
+    if (rx >= 0) {
+        close(rx);
+    }
+    if (tx >= 0) {
+        close(tx);
+    }
+    return ok;
+}
+
+static void receive(receiver *r, const rtp_packet *p) {
+    if (r->count > 0 && p->seq != (uint16_t) (r->seq[r->count - 1] + 1)) {
+        r->seq_gaps++;
+    }
+    if (r->count == 0) {
+        r->ssrc = p->ssrc;
+    }
+    CHECK_EQ(p->ssrc, r->ssrc);
+    if (rtp_nal_type(p) == 5) {
+        r->key_frames++;
+    }
+    if (r->count < MAX_PACKETS) {
+        r->seq[r->count] = p->seq;
+        r->hash[r->count] = fnv1a(p->payload, p->payload_size);
+        r->count++;
+    }
+}
+
+static const char *binary;
+
+static void test_multicast(void) {
+    uint16_t port = (uint16_t) (20000 + 2 * (getpid() % 4000));
+    streamer s;
+    char ini[256];
+    snprintf(ini, sizeof(ini), "multicast=%s\nmulticast_port=%u\nmulticast_ttl=0\n", GROUP, port);
+    if (streamer_start(&s, binary, &video, ini) != 0) {
+        test_failures++;
+        streamer_stop(&s);
+        return;
+    }
+    for (int i = 0; i < RECEIVERS; i++) {
+        memset(&receivers[i], 0, sizeof(receivers[i]));
+        receivers[i].fd = udp_join(GROUP, port);
+        CHECK(receivers[i].fd >= 0);
+    }
+
+    // The session only shows up once the first keyframe gave it its parameter sets
+    rtsp_client c;
+    char sdp[2048];
+    int status = -1;
+    for (int attempt = 0; attempt < 50 && status != 200; attempt++) {
+        if (rtsp_connect(&c, s.rtsp_port, "stream") == 0) {
+            status = rtsp_describe(&c, sdp, sizeof(sdp));
+        }
+        if (status != 200) {
+            rtsp_close(&c);
+            usleep(100 * 1000);
+        }
+    }
+    CHECK_EQ(status, 200);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "c=IN IP4 %s", GROUP);
+    CHECK(strstr(sdp, expected) != NULL);
+    snprintf(expected, sizeof(expected), "m=video %u RTP/AVP", port);
+    CHECK(strstr(sdp, expected) != NULL);
+
+    char transport[256];
+    CHECK_EQ(rtsp_setup_multicast(&c, transport, sizeof(transport)), 200);
+    snprintf(expected, sizeof(expected), "destination=%s", GROUP);
+    CHECK(strstr(transport, "multicast") != NULL);
+    CHECK(strstr(transport, expected) != NULL);
+    snprintf(expected, sizeof(expected), "port=%u-%u", port, port + 1);
+    CHECK(strstr(transport, expected) != NULL);
+    CHECK_EQ(rtsp_play(&c), 200);
+
+    struct pollfd pfds[RECEIVERS];
+    for (int i = 0; i < RECEIVERS; i++) {
+        pfds[i].fd = receivers[i].fd;
+        pfds[i].events = POLLIN;
+    }
+    uint8_t buf[2048];
+    uint64_t end = test_now_us() + WINDOW_US;
+    while (test_now_us() < end) {
+        if (poll(pfds, RECEIVERS, 100) <= 0) {
+            continue;
+        }
+        for (int i = 0; i < RECEIVERS; i++) {
+            rtp_packet p;
+            if ((pfds[i].revents & POLLIN) && rtp_recv(pfds[i].fd, buf, sizeof(buf), 0, &p) == 1) {
+                receive(&receivers[i], &p);
+            }
+        }
+    }
+    rtsp_close(&c);
+
+    // Both saw the same packets: one sender, one sequence, identical payloads
+    receiver *a = &receivers[0];
+    receiver *b = &receivers[1];
+    fprintf(stderr, "Received %u and %u packets, %u and %u keyframes\n", a->count, b->count, a->key_frames, b->key_frames);
+    CHECK(a->count > 100);
+    CHECK(a->key_frames >= 2 && b->key_frames >= 2);
+    CHECK_EQ(a->seq_gaps, 0);
+    CHECK_EQ(b->seq_gaps, 0);
+    CHECK_EQ(a->ssrc, b->ssrc);
+    uint32_t common = 0, different = 0;
+    for (uint32_t i = 0, j = 0; i < a->count && j < b->count;) {
+        int16_t delta = (int16_t) (a->seq[i] - b->seq[j]);
+        if (delta < 0) {
+            i++;
+        } else if (delta > 0) {
+            j++;
+        } else {
+            common++;
+            different += a->hash[i++] != b->hash[j++];
+        }
+    }
+    CHECK(common + 10 >= a->count && common + 10 >= b->count);
+    CHECK_EQ(different, 0);
+
+    for (int i = 0; i < RECEIVERS; i++) {
+        close(receivers[i].fd);
+    }
+    streamer_stop(&s);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <rtsp_streamer>\n", argv[0]);
+        return 1;
+    }
+    binary = argv[1];
+    if (!multicast_loops(19998)) {
+        fprintf(stderr, "Multicast to %s does not loop back on this host, add a route: ip route add 239.0.0.0/8 dev lo\n", GROUP);
+        return TEST_SKIPPED;
+    }
+    test_init();
+    RUN_TEST(test_multicast);
+    return test_finish();
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/sockios.h>
+#include "streamer_harness.h"
+#include "test.h"
+
+// Measures how the server spreads keyframes with and without pacing: the time
+// from the first to the last packet of every keyframe, the gaps between their
+// packets and the most bytes that arrive within any BURST_WINDOW_US. Arrival
+// times are the kernel's receive timestamps, on loopback those are the send times.
+
+#define FPS 20
+#define FRAME_INTERVAL_US (1000000 / FPS)
+#define PACING 50
+#define RUN_US (8 * 1000000ULL)
+#define WARMUP_US (2 * 1000000ULL) // The GOP cache replay at PLAY goes out back to back
+#define MAX_KEYFRAMES 64
+#define MAX_KEY_PACKETS 128
+// Bytes the sink lets out back to back, PACING_BURST in frame_ring_sink.cpp
+#define PACING_BURST (4 * 1456)
+#define BURST_WINDOW_US 2000
+#define MAX_UNPACED_SPREAD_US 5000
+
+static const h264_synth video = {.pictures = 400, .gop = FPS, .key_size = 100000, .size = 8000};
+static const char *binary;
+
+typedef struct {
+    uint64_t arrival[MAX_KEY_PACKETS]; // us
+    uint32_t size[MAX_KEY_PACKETS];    // Including the RTP header
+    unsigned packets;
+    uint32_t bytes;
+} keyframe;
+
+typedef struct {
+    keyframe frames[MAX_KEYFRAMES];
+    unsigned count;
+    uint32_t seq_gaps;
+    uint64_t max_spread;
+    uint64_t max_gap;
+    uint64_t max_window_bytes;
+    uint64_t max_window_allowed; // Token bucket limit for the frame that came closest
+} pacing_run;
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t spread(const keyframe *k) {
+    return k->arrival[k->packets - 1] - k->arrival[0];
+}
+
+static uint64_t median_spread(const pacing_run *r) {
+    uint64_t spreads[MAX_KEYFRAMES];
+    for (unsigned i = 0; i < r->count; i++) {
+        spreads[i] = spread(&r->frames[i]);
+    }
+    qsort(spreads, r->count, sizeof(spreads[0]), compare_u64);
+    return spreads[r->count / 2];
+}
+
+static void analyze(pacing_run *r, const keyframe *k, unsigned pacing) {
+    r->max_spread = spread(k) > r->max_spread ? spread(k) : r->max_spread;
+    // The bucket refills at the frame's bytes over its window and holds PACING_BURST
+    uint64_t window = (uint64_t) FRAME_INTERVAL_US * pacing / 100;
+    uint64_t allowed = pacing ? PACING_BURST + (uint64_t) k->bytes * BURST_WINDOW_US / window + 1456 : k->bytes;
+    for (unsigned first = 0, last = 0; first < k->packets; first++) {
+        uint64_t bytes = 0;
+        for (last = first; last < k->packets && k->arrival[last] - k->arrival[first] < BURST_WINDOW_US; last++) {
+            bytes += k->size[last];
+        }
+        if (first > 0 && k->arrival[first] - k->arrival[first - 1] > r->max_gap) {
+            r->max_gap = k->arrival[first] - k->arrival[first - 1];
+        }
+        // Keeps the window that came closest to its limit
+        if (bytes * r->max_window_allowed >= r->max_window_bytes * allowed) {
+            r->max_window_bytes = bytes;
+            r->max_window_allowed = allowed;
+        }
+    }
+}
+
+static int run(pacing_run *r, unsigned pacing) {
+    memset(r, 0, sizeof(*r));
+    r->max_window_allowed = 1;
+    char ini[64];
+    snprintf(ini, sizeof(ini), "pacing=%u\n", pacing);
+    streamer s;
+    rtsp_client c = {.fd = -1, .rtp = -1, .rtcp = -1};
+    char sdp[2048];
+    if (streamer_start(&s, binary, &video, ini) != 0 || rtsp_connect(&c, s.rtsp_port, "stream") != 0 ||
+        rtsp_describe(&c, sdp, sizeof(sdp)) != 200 || rtsp_setup(&c, 0) != 200 || rtsp_play(&c) != 200) {
+        fprintf(stderr, "Failed to start the stream\n");
+        rtsp_close(&c);
+        streamer_stop(&s);
+        return -1;
+    }
+
+    uint8_t buf[2048];
+    keyframe current = {.packets = 0};
+    int key = 0;
+    uint32_t timestamp = 0;
+    int32_t next_seq = -1;
+    uint64_t start = test_now_us();
+    while (test_now_us() - start < RUN_US && r->count < MAX_KEYFRAMES) {
+        rtp_packet p;
+        struct timeval tv;
+        if (rtp_recv(c.rtp, buf, sizeof(buf), 100, &p) != 1 || ioctl(c.rtp, SIOCGSTAMP, &tv) < 0) {
+            continue;
+        }
+        if (next_seq >= 0 && p.seq != (uint16_t) next_seq) {
+            r->seq_gaps++;
+        }
+        next_seq = (uint16_t) (p.seq + 1);
+        if (p.timestamp != timestamp || current.packets == 0) {
+            timestamp = p.timestamp;
+            current.packets = current.bytes = 0;
+            key = 0;
+        }
+        key |= rtp_nal_type(&p) == 5;
+        if (current.packets < MAX_KEY_PACKETS) {
+            current.arrival[current.packets] = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+            current.size[current.packets] = 12 + p.payload_size;
+            current.bytes += 12 + p.payload_size;
+            current.packets++;
+        }
+        if (p.marker && key && test_now_us() - start >= WARMUP_US) {
+            r->frames[r->count] = current;
+            analyze(r, &r->frames[r->count], pacing);
+            r->count++;
+        }
+        if (p.marker) {
+            current.packets = 0;
+        }
+    }
+    rtsp_close(&c);
+    streamer_stop(&s);
+
+    uint64_t median = r->count ? median_spread(r) : 0;
+    fprintf(stderr, "pacing=%u: %u keyframes of %u bytes, spread median %llu us max %llu us, "
+                    "longest gap %llu us, at most %llu bytes within %u us (%llu allowed)\n",
+            pacing, r->count, r->count ? r->frames[0].bytes : 0, (unsigned long long) median,
+            (unsigned long long) r->max_spread, (unsigned long long) r->max_gap,
+            (unsigned long long) r->max_window_bytes, BURST_WINDOW_US, (unsigned long long) r->max_window_allowed);
+    return 0;
+}
+
+static void test_unpaced(void) {
+    pacing_run r;
+    if (run(&r, 0) != 0) {
+        test_failures++;
+        return;
+    }
+    CHECK(r.count >= 4);
+    CHECK_EQ(r.seq_gaps, 0);
+    if (r.count > 0) {
+        // Every keyframe goes out in a few sendmmsg() calls
+        CHECK(median_spread(&r) < MAX_UNPACED_SPREAD_US);
+    }
+}
+
+static void test_paced(void) {
+    pacing_run r;
+    if (run(&r, PACING) != 0) {
+        test_failures++;
+        return;
+    }
+    CHECK(r.count >= 4);
+    CHECK_EQ(r.seq_gaps, 0);
+    if (r.count == 0) {
+        return;
+    }
+    // All but the first burst is spread over PACING percent of the frame interval
+    uint64_t window = (uint64_t) FRAME_INTERVAL_US * PACING / 100;
+    uint64_t bytes = r.frames[0].bytes;
+    uint64_t expected = bytes > PACING_BURST ? window * (bytes - PACING_BURST) / bytes : 0;
+    uint64_t median = median_spread(&r);
+    CHECK(median >= expected * 8 / 10);
+    CHECK(median <= window + 5000);
+    // Pacing never holds a keyframe past the next frame
+    CHECK(r.max_spread < FRAME_INTERVAL_US);
+    CHECK(r.max_window_bytes <= r.max_window_allowed);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <rtsp_streamer>\n", argv[0]);
+        return 1;
+    }
+    binary = argv[1];
+    test_init();
+    RUN_TEST(test_unpaced);
+    RUN_TEST(test_paced);
+    return test_finish();
+}
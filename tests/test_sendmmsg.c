@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "send_shim.h"
+#include "streamer_harness.h"
+#include "test.h"
+
+// Runs the server under the sendmmsg() shim, once with calls that come up
+// short and once with calls that fail outright, and holds what one loopback
+// client receives against the server's own accounting: the RTCP sender
+// reports, the metrics and the shim's count of packets that reached the kernel.
+
+#define PICTURES 400
+#define RUN_US (12 * 1000000ULL) // Long enough for a couple of RTCP sender reports
+#define PACKETS_METRIC "rtsp_rtp_packets_total{stream=\"0\"}"
+#define BYTES_METRIC "rtsp_rtp_bytes_total{stream=\"0\"}"
+#define DROPPED_METRIC "rtsp_rtp_packets_dropped_total{stream=\"0\"}"
+
+static const h264_synth video = {.pictures = PICTURES, .gop = 20, .key_size = 60000, .size = 8000};
+static const char *binary;
+
+typedef struct {
+    uint64_t packets;
+    uint64_t bytes; // RTP payload
+    uint64_t missing; // Sequence numbers that never arrived
+    int32_t next_seq;
+    uint32_t ssrc;
+    unsigned reports;
+    unsigned report_mismatches;
+} receiver;
+
+static void receive(receiver *r, const rtp_packet *p) {
+    if (r->next_seq >= 0 && p->seq != (uint16_t) r->next_seq) {
+        r->missing += (uint16_t) (p->seq - r->next_seq);
+    }
+    r->next_seq = (uint16_t) (p->seq + 1);
+    r->ssrc = p->ssrc;
+    r->packets++;
+    r->bytes += p->payload_size;
+}
+
+// Reads whatever RTP already arrived, waiting up to timeout_ms for the first packet
+static void drain(receiver *r, int fd, int timeout_ms) {
+    uint8_t buf[2048];
+    rtp_packet p;
+    while (rtp_recv(fd, buf, sizeof(buf), timeout_ms, &p) == 1) {
+        receive(r, &p);
+        timeout_ms = 0;
+    }
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+// The server sends RTP before the report on the same thread, on loopback
+// every packet counted in it is in the RTP socket by the time it arrives
+static void sender_report(receiver *r, int rtp, const uint8_t *buf, size_t size) {
+    for (size_t pos = 0; pos + 28 <= size;) {
+        size_t length = 4 * (((size_t) buf[pos + 2] << 8 | buf[pos + 3]) + 1);
+        if (buf[pos + 1] == 200 && r->packets > 0 && read_u32(buf + pos + 4) == r->ssrc) {
+            drain(r, rtp, 0);
+            uint32_t packets = read_u32(buf + pos + 20);
+            uint32_t bytes = read_u32(buf + pos + 24);
+            r->reports++;
+            if (packets != r->packets || bytes != r->bytes) {
+                fprintf(stderr, "Sender report has %u packets and %u bytes, %llu and %llu arrived\n", packets, bytes,
+                        (unsigned long long) r->packets, (unsigned long long) r->bytes);
+                r->report_mismatches++;
+            }
+        }
+        pos += length;
+    }
+}
+
+static void run(const char *short_every, const char *fail_every) {
+    char path[] = "/tmp/send_shim_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || ftruncate(fd, sizeof(send_shim_stats)) < 0) {
+        test_failures++;
+        return;
+    }
+    send_shim_stats *stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED) {
+        unlink(path);
+        test_failures++;
+        return;
+    }
+
+    // Only the server is started with the shim
+    setenv("LD_PRELOAD", SEND_SHIM, 1);
+    setenv(SEND_SHIM_STATS, path, 1);
+    setenv(SEND_SHIM_SHORT_EVERY, short_every, 1);
+    setenv(SEND_SHIM_FAIL_EVERY, fail_every, 1);
+    streamer s;
+    int started = streamer_start(&s, binary, &video, "");
+    unsetenv("LD_PRELOAD");
+    unsetenv(SEND_SHIM_STATS);
+    if (started != 0) {
+        streamer_stop(&s);
+        munmap(stats, sizeof(*stats));
+        unlink(path);
+        test_failures++;
+        return;
+    }
+
+    rtsp_client c;
+    receiver r = {.next_seq = -1};
+    char sdp[2048];
+    if (rtsp_connect(&c, s.rtsp_port, "stream") != 0 || rtsp_describe(&c, sdp, sizeof(sdp)) != 200 ||
+        rtsp_setup(&c, 0) != 200 || rtsp_play(&c) != 200) {
+        fprintf(stderr, "Failed to start the client\n");
+        test_failures++;
+    } else {
+        struct pollfd pfds[2] = {{.fd = c.rtp, .events = POLLIN}, {.fd = c.rtcp, .events = POLLIN}};
+        uint64_t end = test_now_us() + RUN_US;
+        while (test_now_us() < end) {
+            if (poll(pfds, 2, 20) <= 0) {
+                continue;
+            }
+            if (pfds[0].revents & POLLIN) {
+                drain(&r, c.rtp, 0);
+            }
+            if (pfds[1].revents & POLLIN) {
+                uint8_t buf[1500];
+                ssize_t n = recv(c.rtcp, buf, sizeof(buf), 0);
+                if (n > 0) {
+                    sender_report(&r, c.rtp, buf, (size_t) n);
+                }
+            }
+        }
+        // Once the session is gone the counters stand still
+        CHECK_EQ(rtsp_request(&c, "TEARDOWN", c.url, NULL, NULL, 0), 200);
+        c.session[0] = '\0';
+        drain(&r, c.rtp, 200);
+
+        double packets = -1, bytes = -1, dropped = -1;
+        CHECK(streamer_metric(&s, PACKETS_METRIC, &packets) == 0);
+        CHECK(streamer_metric(&s, BYTES_METRIC, &bytes) == 0);
+        CHECK(streamer_metric(&s, DROPPED_METRIC, &dropped) == 0);
+        fprintf(stderr, "%llu packets in %llu sendmmsg calls, %llu short and %llu failed, %llu never arrived\n",
+                (unsigned long long) stats->packets, (unsigned long long) stats->calls,
+                (unsigned long long) stats->short_calls, (unsigned long long) stats->failed_calls,
+                (unsigned long long) r.missing);
+
+        CHECK(r.packets > 0);
+        CHECK(stats->calls < r.packets);
+        CHECK_EQ(stats->packets, r.packets);
+        CHECK_EQ(packets, r.packets);
+        CHECK_EQ(bytes, r.bytes);
+        CHECK_EQ(dropped, r.missing);
+        CHECK(r.reports > 0);
+        CHECK_EQ(r.report_mismatches, 0);
+        if (atoi(fail_every) == 0) {
+            // The rest of a short batch goes out in the next call
+            CHECK(stats->short_calls > 0);
+            CHECK_EQ(r.missing, 0);
+        } else {
+            CHECK(stats->failed_calls > 0);
+            CHECK(r.missing > 0);
+        }
+    }
+    rtsp_close(&c);
+    streamer_stop(&s);
+    munmap(stats, sizeof(*stats));
+    unlink(path);
+}
+
+static void test_short_sends(void) {
+    run("3", "0");
+}
+
+static void test_failed_sends(void) {
+    run("0", "7");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <rtsp_streamer>\n", argv[0]);
+        return 1;
+    }
+    binary = argv[1];
+    test_init();
+    RUN_TEST(test_short_sends);
+    RUN_TEST(test_failed_sends);
+    return test_finish();
+}
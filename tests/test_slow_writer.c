@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2025 Noah Maceri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <frame_ring.h>
+#include <globals.h>
+#include <hal.h>
+#include <stream.h>
+#include "h264_synth.h"
+#include "test.h"
+
+// Runs the capture loop on the simulator in a child process and stalls its
+// writer thread for a while, with the encoder allowed to hold more frames
+// than the queue takes. The queue has to overflow, skip to a keyframe once
+// the writer is back and keep going, and the loop still has to stop when asked.
+// The writer is stalled by wrapping frame_ring_write() at link time.
+// The same child, started at night, also has to keep the IR mode on channels
+// rebuilt by a reload, which the ISP wraps below follow.
+
+#define FPS 20
+#define GOP (2 * FPS)
+#define STALL_US (3 * 1000000ULL)
+#define EXIT_TIMEOUT_MS 5000
+// The IR thread starts right away in this build, the first decision takes IR_MEDIAN_WINDOW samples
+#define NIGHT_TIMEOUT_US (10 * 1000000ULL)
+#define REBUILD_TIMEOUT_US (5 * 1000000ULL)
+#define RESTORE_TIMEOUT_US (3 * 1000000ULL)
+
+static const h264_synth video = {.pictures = 10 * GOP, .gop = GOP, .key_size = 20000, .size = 3000};
+
+// More encoder buffers than FRAME_QUEUE_SIZE, so the queue is what overflows
+static const char ini[] = "[encoder]\nwidth=1920\nheight=1080\nfps=%u\ngop=40\nmax_bitrate=1024000\n"
+                          "min_bitrate=512000\nkey_frame_interval=%u\n[simulator]\nbuffers=24\n%s";
+
+// The ISP settings the IR mode is made of, as the child last set them
+typedef struct {
+    int32_t gray_mode;
+    int32_t ir_mode;
+    int32_t ir_cut;
+    uint32_t isp_channels; // Created so far
+} isp_state;
+
+// Shared with the child
+static volatile uint8_t *stall; // Set while its writer has to wait
+static volatile isp_state *isp;
+
+uint8_t __real_frame_ring_write(frame_ring *ring, const void *data, uint32_t size, uint32_t flags, uint64_t timestamp,
+                                uint64_t recv_time);
+
+uint8_t __wrap_frame_ring_write(frame_ring *ring, const void *data, uint32_t size, uint32_t flags, uint64_t timestamp,
+                                uint64_t recv_time) {
+    while (*stall) {
+        usleep(1000);
+    }
+    return __real_frame_ring_write(ring, data, size, flags, timestamp, recv_time);
+}
+
+int __real_hal_create_isp_chn(struct rts_isp_attr *attr);
+int __real_hal_set_isp_ctrl(uint32_t id, struct rts_video_control *ctrl);
+void __real_hal_set_ir_cut(int night);
+
+// A new ISP channel starts from the defaults, day mode included
+int __wrap_hal_create_isp_chn(struct rts_isp_attr *attr) {
+    isp->gray_mode = 0;
+    isp->ir_mode = 0;
+    isp->isp_channels++;
+    return __real_hal_create_isp_chn(attr);
+}
+
+int __wrap_hal_set_isp_ctrl(uint32_t id, struct rts_video_control *ctrl) {
+    int ret = __real_hal_set_isp_ctrl(id, ctrl);
+    if (ret == 0 && id == RTS_VIDEO_CTRL_ID_GRAY_MODE) {
+        isp->gray_mode = ctrl->current_value;
+    } else if (ret == 0 && id == RTS_VIDEO_CTRL_ID_IR_MODE) {
+        isp->ir_mode = ctrl->current_value;
+    }
+    return ret;
+}
+
+void __wrap_hal_set_ir_cut(int night) {
+    isp->ir_cut = night;
+    __real_hal_set_ir_cut(night);
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void terminate() {
+    stop_stream();
+}
+
+static void run_streamer(void) {
+    signal(SIGTERM, terminate);
+    streamer_settings config;
+    frame_ring *rings[VIDEO_STREAMS];
+    if (stream_init(&config) || stream_create_rings(&config, rings)) {
+        _exit(2);
+    }
+    int ret = start_stream(config, rings);
+    stream_release(rings);
+    _exit(ret);
+}
+
+typedef struct {
+    frame_ring *ring;
+    uint32_t seq;
+    int64_t picture; // Of the last frame, -1 before the first
+    uint32_t frames;
+    uint32_t jumps;       // Frames that do not follow the one before
+    uint32_t bad_jumps;   // Of those, the ones that are not keyframes
+    uint32_t overruns;
+    uint64_t first_jump_us;
+} reader;
+
+// Reads whatever the writer put in the ring since the last call
+static void read_frames(reader *r) {
+    frame_ring_frame frame;
+    enum frame_ring_status status;
+    while ((status = frame_ring_peek(r->ring, r->seq, &frame)) != FRAME_RING_EMPTY) {
+        if (status == FRAME_RING_OVERRUN) {
+            r->overruns++;
+            r->seq = frame_ring_head(r->ring);
+            r->picture = -1;
+            continue;
+        }
+        r->seq++;
+        if (frame.nal_count == 0) {
+            continue;
+        }
+        int64_t picture = h264_synth_counter(frame.data + frame.nals[frame.nal_count - 1].offset);
+        if (r->picture >= 0 && picture != (r->picture + 1) % video.pictures) {
+            r->jumps++;
+            if (!(frame.flags & FRAME_RING_FLAG_KEY) || picture % video.gop != 0) {
+                fprintf(stderr, "Picture %lld follows %lld and is no keyframe\n", (long long) picture,
+                        (long long) r->picture);
+                r->bad_jumps++;
+            }
+            if (!r->first_jump_us) {
+                r->first_jump_us = now_us();
+            }
+        }
+        r->picture = picture;
+        r->frames++;
+    }
+}
+
+static void read_for(reader *r, uint64_t us) {
+    uint64_t end = now_us() + us;
+    while (now_us() < end) {
+        read_frames(r);
+        usleep(5000);
+    }
+}
+
+// Exit status of the child, -1 if it is still running after timeout_ms
+static int wait_exit(pid_t pid, int timeout_ms) {
+    for (int waited = 0; waited < timeout_ms; waited += 10) {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+        usleep(10 * 1000);
+    }
+    return -1;
+}
+
+static void remove_files(const char *dir) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/sim.h264", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/streamer.ini", dir);
+    unlink(path);
+}
+
+static uint8_t write_ini(const char *dir, uint32_t fps, uint32_t key_frame_interval, const char *simulator) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/streamer.ini", dir);
+    FILE *f = fopen(path, "w");
+    return f && fprintf(f, ini, fps, key_frame_interval, simulator) >= 0 && fclose(f) == 0;
+}
+
+// Starts the streamer in a scratch directory and opens its ring, the pid is 0 if that failed
+static pid_t start_child(char *dir, uint32_t key_frame_interval, const char *simulator, reader *r) {
+    char path[128];
+    *r = (reader) {.picture = -1};
+    if (!mkdtemp(dir)) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/sim.h264", dir);
+    if (h264_synth_write(path, &video) != 0 || !write_ini(dir, FPS, key_frame_interval, simulator)) {
+        fprintf(stderr, "Failed to set up %s\n", dir);
+        remove_files(dir);
+        rmdir(dir);
+        return 0;
+    }
+
+    shm_unlink(VIDEO_RING);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (chdir(dir) == 0) {
+            run_streamer();
+        }
+        _exit(2);
+    }
+
+    for (int waited = 0; pid > 0 && !r->ring && waited < 5000; waited += 10) {
+        usleep(10 * 1000);
+        r->ring = frame_ring_open(VIDEO_RING);
+    }
+    if (r->ring) {
+        r->seq = frame_ring_head(r->ring);
+    }
+    return pid > 0 ? pid : 0;
+}
+
+static void stop_child(char *dir, pid_t pid, reader *r) {
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        int status = wait_exit(pid, EXIT_TIMEOUT_MS);
+        if (status < 0) {
+            fprintf(stderr, "The capture loop did not stop\n");
+            test_failures++;
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        // A clean stop returns through main and removes the ring
+        CHECK_EQ(status, 0);
+        if (status == 0 && r->ring) {
+            CHECK(frame_ring_closed(r->ring));
+            CHECK(frame_ring_open(VIDEO_RING) == NULL);
+        }
+    }
+    frame_ring_close(r->ring);
+    shm_unlink(VIDEO_RING);
+    remove_files(dir);
+    rmdir(dir);
+}
+
+// Stalls the writer once, the first keyframe after the stall has to come within max_resync_us
+static void run(uint32_t key_frame_interval, uint64_t max_resync_us) {
+    char dir[] = "/tmp/test_slow_writer.XXXXXX";
+    reader r;
+    pid_t pid = start_child(dir, key_frame_interval, "", &r);
+    CHECK(pid > 0);
+    CHECK(r.ring != NULL);
+    if (r.ring) {
+        read_for(&r, 2000000);
+        uint32_t before = r.frames;
+        CHECK(before >= 2 * FPS * 8 / 10);
+        CHECK_EQ(r.jumps, 0);
+
+        *stall = 1;
+        read_for(&r, STALL_US);
+        *stall = 0;
+        uint64_t released = now_us();
+        read_for(&r, 3000000);
+
+        fprintf(stderr, "%u frames before the stall, %u after, %u jumps, resynced %llu ms after the stall\n", before,
+                r.frames - before, r.jumps,
+                (unsigned long long) (r.first_jump_us ? (r.first_jump_us - released) / 1000 : 0));
+        // The queue overflowed and everything after the gap starts with a keyframe
+        CHECK(r.jumps >= 1);
+        CHECK_EQ(r.bad_jumps, 0);
+        CHECK_EQ(r.overruns, 0);
+        CHECK(r.first_jump_us > released && r.first_jump_us - released < max_resync_us);
+        // Frames keep coming after the resync
+        uint32_t after = r.frames;
+        read_for(&r, 1000000);
+        CHECK(r.frames - after >= FPS * 8 / 10);
+    }
+    stop_child(dir, pid, &r);
+}
+
+static uint8_t night_mode(void) {
+    return isp->gray_mode == 1 && isp->ir_mode == 1 && isp->ir_cut == 1;
+}
+
+// Reads frames until cond holds or timeout_us passed
+static uint8_t read_until(reader *r, uint8_t (*cond)(void), uint64_t timeout_us) {
+    uint64_t end = now_us() + timeout_us;
+    while (!cond() && now_us() < end) {
+        read_for(r, 50000);
+    }
+    return cond();
+}
+
+// Starts at midnight, the reading stays far above the cutoff with the IR reflection taken off
+static const char night_ini[] = "adc_phase=0.5\n[isp]\nadc_cutoff=400\n";
+static uint32_t rebuilt_from;
+
+static uint8_t rebuilt(void) {
+    return isp->isp_channels > rebuilt_from;
+}
+
+// The overflow asks for a keyframe, which comes as soon as the writer catches up
+static void test_requested_key_frame(void) {
+    run(1000, 1500 * 1000ULL);
+}
+
+// With requests held back, frames are skipped up to the next keyframe of the GOP
+static void test_next_gop(void) {
+    run(60000, (GOP * 1000000ULL) / FPS + 500 * 1000ULL);
+}
+
+// A reload that rebuilds the stream at night gets new ISP channels in day
+// mode, the IR thread has to put gray mode, IR mode and the IR cut back
+static void test_night_rebuild(void) {
+    char dir[] = "/tmp/test_slow_writer.XXXXXX";
+    reader r;
+    memset((void *) isp, 0, sizeof(*isp));
+    pid_t pid = start_child(dir, 1000, night_ini, &r);
+    CHECK(pid > 0);
+    CHECK(r.ring != NULL);
+    if (r.ring) {
+        CHECK(read_until(&r, night_mode, NIGHT_TIMEOUT_US));
+        rebuilt_from = isp->isp_channels;
+        CHECK(write_ini(dir, FPS / 2, 1000, night_ini));
+        CHECK(read_until(&r, rebuilt, REBUILD_TIMEOUT_US));
+        uint64_t start = now_us();
+        CHECK(read_until(&r, night_mode, RESTORE_TIMEOUT_US));
+        fprintf(stderr, "Night mode back %llu ms after the rebuild\n", (unsigned long long) (now_us() - start) / 1000);
+        // And the rebuilt stream keeps going
+        uint32_t frames = r.frames;
+        read_for(&r, 1000000);
+        CHECK(r.frames - frames >= FPS / 2 * 8 / 10);
+    }
+    stop_child(dir, pid, &r);
+}
+
+int main(void) {
+    test_init();
+    stall = mmap(NULL, sizeof(*stall), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    isp = mmap(NULL, sizeof(*isp), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stall == MAP_FAILED || isp == MAP_FAILED) {
+        return 1;
+    }
+    RUN_TEST(test_requested_key_frame);
+    RUN_TEST(test_next_gop);
+    RUN_TEST(test_night_rebuild);
+    return test_finish();
+}